@@ -15,13 +15,45 @@ SOURCES += src/settings.cpp \
     src/main.cpp \
     src/governors.cpp \
     src/dialogs.cpp \
-    src/devices.cpp
+    src/devices.cpp \
+    src/input.cpp \
+    src/fangovernor.cpp \
+    src/daemon.cpp \
+    src/snapshot.cpp \
+    src/scheduler.cpp \
+    src/eventloop.cpp \
+    src/cpufreq.cpp \
+    src/topology.cpp \
+    src/reduce.cpp \
+    src/fancurve.cpp \
+    src/thermalmodel.cpp \
+    src/samplebus.cpp \
+    src/uevent.cpp \
+    src/batterylog.cpp \
+    src/sensorhistory.cpp \
+    src/historygraph.cpp
 
 HEADERS  += h/settings.h \
     h/mainwindow.h \
     h/governors.h \
     h/dialogs.h \
-    h/devices.h
+    h/devices.h \
+    h/input.h \
+    h/fangovernor.h \
+    h/daemon.h \
+    h/snapshot.h \
+    h/scheduler.h \
+    h/eventloop.h \
+    h/cpufreq.h \
+    h/topology.h \
+    h/reduce.h \
+    h/fancurve.h \
+    h/thermalmodel.h \
+    h/samplebus.h \
+    h/uevent.h \
+    h/batterylog.h \
+    h/sensorhistory.h \
+    h/historygraph.h
 
 FORMS    += ui/touchpad.ui \
     ui/mainwindow.ui \
@@ -0,0 +1,117 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef BATTERYLOG_H
+#define BATTERYLOG_H
+
+#include <QObject>
+#include <QList>
+#include "devices.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#define BATLOG_MAGIC 0x544b4231             // "TKB1"
+#define BATLOG_VERSION 1
+#define BATLOG_INDEX_HOURS 8784             // index wraps after a leap year
+#define BATLOG_MIN_INTERVAL 60              // s, between records of slowly drifting values
+#define BATLOG_MAX_RECORD 64                // bytes, longest encoded record
+
+/* Values kept for each record, times are in seconds since epoch */
+
+struct BatteryLogRecord {
+    time_t time;
+    bool installed;
+    bool acConnected;
+    int voltage;                        // mV
+    int remainingCapacity;              // mWh
+    int lastFullCapacity;               // mWh
+    int chargeLvl;                      // %
+    int cyclesCount;
+};
+
+/*
+ * Hour index is mapped from its own file. Slot for hour h is
+ * slot[h % BATLOG_INDEX_HOURS], it's only valid when slot.hour == h + 1,
+ * so zeroed slots and slots left from previous wrap are skipped.
+ */
+
+struct BatteryLogSlot {
+    uint32_t hour;                      // hours since epoch + 1, 0 if empty
+    uint32_t pad;
+    uint64_t offset;                    // first record of that hour in log
+};
+
+struct BatteryLogIndex {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t hours;
+    uint32_t pad;
+    BatteryLogSlot slot[BATLOG_INDEX_HOURS];
+};
+
+/*
+ * Append-only history of one battery. Every record is a flags byte and
+ * zigzag varints of differences against the previous record, except the
+ * first record of an hour, which holds absolute values and is pointed to
+ * by the index. Usual record is a few bytes, so log grows by hundreds of
+ * kilobytes a year and reading any time range starts from its hour.
+ *
+ * Torn record at the end of log, left by a crash, is cut on open. Only one
+ * process writes a log, other writers get a read-only one.
+ */
+
+class BatteryLog : public QObject
+{
+    Q_OBJECT
+
+public:
+    BatteryLog(Battery *bat, const QString &dir, QObject *parent = 0);
+    ~BatteryLog();
+
+    bool isOpen();
+    bool isWritable();
+
+    QList<BatteryLogRecord> read(time_t from, time_t to);
+    int dischargeRate(time_t from, time_t to);      // mW on battery, 0 if not enough data
+
+    static void setClock(time_t (*f)(time_t *));    // time() by default, checks run their own
+
+public slots:
+    void record(uint dirty);
+
+private:
+    Battery *battery;
+    int logFd;
+    int indexFd;
+    BatteryLogIndex *index;             // NULL for reader without valid index
+    bool opened;
+    bool writable;
+    uint64_t logSize;
+    BatteryLogRecord last;              // time is 0 before first record
+    bool pending;                       // drifting values changed since last record
+
+    bool openLog(const QString &path);
+    bool openIndex(const QString &path);
+    void recover();
+    void append(const BatteryLogRecord &r);
+    int decode(const uint8_t *p, int len, BatteryLogRecord *r);
+};
+
+#endif // BATTERYLOG_H
@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef CPUFREQ_H
+#define CPUFREQ_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/* Open descriptors and values of one core cpufreq files, as last read */
+
+struct CoreFreqFiles {
+    int governorFd;
+    int setspeedFd;
+    int minFreqFd;
+    int maxFreqFd;
+
+    QString governor;
+    int setspeed;
+    int minFreq;
+    int maxFreq;
+};
+
+/* Policy applied to every core, zero frequency means "don't touch" */
+
+struct CpuFreqPolicy {
+    QString governor;
+    int setspeed;
+    int minFreq;
+    int maxFreq;
+};
+
+/*
+ * CpuFreqController keeps cpufreq files of all online cores open.
+ * Applying a policy reads them back and writes only files which value
+ * differs, so switching profile costs a few pwrite() calls.
+ */
+
+class CpuFreqController {
+public:
+    CpuFreqController();
+    ~CpuFreqController();
+
+    int getCoresCount();
+    QStringList getAvailFreq();
+    int getHwMinFreq();
+    int getHwMaxFreq();
+
+    void applyPolicy(const CpuFreqPolicy &p);
+    void applyProfilePolicy(int n);     // 0 - ondemand, n - n-th available frequency
+    void setGovernor(QString);
+    void setFreq(int);
+
+private:
+    QVector<CoreFreqFiles> cores;
+    QStringList availFreq;
+    int hwMinFreq;
+    int hwMaxFreq;
+
+    void refreshCore(CoreFreqFiles *c);
+    bool writeString(int fd, QString *cached, const QString &val);
+    bool writeInt(int fd, int *cached, int val);
+};
+
+#endif // CPUFREQ_H
@@ -0,0 +1,129 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include <QSocketNotifier>
+#include <QTimer>
+#include "settings.h"
+
+#include <sys/types.h>
+
+#define THINKCTLD_SOCKET_PATH "/var/run/thinkctld.sock"
+#define THINKCTLD_PID_PATH "/var/run/thinkctld.pid"
+#define THINKCTLD_RECONNECT_INTERVAL 2000   // ms, between tries after daemon went away
+#define THINKCTLD_GROUP "thinkctl"          // members may steer the fan, root always can
+
+class Governor;
+
+/*
+ * DaemonServer runs inside thinkctld. It accepts GUI connections on a unix
+ * socket and applies line based commands to the fan governor:
+ *
+ *   mode <0|1>
+ *   level <n|auto|full-speed>
+ *   profile cpuMin cpuMid cpuMax gpuMin gpuMid gpuMax mchMin mchMid mchMax treshold
+ *           [pidControl targetTemp]
+ *   curve <cpu|gpu|mch> temp:level ...
+ *
+ * Socket is 0660 and belongs to the control group. Peer credentials are
+ * checked on accept too, so a socket left with wrong owner doesn't let
+ * other users in.
+ *
+ * Only one daemon runs at a time: it holds a lock on its pid file for
+ * life, and the socket is replaced only by the holder of that lock.
+ */
+
+class DaemonServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    DaemonServer(Governor *, Profile *, const QString &group = THINKCTLD_GROUP);
+    ~DaemonServer();
+
+    bool isListening();
+
+private:
+    int listenFd;
+    int pidFd;                              // locked while we run
+    QSocketNotifier *listenNotifier;
+    QSocketNotifier *signalNotifier;
+    QHash<int, QSocketNotifier*> clients;
+    QHash<int, QByteArray> pending;          // incomplete lines
+
+    Governor *gov;
+    Profile *profile;
+    gid_t groupId;                          // (gid_t)-1 if group doesn't exist
+
+    bool lockPidFile();
+    bool isPeerAllowed(int fd);
+    void processCommand(const QByteArray &);
+    void dropClient(int fd);
+
+private slots:
+    void newConnection();
+    void readClient(int fd);
+    void signalReceived();
+
+signals:
+    void profileUpdated(const Profile &);       // profile was changed by a client
+};
+
+/*
+ * Thin client used by the GUI to steer thinkctld. Daemon going away is
+ * noticed on send or when it closes the socket, then client tries to
+ * connect again every THINKCTLD_RECONNECT_INTERVAL. Commands sent
+ * meanwhile are dropped, owner sends its state again on reconnected().
+ */
+
+class DaemonClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    DaemonClient(QObject *parent = 0);
+    ~DaemonClient();
+
+    bool isConnected();
+
+    void sendMode(bool);
+    void sendLevel(QString);
+    void sendProfile(Profile *);
+
+private:
+    int fd;
+    QSocketNotifier *notifier;
+    QTimer *retry;
+
+    bool open();
+    void lost();
+    void sendLine(const QByteArray &);
+
+private slots:
+    void readDaemon();
+    void reconnect();
+
+signals:
+    void disconnected();
+    void reconnected();
+};
+
+#endif // DAEMON_H
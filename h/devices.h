@@ -30,70 +30,83 @@
 #include <QDebug>
 #include <QSettings>
 #include <QFileSystemWatcher>
+#include <QVector>
+#include <QElapsedTimer>
 
+#include <stdint.h>
 
-class Timer : public QObject {
+#include "topology.h"
+#include "reduce.h"
 
-    Q_OBJECT
-
-public:
-    Timer();
-
-    void setTimerInterval(int i);
-
-signals:
-    void timeout();
+#define THERMAL_SLOTS 16            // max number of values in thinkpad thermal file
+#define SENSOR_NONE -128            // thinkpad_acpi value for absent sensor
+#define HISTORY_SYSTEM_DIR "/var/lib/thinkctl"  // battery and sensor history of thinkctld
 
-private slots:
-    void timeIsOut();
+void setHwRoot(const QString &root);
+QString getHwRoot();
+QString hwPath(const QString &path);        // absolute hardware path under root
+QString historyDir();                       // system one for root, per user one otherwise
 
-private:
-    QTimer t;
-};
+class SampleBus;
 
 /* Sensor class represents each thinkpad sensor */
 
 class Sensor {
 public:
-    Sensor(QStringList *, int, int);
-    QString getTemp();
+    Sensor(const int16_t *, int, int);
+    int getTemp();              // SENSOR_NONE if sensor isn't present
+    int getTemp(const int16_t *thermal);    // same slot of a sample copy
     int getCritTemp();
 
 private:
     int critTemp;               // critical temperature of device
     int positionNum;            // calculated position in thermal file
-    QStringList *valuesPtr;
+    const int16_t *valuesPtr;
 };
 
 
 /*
  * Cpu class represent interface for acquaring core temperatures
- * and frequency controlling.
+ * and frequency info, frequency is controlled by CpuFreqController.
+ * getTemp() is the hottest core or package, so fan reacts to it.
  */
 
 class Cpu {
 public:
     Cpu();
-    int getAvailCores();
+    ~Cpu();
+
+    void refresh();             // read core inputs and load, called once per tick
+    int getAvailCores();        // online logical cpus
+    int getPhysCores();
+    int getPackages();
     QStringList getAvailFreq();
     int getTemp();
+    int getAvgTemp();
+    int getLoad();              // %, busy share since previous refresh
+    const CpuTemps *getTemps();
     int getCritTemp();
     int getCurFreq();
     QString getCurGovernor();
 
-    void setFreq(int);
-    void setGovernor(QString);
-
 private:
     int availCores;
     int critTemp;
-    QList<QFile*> file;
-    QList<QTextStream*> txtStr;
+    CpuTopology topology;
+    CpuTemps temps;             // values of last refresh()
+
+    int statFd;
+    int load;
+    unsigned long long prevBusy, prevTotal;
+
+    void refreshLoad();
 };
 
 /* Gpu interface */
 class AbstractGpu {
 public:
+    virtual ~AbstractGpu() {}
+
     virtual QStringList getProfiles() = 0;
     virtual int getCurProfile() = 0;
     virtual void setProfile(int p) = 0;
@@ -134,12 +147,13 @@ private:
 
 class Gpu : public Sensor {
 public:
-    Gpu(QStringList *sLst, int pNum, int cTmp) : Sensor(sLst, pNum, cTmp) {
+    Gpu(const int16_t *vPtr, int pNum, int cTmp) : Sensor(vPtr, pNum, cTmp) {
 
-        QFile f("/proc/modules");                       // check for module presence
+        QFile f(hwPath("/proc/modules"));                     // check for module presence
         QTextStream ts(&f);
         f.open(QIODevice::ReadOnly);
 
+        gpu = NULL;                                         // only radeon has a driver class
         if (ts.readAll().contains("radeon")) {
             gpu = new Radeon();
             present = true;
@@ -170,45 +184,155 @@ private:
     AbstractGpu *gpu;
 };
 
+/*
+ * Fields of BatterySnapshot, set in dirty mask when a refresh changed
+ * them. Identity fields are read once when battery appears, the rest on
+ * every refresh.
+ */
+
+#define BAT_INSTALLED           (1 << 0)
+#define BAT_AC_CONNECTED        (1 << 1)
+#define BAT_STATE               (1 << 2)
+#define BAT_CHARGE_LVL          (1 << 3)
+#define BAT_RUNNING_TIME        (1 << 4)
+#define BAT_CHARGING_TIME       (1 << 5)
+#define BAT_CYCLES              (1 << 6)
+#define BAT_VOLTAGE             (1 << 7)
+#define BAT_REMAINING_CAP       (1 << 8)
+#define BAT_FULL_CAP            (1 << 9)
+#define BAT_IDENTITY            (1 << 10)      // all fields below dynamic ones
+#define BAT_ALL                 ((1 << 11) - 1)
+
+struct BatterySnapshot {
+    bool installed;
+    bool acConnected;
+    QString state;                      // none, idle, charging or discharging
+    int chargeLvl;                      // %
+    int runningTime;                    // min
+    int chargingTime;                   // min
+    int cyclesCount;
+    int voltage;                        // mV
+    int remainingCapacity;              // mWh
+    int lastFullCapacity;               // mWh
+
+    QString firstUseDate;
+    QString manufacturer;
+    QString model;
+    QString type;
+    int designCapacity;                 // mWh
+    int designVoltage;                  // mV
+    QString manufactureDate;
+};
+
+/*
+ * Battery interface. read() fills dynamic fields in one pass and only
+ * touches the rest of them when battery is installed.
+ */
+
+class AbstractBatteryBackend {
+public:
+    virtual ~AbstractBatteryBackend() {}
+
+    virtual QString getName() = 0;
+    virtual void read(BatterySnapshot *s) = 0;
+    virtual void readIdentity(BatterySnapshot *s) = 0;
+
+    virtual int getStartThreshold() = 0;
+    virtual int getStopThreshold() = 0;
+    virtual void setStartThreshold(int n) = 0;
+    virtual void setStopThreshold(int n) = 0;
+};
+
+/* tp_smapi, attribute files are held open in BATn directory */
+
+class SmapiBattery : public AbstractBatteryBackend {
+public:
+    SmapiBattery(int batNum);
+    ~SmapiBattery();
+
+    QString getName();
+    void read(BatterySnapshot *s);
+    void readIdentity(BatterySnapshot *s);
+
+    int getStartThreshold();
+    int getStopThreshold();
+    void setStartThreshold(int n);
+    void setStopThreshold(int n);
+
+private:
+    enum { INSTALLED, STATE, CHARGE_LVL, RUNNING_TIME, CHARGING_TIME, CYCLES, VOLTAGE,
+           REMAINING_CAP, FULL_CAP, DYNAMIC_FILES };
+
+    QString batPath;
+    int dirFd;
+    int acFd;
+    int fd[DYNAMIC_FILES];
+
+    QString readString(const char *name);
+};
+
+/*
+ * Generic power_supply class battery. Its uevent file carries every field
+ * at once, so a refresh is a single read.
+ */
+
+class PowerSupplyBattery : public AbstractBatteryBackend {
+public:
+    PowerSupplyBattery(const QString &dir, const QString &acDir);
+    ~PowerSupplyBattery();
+
+    QString getName();
+    void read(BatterySnapshot *s);
+    void readIdentity(BatterySnapshot *s);
+
+    int getStartThreshold();
+    int getStopThreshold();
+    void setStartThreshold(int n);
+    void setStopThreshold(int n);
+
+private:
+    QString batPath;
+    int ueventFd;
+    int acFd;                           // online file of mains supply, -1 if none
+};
+
+/*
+ * Battery with change detection on top of a backend. refresh() emits
+ * snapshotChanged() with fields which differ from the previous pass.
+ */
+
 class Battery : public QObject {
     Q_OBJECT
 
 public:
-    Battery(int batNum);
-
-    bool isInstalled(void);
-    bool isACConnected(void);
-
-    QString getState(void);
-    int getChargeLvl(void);
-    int getRemainingRunningTime(void);
-    int getChargingTime(void);
-    int getCyclesCount(void);
-    int getCurrentVoltage(void);
-    int getRemainingCapacity(void);
-    QString getFirstUseDate(void);
-
-    QString getManufacturer(void);
-    QString getModel(void);
-    QString getType(void);
-    int getDesignCapacity(void);
-    int getDesignVoltage(void);
-    QString getManufactureDate(void);
+    Battery(AbstractBatteryBackend *b);     // takes ownership
+    ~Battery();
+
+    QString getName();
+    const BatterySnapshot &getSnapshot();
 
     int getStartChargingTreshold(void);
     int getStopChargingTreshold(void);
     void setStartChargingTreshold(int n);
     void setStopChargingTreshold(int n);
 
+public slots:
+    void refresh();
+
+signals:
+    void snapshotChanged(uint dirty);
+
 private:
-    bool powerConnected;
-    int startChargeTreshold;
-    int stopChargeTreshold;
-    QString batPath;
+    AbstractBatteryBackend *backend;
+    BatterySnapshot snap;
 
-    QSettings *settings;
+    uint read();
 };
 
+QList<Battery *> findBatteries();       // tp_smapi if loaded, power_supply otherwise
+BatterySnapshot sumBatteries(const QList<Battery *> &bats);
+QString findMainsSupply();              // power_supply directory of AC adapter, empty if none
+
 /*
  * SensorsArray represents all thinkpad sensors and interface
  * for updating their thermal values.
@@ -220,6 +344,7 @@ class SensorsArray : public QObject
 
 public:
     SensorsArray();
+    ~SensorsArray();
 
     Cpu *cpu;
     Gpu *gpu;
@@ -233,10 +358,20 @@ public:
     Sensor *bayBatFirst;
     Sensor *bayBatSecond;
 
+    void getThermValues(int16_t *out);      // copy THERMAL_SLOTS values
+    ZoneStats getThermStats();
+    int getMaxRise();                       // degrees above moving average
+
+    void setSampleBus(SampleBus *b);        // every update is published there
+
 private:
-    QFile thermalSrc;
-    QTextStream stream;
-    QStringList values;
+    int thermalFd;
+    int fanFd;
+    SampleBus *bus;
+    int16_t values[THERMAL_SLOTS];
+    int32_t trend[THERMAL_SLOTS];           // EWMA of values, Q8
+    ZoneStats stats;
+    int maxRise;
 
 public slots:
     void updateThermValues();
@@ -245,7 +380,26 @@ signals:
     void thermalValuesUpdated();
 };
 
-/* Fan represents interface for controlling fan speed */
+/*
+ * Fan represents interface for controlling fan speed. Commands go
+ * straight to the fd, a command equal to the last one is not written.
+ * Automatic control uses requestLevel(), which also holds a level for
+ * FAN_MIN_DWELL_MS before going down, so the fan doesn't hunt.
+ *
+ * thinkpad_acpi watchdog returns fan to auto when nothing was written to
+ * it for given seconds. kickWatchdog() is called from the control loop on
+ * every tick and rewrites "watchdog <n>" when no other command re-armed
+ * it recently, so a stalled loop can't leave fan stopped.
+ */
+
+/* Fan level values which aren't numbers in thinkpad fan file */
+
+#define FAN_LEVEL_AUTO -1
+#define FAN_LEVEL_FULL -2           // full-speed or disengaged, as read back
+#define FAN_LEVEL_UNKNOWN -3
+#define FAN_LEVEL_FULL_SPEED 8      // as commanded, above every level
+#define FAN_MIN_DWELL_MS 5000
+#define FAN_WATCHDOG_TIMEOUT 15     // s, several slowest thermal ticks
 
 class Fan {
 public:
@@ -254,14 +408,37 @@ public:
     QString getLevel();
     QString getStatus();
     int getSpeed();
-    void setLevel(int);
-    void setLevelAuto();
-    void setFullSpeed();
+    virtual void setLevel(int);
+    virtual void setLevelAuto();
+    virtual void setFullSpeed();
     void setFanOff();
 
+    int getCommandedLevel();            // last written FAN_LEVEL_* or 0..7
+    void forgetLevel();                 // next command is written in any case
+    unsigned long getWritesIssued();
+    unsigned long getWritesSuppressed();
+
+    void setWatchdog(int seconds);      // 0 disables, armed on next kick
+    void kickWatchdog();
+
+protected:
+    bool requestLevel(int l);           // true if fan is at l afterwards
+
 private:
     QFile fanSrc;
     QTextStream stream;
+
+    int commanded;
+    QElapsedTimer lastChange;
+    QElapsedTimer lastWrite;            // any command re-arms watchdog
+    unsigned long writesIssued;
+    unsigned long writesSuppressed;
+    int watchdog;
+    bool watchdogArmed;
+    bool writable;
+
+    bool command(int l);
+    bool write(const QByteArray &cmd);
 };
 
 /* Interface for controlling wireless device */
@@ -306,105 +483,18 @@ private:
     float biosVer;
 };
 
-/* IBM TrackPoint configuration */
-
-class TrackPoint {
-public:
-    TrackPoint();
-    ~TrackPoint();
-
-    bool getState();
-    bool getScrollingState();
-    bool getPressToSelectState();
-    bool getMiddleBtnState();
-    int getCurSpeed();
-    int getCurSensitivity();
-    int getCurInertia();
-
-    void setEnabled(bool st);
-    void setScrollingEnabled(bool st);
-    void setPressToSelectEnabled(bool st);
-    void setMiddleBtnEnabled(bool st);
-    void setSpeed(int n);
-    void setSensitivity(int n);
-    void setInertia(int n);
-
-    void applySettings();               // Apply settings after resume from suspend
-
-private:
-    long int devID;                     // Bug in including order. So we can't use XID type
-    bool devPresented;
-    int devEnabled;
-    bool scrollingState;
-    bool pressToSelectState;
-    bool middleBtnState;
-
-    int speed;
-    int sensitivity;
-    int inertia;
-    QSettings *settings;
-
-    int getSpeedValue();
-    int getSensitivityValue();
-};
-
-/* TouchPad configuration */
-
-class TouchPad {
-public:
-    TouchPad();
-    ~TouchPad();
-
-    bool isPresent();
-
-    bool getState();
-    bool getTwoFingetVertScrolling();
-    bool getTwoFingerHorizScrolling();
-    int getVertScrollingSpeed();
-    int getHorizScrollingSpeed();
-    bool getEdgeVertScrollingState();
-    bool getEdgeHorizScrollingState();
-    bool getEdgeCoastingState();
-    int getCoastingAccel();
-    int getCoastingDecel();
-
-    void setEnabled(bool st);
-    void setTwoFingerVertScrolling(bool st);
-    void setTwoFingerHorizScrolling(bool st);
-    void setVertScrollingSpeed(int n);
-    void setHorizScrollingSpeed(int n);
-    void setEdgeVertScrolling(bool st);
-    void setEdgeHorizScrolling(bool st);
-    void setEdgeCoasting(bool st);
-    void setCoastingAccel(int n);
-    void setCoastingDecel(int n);
-
-    void applySettings();
-
-private:
-    long int devID;
-    bool devPresented;
-    int devEnabled;
-
-    int twoFingerVertScrolling;
-    int twoFingerHorizScrolling;
-    int vertScrollingSpeed;
-    int horizScrollingSpeed;
-    int edgeVertScrolling;
-    int edgeHorizScrolling;
-    int edgeCoasting;
-
-    float coastingAccel;
-    float coastingDecel;
-
-
-    QSettings *settings;
-};
-
 bool isSettingsExists(const QSettings *s);
 
 int getIntValueFromFile(QString path);
 void setIntValueToFile(QString path, int val);
 QString getStringValueFromFile(QString path);
 
+int readIntFromFd(int fd);
+QString readStringFromFd(int fd);
+int parseThermValues(const char *buf, int len, int16_t *vals, int n);
+void parseFanStatus(const char *buf, int len, int *speed, int *level);
+
+int fanLevelToInt(QString);
+QString fanLevelToString(int);
+
 #endif // DEVICES_H
@@ -23,6 +23,7 @@
 #include <QDialog>
 #include "settings.h"
 #include "devices.h"
+#include "input.h"
 #include "governors.h"
 
 namespace Ui {
@@ -49,6 +50,9 @@ private slots:
 private:
     Ui::FanPresetDialog *ui;
     Profile *pf;
+
+signals:
+    void profileEdited();
 };
 
 class ProfileLineDialog : public QDialog
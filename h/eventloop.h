@@ -0,0 +1,77 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSocketNotifier>
+
+#include <stdint.h>
+
+#define EVENTLOOP_MAX_EVENTS 16
+
+/* Implemented by everything which waits for descriptors in EventLoop */
+
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+    virtual void handleEvent(int fd, uint32_t events) = 0;
+};
+
+struct EventSource {
+    int fd;
+    bool timer;                 // read expiration counter before handler
+    EventHandler *handler;      // NULL once removed
+};
+
+/*
+ * Small epoll based loop for the sampling core. All descriptors (timerfd
+ * timers, ALSA mixer, hotplug sockets) live in one epoll set, and only the
+ * epoll descriptor itself is watched by Qt through QSocketNotifier. So
+ * the process sleeps until one of them is really ready.
+ */
+
+class EventLoop : public QObject
+{
+    Q_OBJECT
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    bool addFd(int fd, uint32_t events, EventHandler *h);
+    void removeFd(int fd);
+
+    int addTimer(EventHandler *h);                  // returns timerfd or -1
+    void setTimer(int tfd, int ms, bool repeat);    // ms == 0 disarms timer
+    void removeTimer(int tfd);
+
+private:
+    int epollFd;
+    QSocketNotifier *notifier;
+    QHash<int, EventSource*> sources;
+    QList<EventSource*> removed;        // freed after current dispatch
+
+    bool addSource(int fd, uint32_t events, EventHandler *h, bool timer);
+
+private slots:
+    void dispatch();
+};
+
+#endif // EVENTLOOP_H
@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef FANCURVE_H
+#define FANCURVE_H
+
+#include <QString>
+#include <QVector>
+
+#include <stdint.h>
+
+#define FAN_CURVE_TEMPS 128             // lookup table covers 0..127 C
+#define FAN_CURVE_MAX_LEVEL 7
+#define FAN_CURVE_MAX_POINTS 16
+#define FAN_CURVE_MAX_HYSTERESIS 15
+
+struct FanPoint {
+    int temp;
+    int level;
+};
+
+/*
+ * FanCurve maps sensor temperature to fan level. Between points level is
+ * interpolated linearly, outside them it's the level of nearest point.
+ * Curve is expanded into a table indexed by degree, so evaluation is two
+ * table loads. Hysteresis: level goes down only when temperature falls
+ * hysteresis degrees below the point where it went up.
+ *
+ * Text form, used in profiles file and daemon protocol: "50:1 60:5 70:7".
+ */
+
+class FanCurve {
+public:
+    FanCurve();
+
+    bool setPoints(const QVector<FanPoint> &p, int hyst, QString *err = 0);
+    bool setTriplet(int min, int mid, int max, int hyst, QString *err = 0);
+    bool fromString(const QString &s, int hyst, QString *err = 0);
+    QString toString();
+
+    QVector<FanPoint> getPoints();
+    int getHysteresis();
+    void setHysteresis(int hyst);
+
+    int level(int temp, int curLevel);      // curLevel -1 if unknown
+    bool isNear(int temp, int degrees);     // temp close to level step
+
+    static bool validate(const QVector<FanPoint> &p, int hyst, QString *err);
+
+private:
+    QVector<FanPoint> points;
+    int hysteresis;
+    int8_t table[FAN_CURVE_TEMPS];
+
+    void buildTable();
+};
+
+/* For built-in profiles: min < mid < max and steps wider than hysteresis */
+
+#define FAN_TRIPLET_VALID(min, mid, max, hyst) \
+    ((min) > 0 && (max) < FAN_CURVE_TEMPS && (hyst) >= 0 && (hyst) <= FAN_CURVE_MAX_HYSTERESIS && \
+     (mid) - (min) > (hyst) && (max) - (mid) > (hyst))
+
+#define FAN_STATIC_ASSERT(expr, name) typedef char name[(expr) ? 1 : -1]
+
+#endif // FANCURVE_H
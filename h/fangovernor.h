@@ -0,0 +1,106 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef FANGOVERNOR_H
+#define FANGOVERNOR_H
+
+#include <QObject>
+#include "devices.h"
+#include "settings.h"
+#include "daemon.h"
+#include "thermalmodel.h"
+#include "samplebus.h"
+
+
+/* Fan Governor classes definitions */
+
+/*
+ * Closed loop mode: PID on the hottest cpu temperature against profile
+ * target, with feed-forward from cpu load. Output is a fan level, where
+ * PID_MAX_LEVEL stands for "level disengaged" (full-speed).
+ */
+
+#define PID_KP 0.35                 // levels per degree
+#define PID_KI 0.015                // levels per degree*second
+#define PID_KD 1.0                  // levels per degree/second
+#define PID_KFF 0.02                // levels per % of cpu load
+#define PID_D_FILTER 0.3            // weight of new derivative sample
+#define PID_MAX_DT 10.0             // s, longer gaps restart the loop
+#define PID_MAX_LEVEL FAN_LEVEL_FULL_SPEED
+#define PID_LEVEL_HYSTERESIS 0.3    // on top of rounding, avoids level flapping
+
+class Governor: public QObject,
+        public Fan
+{
+    Q_OBJECT
+
+public:
+    Governor(SensorsArray *, SampleBus *, Profile *);
+
+    void attachDaemon(DaemonClient *);
+    void adjustFanSpeed(const Sample &);
+
+/* May live in control thread, GUI reaches these through queued connections */
+
+public slots:
+    void profileChanged(const Profile &);
+    void setMode(bool);
+    void setLevel(int);
+    void setLevelAuto();
+    void setFullSpeed();
+    void fanOff(bool);
+    void fanFullSpeed(bool);
+
+private:
+    bool mode;              // true - preset, false - manual
+    int cpuLvl;             // levels of sensor curves, carry hysteresis
+    int gpuLvl;
+    int mchLvl;
+    int prevLevel;
+
+    ThermalZoneModel cpuModel;  // predict temperatures THERMAL_HORIZON ahead
+    ThermalZoneModel gpuModel;
+    ThermalZoneModel mchModel;
+    qint64 modelTime;           // timestamp of last sample, -1 if none
+
+    double pidIntegral;
+    double pidDeriv;            // filtered d(temp)/dt
+    int pidPrevTemp;
+    int pidLevel;               // level fan was set to, -1 if unknown
+    qint64 pidTime;
+
+    void adjustFanPid(const Sample &);
+    void resetCurves();
+    void updateModels(const Sample &);
+    void resetPid();
+
+    SensorsArray *snsArray;     // only for layout of thermal slots
+    SampleSubscriber *samples;
+    Profile profile;
+    DaemonClient *daemon;       // set when fan is driven by thinkctld
+
+private slots:
+    void refresh();
+
+signals:
+    void showCtrldBox(bool);
+    void showModeBoxes(bool);
+};
+
+#endif // FANGOVERNOR_H
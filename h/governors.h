@@ -23,6 +23,9 @@
 #include <QObject>
 #include "devices.h"
 #include "settings.h"
+#include "fangovernor.h"
+#include "eventloop.h"
+#include "samplebus.h"
 
 #include <QtDBus/QtDBus>
 
@@ -31,43 +34,6 @@
 #endif
 
 
-/* Fan Governor classes definitions */
-
-class Governor: public QObject,
-        public Fan
-{
-    Q_OBJECT
-
-public:
-    Governor(SensorsArray *, Profile *);
-
-    void profileChanged(Profile *);
-
-public slots:
-    void setMode(bool);
-    void fanOff(bool);
-    void fanFullSpeed(bool);
-
-private:
-    bool mode;              // true - preset, false - manual
-    int cpuTdTmp;           // temp values for treshold states
-    int gpuTdTmp;           // prevent for constant level switching
-    int mchTdTmp;
-    int prevLevel;
-
-    SensorsArray *snsArray;
-    Profile *plPtr;
-
-    void adjustFanSpeed();
-
-private slots:
-    void refresh();
-
-signals:
-    void showCtrldBox(bool);
-    void showModeBoxes(bool);
-};
-
 /* Warning Levels Governor classes definitions */
 
 enum WLevelsT {NSEN, NORM, WARN, CRIT};
@@ -81,6 +47,45 @@ struct WLDevice {
     bool critNotifyWasSent;
 };
 
+#define NOTIFY_MAX_BACKLOG 8
+#define NOTIFY_TIMEOUT_MS 5000          // instead of 25 s D-Bus default
+#define NOTIFY_VOLUME_ID 29             // replaces_id, volume popups replace each other
+
+struct NotifyMsg {
+    QString body;
+    uint replacesId;
+};
+
+/*
+ * Notify calls go out asynchronously one at a time, the rest waits in a
+ * bounded backlog, so a slow or missing notification daemon never blocks
+ * the caller. A message equal to one waiting or in flight is dropped, one
+ * with the same replaces_id takes the place of the waiting one, and when
+ * backlog is full the oldest message goes.
+ */
+
+class NotifyQueue : public QObject {
+    Q_OBJECT
+
+public:
+    NotifyQueue(QObject *parent = 0);
+    ~NotifyQueue();
+
+    void post(const QString &body, uint replacesId);
+    unsigned long getDropped();
+
+private:
+    QList<NotifyMsg> backlog;
+    QDBusPendingCallWatcher *inFlight;  // NULL when idle
+    NotifyMsg current;
+    unsigned long dropped;
+
+    void dispatch();
+
+private slots:
+    void callFinished(QDBusPendingCallWatcher *w);
+};
+
 class Notifications {
 public:
     Notifications();
@@ -98,7 +103,7 @@ public:
     void sendVolumeLvl(int v, bool m);
 
 private:
-    QDBusInterface *notify;
+    NotifyQueue *queue;
     QSettings *settings;
 
     bool warnNotify;
@@ -115,16 +120,14 @@ private:
 
 class CritTempActions {
 public:
-    CritTempActions();
-    ~CritTempActions();
-
     void performSuspend();
     void performHibernate();
     void performShutdow();
 
 private:
-    bool actionWasCompleted;
-    QDBusInterface *dbus;
+    QDBusPendingReply<> action;         // finished when no request is outstanding
+
+    void requestAction(const QString &method);
 };
 
 class WLGovernor: public QObject,
@@ -134,7 +137,7 @@ class WLGovernor: public QObject,
     Q_OBJECT
 
 public:
-    WLGovernor(SensorsArray *, ProfileList *);
+    WLGovernor(SensorsArray *, SampleBus *, ProfileList *);
     ~WLGovernor();
 
     WLevelsT cpuGetLevel();
@@ -163,7 +166,8 @@ public:
     void setFallbackProfile(int n);
 
 private:    
-    SensorsArray *snsArray;
+    SensorsArray *snsArray;             // only for layout of thermal slots
+    SampleSubscriber *samples;
     Settings *sttgs;
     ProfileList *pfls;
     QSettings *settings;
@@ -188,7 +192,7 @@ private:
     WLDevice bayBatFirst;
     WLDevice bayBatSecond;
 
-    WLevelsT checkLevel(QString, WLDevice *, QString, int);
+    WLevelsT checkLevel(QString, WLDevice *, int, int);
     void checkForCritActions();
 
     void loadSettings();
@@ -209,24 +213,28 @@ class BatteryGovernor : public QObject {
 
 public:
     BatteryGovernor();
+    ~BatteryGovernor();
 
-    Battery *mainBat;
+    Battery *mainBat;                   // first one, shown on battery tab
 
-    bool isModulePresent(void);
+    bool isModulePresent(void);         // any battery backend found
+    QList<Battery *> getBatteries();
 
 public slots:
     void updateBatteriesState();
     void mainBatSetStartChargeTreshold(int n);
     void mainBatSetStopChargeTreshold(int n);
 
+private slots:
+    void mainBatChanged(uint dirty);
+
 signals:
-    void mainBatValuesChanged();
+    void mainBatValuesChanged(uint dirty);  // BAT_* fields that changed
     void mainBatInstalled(bool);
-//    void mainBatStateChanged(QString);
 
 private:
     bool presence;
-    QString mainBatPrevState;   // avoid repeating
+    QList<Battery *> batteries;
 
     QSettings *settings;
     void loadSettings();
@@ -287,18 +295,22 @@ private:
     void sendKosd(int n, bool m);
 };
 
-class TPVolume : public QObject
+class TPVolume : public QObject,
+        public EventHandler
 {
     Q_OBJECT
 
 public:
-    TPVolume();
+    TPVolume(EventLoop *);
     ~TPVolume();
 
     int getCurrentVolumeLvl();
 
+    void handleEvent(int fd, uint32_t events);
+
 private:
-    QTimer *timer;
+    EventLoop *loop;
+    QList<int> pollFds;             // mixer descriptors registered in loop
 
     snd_mixer_t *handle;
     snd_mixer_elem_t *elem;
@@ -307,9 +319,6 @@ private:
 
     static int showVolumeLvl(snd_mixer_elem_t *e, unsigned int m);
 
-private slots:
-    void checkForEvent();
-
 signals:
     void sendMessage(int);
 };
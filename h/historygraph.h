@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef HISTORYGRAPH_H
+#define HISTORYGRAPH_H
+
+#include <QWidget>
+#include <QPixmap>
+#include <QPainter>
+#include "sensorhistory.h"
+
+#define GRAPH_STEP 2                        // px per raw point
+#define GRAPH_TEMP_MIN 20                   // C at the bottom
+#define GRAPH_TEMP_MAX 100                  // C at the top
+#define GRAPH_TEMP_GRID 20                  // C between grid lines
+#define GRAPH_RPM_MAX 8000                  // rpm at the top
+#define GRAPH_MAX_GAP 15000                 // ms, points further apart aren't joined
+
+/*
+ * Temperatures of all thermal slots, the hottest one and fan rpm over the
+ * last raw points of sensor history, one GRAPH_STEP column per point.
+ *
+ * Plot is kept in a pixmap. New points scroll it left and only their
+ * columns are drawn, paintEvent() just blits it. Scales are fixed, so old
+ * columns never need redrawing. While widget is hidden (other tab, window
+ * in tray) it's disconnected from history and pixmap is rebuilt once on
+ * show.
+ */
+
+class HistoryGraph : public QWidget
+{
+    Q_OBJECT
+
+public:
+    HistoryGraph(QWidget *parent = 0);
+
+    void setHistory(SensorHistory *h);
+
+protected:
+    void paintEvent(QPaintEvent *);
+    void resizeEvent(QResizeEvent *);
+    void showEvent(QShowEvent *);
+    void hideEvent(QHideEvent *);
+
+private:
+    SensorHistory *history;
+    QPixmap plot;
+    uint64_t drawn;                     // newest raw point on plot, 0 if plot must be rebuilt
+    HistoryPoint last;                  // that point
+
+    int tempY(int t);
+    int rpmY(int rpm);
+    int hottest(const HistoryPoint &p);
+    void rebuild();
+    void drawBackground(QPainter &p, int x, int w);
+    void drawSegment(QPainter &p, int x, const HistoryPoint &a, const HistoryPoint &b);
+
+private slots:
+    void pointsAppended();
+};
+
+#endif // HISTORYGRAPH_H
@@ -0,0 +1,160 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "devices.h"
+#include <QHash>
+#include <QByteArray>
+
+/*
+ * One X display connection for all input devices. Atoms and opened
+ * devices are cached for the life of the session, and property changes
+ * made between begin() and commit() are sent out by one XFlush, so
+ * applying a whole profile is one burst of requests. Outside of a batch
+ * every change is flushed right away. X types aren't used here because
+ * X headers break Qt ones when included first.
+ */
+
+class XInputSession {
+public:
+    XInputSession();
+    ~XInputSession();
+
+    bool isOpen();
+    long int findDevice(const char *name);     // -1 if not found
+
+    void setProp(long int dev, const char *prop, int val, int val2 = -1, int val3 = -1, int val4 = -1);
+    void setProp32(long int dev, const char *prop, int fmt, int val, int val2 = -1);
+    void setPropFloat(long int dev, const char *prop, float val, float val2 = -1);
+
+    void begin();
+    void commit();
+
+private:
+    void *display;
+    QHash<QByteArray, unsigned long> atoms;
+    QHash<long int, void *> devices;    // XDevice * by id
+    int batchDepth;
+
+    unsigned long atom(const char *name);
+    void *device(long int dev);
+    void changed();
+};
+
+
+/* IBM TrackPoint configuration */
+
+class TrackPoint {
+public:
+    TrackPoint(XInputSession *);
+    ~TrackPoint();
+
+    bool getState();
+    bool getScrollingState();
+    bool getPressToSelectState();
+    bool getMiddleBtnState();
+    int getCurSpeed();
+    int getCurSensitivity();
+    int getCurInertia();
+
+    void setEnabled(bool st);
+    void setScrollingEnabled(bool st);
+    void setPressToSelectEnabled(bool st);
+    void setMiddleBtnEnabled(bool st);
+    void setSpeed(int n);
+    void setSensitivity(int n);
+    void setInertia(int n);
+
+    void applySettings();               // Apply settings after resume from suspend
+
+private:
+    XInputSession *xi;
+    long int devID;                     // Bug in including order. So we can't use XID type
+    bool devPresented;
+    int devEnabled;
+    bool scrollingState;
+    bool pressToSelectState;
+    bool middleBtnState;
+
+    int speed;
+    int sensitivity;
+    int inertia;
+    QSettings *settings;
+
+    int getSpeedValue();
+    int getSensitivityValue();
+};
+
+/* TouchPad configuration */
+
+class TouchPad {
+public:
+    TouchPad(XInputSession *);
+    ~TouchPad();
+
+    bool isPresent();
+
+    bool getState();
+    bool getTwoFingetVertScrolling();
+    bool getTwoFingerHorizScrolling();
+    int getVertScrollingSpeed();
+    int getHorizScrollingSpeed();
+    bool getEdgeVertScrollingState();
+    bool getEdgeHorizScrollingState();
+    bool getEdgeCoastingState();
+    int getCoastingAccel();
+    int getCoastingDecel();
+
+    void setEnabled(bool st);
+    void setTwoFingerVertScrolling(bool st);
+    void setTwoFingerHorizScrolling(bool st);
+    void setVertScrollingSpeed(int n);
+    void setHorizScrollingSpeed(int n);
+    void setEdgeVertScrolling(bool st);
+    void setEdgeHorizScrolling(bool st);
+    void setEdgeCoasting(bool st);
+    void setCoastingAccel(int n);
+    void setCoastingDecel(int n);
+
+    void applySettings();
+
+private:
+    XInputSession *xi;
+    long int devID;
+    bool devPresented;
+    int devEnabled;
+
+    int twoFingerVertScrolling;
+    int twoFingerHorizScrolling;
+    int vertScrollingSpeed;
+    int horizScrollingSpeed;
+    int edgeVertScrolling;
+    int edgeHorizScrolling;
+    int edgeCoasting;
+
+    float coastingAccel;
+    float coastingDecel;
+
+
+    QSettings *settings;
+};
+
+#endif // INPUT_H
@@ -27,10 +27,22 @@
 #include <QSystemTrayIcon>
 #include <QMenu>
 #include <QAction>
+#include <QThread>
 #include "governors.h"
+#include "input.h"
+#include "daemon.h"
+#include "snapshot.h"
+#include "batterylog.h"
+#include "sensorhistory.h"
+#include "scheduler.h"
+#include "uevent.h"
+#include "samplebus.h"
+#include "cpufreq.h"
 #include "settings.h"
 #include "dialogs.h"
 
+#define GUI_REFRESH_INTERVAL 1000        // ms, at most one repaint of values per interval
+
 namespace Ui {
     class MainWindow;
 }
@@ -43,6 +55,8 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    SampleBus *stopSampling();              // for thinkctl_bench, returns bus it may publish to
+
 private:
     Ui::MainWindow *ui;
 
@@ -54,9 +68,19 @@ private:
     QPoint windowPosition;
     QDBusConnection dbus;
 
-    Timer *timer;
+    EventLoop *loop;                        // GUI thread sources (mixer)
+    EventLoop *samplerLoop;
+    QThread *samplerThread;                 // scheduler and sensors, NULL with thinkctld
+    QThread *controlThread;                 // fan governor
+    SampleBus *bus;
+    SampleSubscriber *samples;
+    SensorHistory *history;
+    Scheduler *scheduler;
+    UeventMonitor *uevents;
     SensorsArray *sensorsArray;
+    CpuFreqController *cpufreq;
     WirelessSwitchers *ws;
+    XInputSession *xinput;
     TrackPoint *tp;
     TouchPad *touchpad;
     ProfileList profiles;
@@ -64,6 +88,10 @@ private:
     MachineInfo mi;
 
     Governor *gov;
+    DaemonClient *daemon;
+    SnapshotPublisher *publisher;           // only when we own the fan
+    SnapshotFeeder *feeder;                 // only when thinkctld owns it
+    QList<BatteryLog *> batlogs;            // thinkctld keeps history when it runs
     WLGovernor *wlgov;
 //    APSGovernor *apsgov;
     BatteryGovernor *batgov;
@@ -72,6 +100,9 @@ private:
     int currentProfile;
     int warnDiff;
     bool realyClose;                 // true - close program, false - minimize in tray
+    double wakeupRate;
+    bool powerSaving;
+    bool daemonLost;                 // thinkctld went away, fan controls are off
 
     void notifyAction(QString, QString, int, int);
     void initTrayIcon();
@@ -90,17 +121,17 @@ private:
     void initMainBatInfo();
     void mainBatUpdateVolValues();
 
-    void setWirelessStates();
-
     void closeEvent(QCloseEvent *);
 
 private slots:
+    void setWirelessStates();           // also on rfkill uevents
     void refreshValues();
     void programCtrlActivated(bool);
     void presetCtrlActivated();
     void manualCtrlActivated();
     void speedLvlDial(int);
     void fanPresetBtnPressed();
+    void fanPresetChanged();
     void cpuPolicyChoosed(int);
 //    void gpuMethodChoosed(int);
     void gpuProfileChoosed(int);
@@ -128,17 +159,33 @@ private slots:
 
     void mainBatInstalled(bool s);
     void mainBatWidgetsState(bool s);
-    void mainBatRefreshValues();
+    void mainBatRefreshValues(uint dirty);
 //    void mainBatUpdateState(QString s);
 
     void trayIconActivated(QSystemTrayIcon::ActivationReason);
+    void updateTrayToolTip();
+    void setWakeupRate(double);
+    void setPowerSaving(bool);
     void trayMenuAction(QAction *);
 
     void applyAfterSusped();
 
+    void samplerThreadFinished();
+    void controlThreadFinished();
+    void daemonDisconnected();
+    void daemonReconnected();
+
     QString getColor(WLevelsT lvl);
+
+signals:
+    void fanModeChanged(bool);
+    void fanLevelChanged(int);
+    void fanLevelAuto();
+    void fanProfileChanged(const Profile &);
 };
 
 QString minToHrsAndMin(int m);
+QString tempToString(int t);
+QString cpuTempsToString(const CpuTemps *t);
 
 #endif // MAINWINDOW_H
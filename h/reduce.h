@@ -0,0 +1,47 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stdint.h>
+
+#define EWMA_SHIFT 2                // weight of new sample is 1/4
+#define EWMA_FRAC_BITS 8            // ewma state is degrees in Q8
+
+/* Result of reduction over group of zones, absent zones are skipped */
+
+struct ZoneStats {
+    int16_t min;                // SENSOR_NONE if no zone is present
+    int16_t max;
+    int16_t mean;
+    int16_t count;              // present zones
+};
+
+/*
+ * Reductions over contiguous int16_t temperature arrays where absent
+ * sensors hold SENSOR_NONE. reduceZones() has SSE2 path, others are
+ * plain loops which gcc vectorizes at -O2 -ftree-vectorize / -O3.
+ */
+
+void reduceZones(const int16_t *v, int n, ZoneStats *out);
+void ewmaUpdate(int32_t *state, const int16_t *v, int n);
+int ewmaMaxRise(const int32_t *state, const int16_t *v, int n);
+
+#endif // REDUCE_H
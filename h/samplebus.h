@@ -0,0 +1,120 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef SAMPLEBUS_H
+#define SAMPLEBUS_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QDateTime>
+#include "devices.h"
+
+#include <stdint.h>
+
+#define SAMPLEBUS_RING_SIZE 16
+#define SAMPLEBUS_MAX_SUBSCRIBERS 8
+
+/* Everything consumers need from one sampling tick, immutable once published */
+
+struct Sample {
+    uint64_t seq;                       // 1 for the first sample
+    qint64 timestamp;                   // ms, monotonic
+    int16_t thermal[THERMAL_SLOTS];     // SENSOR_NONE for absent sensors
+    ZoneStats thermStats;
+    int16_t maxRise;                    // degrees above moving average
+    int16_t cpuLoad;                    // %
+    CpuTemps cpu;
+    int32_t fanSpeed;                   // rpm
+    int16_t fanLevel;                   // FAN_LEVEL_* or 0..7, as read back
+};
+
+struct SampleSlot {
+    volatile uint32_t seq;
+    Sample data;
+};
+
+/*
+ * Single producer, many consumers ring of samples inside one process.
+ * It's the same per slot sequence lock as snapshot ring: sampler never
+ * waits for a consumer, consumer retries copy if slot changed under it.
+ * Producer wakes subscribers through their eventfds, several samples
+ * published before consumer runs make only one wakeup.
+ *
+ * subscribe() and unsubscribe() must not race with publish(), so they
+ * are done before sampler thread starts and after it's stopped.
+ */
+
+class SampleBus {
+public:
+    SampleBus();
+
+    void publish(Sample &s);            // fills seq and timestamp
+    void publish(Sample &s, qint64 timestamp);  // sampled earlier, ms on bus clock
+    bool latest(Sample *out);
+    bool get(uint64_t seq, Sample *out);    // false if it's not published or already overwritten
+    uint64_t getHead();
+    qint64 getEpoch();                  // ms since epoch when timestamps were 0
+
+    bool subscribe(int fd);
+    void unsubscribe(int fd);
+
+private:
+    volatile uint64_t head;
+    SampleSlot slot[SAMPLEBUS_RING_SIZE];
+    volatile int subscribers[SAMPLEBUS_MAX_SUBSCRIBERS];   // eventfds, -1 free
+    QElapsedTimer clock;
+    qint64 epoch;
+};
+
+/*
+ * Consumer side. Lives in consumer's thread and emits sampleReady() there
+ * when a new sample is on the bus, but not more often than minInterval
+ * ms. Consumer then takes the newest one with latest().
+ */
+
+class SampleSubscriber : public QObject
+{
+    Q_OBJECT
+
+public:
+    SampleSubscriber(SampleBus *, int minInterval = 0, QObject *parent = 0);
+    ~SampleSubscriber();
+
+    bool latest(Sample *out);           // false if nothing new since last call
+
+private:
+    SampleBus *bus;
+    int eventFd;
+    QSocketNotifier *notifier;
+    QTimer *delay;                      // holds back notification until minInterval
+    QElapsedTimer lastReady;
+    int interval;
+    uint64_t lastSeq;
+
+private slots:
+    void wakeup();
+    void deliver();
+
+signals:
+    void sampleReady();
+};
+
+#endif // SAMPLEBUS_H
@@ -0,0 +1,130 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include "devices.h"
+#include "settings.h"
+#include "eventloop.h"
+
+/* Thermal sampling intervals, ms */
+
+#define THERMAL_FAST_INTERVAL 500       // temperature rising or near profile threshold
+#define THERMAL_BASE_INTERVAL 1000
+#define THERMAL_SLOW_INTERVAL 4000      // upper bound of back off when stable
+#define THERMAL_STABLE_TICKS 5          // unchanged ticks before backing off
+#define THERMAL_NEAR_DEGREES 2
+#define THERMAL_RISE_DEGREES 2          // above moving average, a degree is sensor jitter
+
+/* Battery sampling intervals, ms */
+
+#define BATTERY_FAST_INTERVAL 2000      // right after AC state change
+#define BATTERY_SLOW_INTERVAL 30000
+
+/* Battery saver mode, used while AC adapter is unplugged */
+
+#define SAVER_TIMER_SLACK 50000000      // ns, for poll() of Qt event loop
+#define SAVER_COALESCE_WINDOW 1000      // ms, sources due within it share wakeup
+#define SAVER_THERMAL_MIN_INTERVAL 2000
+
+#define WAKEUP_RATE_WINDOW 10000        // ms
+
+/*
+ * Scheduler drives every sampling source with its own cadence from one
+ * timerfd in EventLoop, so sources due at the same time share a wakeup.
+ *
+ * Thermal cadence adapts to cpu temperature: fast when it rises, when any
+ * thinkpad sensor is THERMAL_RISE_DEGREES above its moving average or
+ * near a threshold of the current profile, doubling up to slow interval
+ * while it stays unchanged. Battery cadence backs off from fast to slow
+ * and is reset when AC adapter state changes or a power_supply uevent
+ * arrives. With setACEvents() AC state comes from acChanged() and is
+ * read again on every power_supply uevent, otherwise it's polled on
+ * thermal ticks.
+ *
+ * Without AC power scheduler switches to battery saver mode: timer slack
+ * of its thread is raised, thermal sampling is never faster than
+ * SAVER_THERMAL_MIN_INTERVAL and sources due close to each other are
+ * served by one wakeup.
+ */
+
+class Scheduler : public QObject,
+        public EventHandler
+{
+    Q_OBJECT
+
+public:
+    Scheduler(EventLoop *, SensorsArray *, Profile *);
+    ~Scheduler();
+
+    int getThermalInterval();
+    bool isPowerSaving();
+    double getWakeupRate();
+
+    void handleEvent(int fd, uint32_t events);
+    void setACEvents(bool);             // AC is reported by UeventMonitor
+
+public slots:
+    void thermalUpdated();
+    void acChanged(bool online);
+    void powerSupplyChanged();
+    void thermalChanged();
+    void profileChanged(const Profile &);
+    void applyTimerSlack();             // to the thread running scheduler
+
+private:
+    EventLoop *loop;
+    int timerFd;
+    QElapsedTimer clock;
+
+    SensorsArray *snsArray;
+    Profile profile;                    // own copy, sampler may run in other thread
+
+    int thermalInterval;
+    int batteryInterval;
+    qint64 nextThermal;
+    qint64 nextBattery;
+
+    int lastCpuTemp;
+    int stableTicks;
+
+    int acFd;
+    int lastACState;
+    bool acEvents;
+
+    bool powerSaving;
+    double wakeupRate;
+    qint64 rateWindowStart;
+    quint64 rateWindowWakeups;
+
+    bool isNearThreshold();
+    void checkACState();
+    void batteryDue();
+    void setPowerSaving(bool);
+    void updateWakeupRate(qint64 now);
+    void rearm();
+
+signals:
+    void thermalTick();
+    void batteryTick();
+    void powerSavingChanged(bool);
+    void wakeupRateUpdated(double);
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,144 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef SENSORHISTORY_H
+#define SENSORHISTORY_H
+
+#include <QObject>
+#include "devices.h"
+#include "samplebus.h"
+
+#include <stdint.h>
+
+#define HISTORY_MAGIC 0x544b4831            // "TKH1"
+#define HISTORY_VERSION 1
+#define HISTORY_CHANNELS (THERMAL_SLOTS + 1)
+#define HISTORY_FAN THERMAL_SLOTS           // channel of fan rpm, after thermal slots
+#define HISTORY_RAW_SIZE 600                // 10 min at fastest thermal tick
+#define HISTORY_TIERS 3
+#define HISTORY_TIER_SIZE 720               // 2 h of 10 s, 12 h of 1 min, 5 days of 10 min
+#define HISTORY_FILE "sensors.dat"          // in historyDir()
+
+/* One sample as kept in history, SENSOR_NONE for absent channels */
+
+struct HistoryPoint {
+    int64_t time;                       // ms since epoch
+    int16_t value[HISTORY_CHANNELS];
+    int16_t pad;
+};
+
+struct HistoryStat {
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+};
+
+/* Closed period of a tier, starts at time and holds count samples */
+
+struct HistoryBucket {
+    int64_t time;
+    int32_t count;
+    HistoryStat stat[HISTORY_CHANNELS];
+    int16_t pad;
+};
+
+/* Open period, becomes a bucket when first sample of next period comes */
+
+struct HistoryAccum {
+    int64_t time;                       // 0 if nothing is accumulated
+    int32_t count;
+    int32_t valid[HISTORY_CHANNELS];    // samples where channel was present
+    int64_t sum[HISTORY_CHANNELS];
+    int16_t min[HISTORY_CHANNELS];
+    int16_t max[HISTORY_CHANNELS];
+};
+
+struct HistoryTier {
+    int64_t period;                     // ms
+    uint64_t head;                      // buckets ever closed
+    HistoryAccum acc;
+    HistoryBucket bucket[HISTORY_TIER_SIZE];
+};
+
+/*
+ * Whole history in one fixed layout, so it is used straight from the
+ * mapped file and is there on next start. Rings are indexed like snapshot
+ * ring: newest entry is at (head - 1) % size.
+ */
+
+struct HistoryData {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                      // sizeof(HistoryData), catches layout changes
+    uint32_t pad;
+    uint64_t head;                      // raw points ever appended
+    HistoryPoint raw[HISTORY_RAW_SIZE];
+    HistoryTier tier[HISTORY_TIERS];
+};
+
+/*
+ * Keeps every sample from the bus in a raw ring and downsamples them into
+ * 10 s, 1 min and 10 min tiers of min, max and mean. Tier periods are
+ * aligned to wall clock, so buckets of different runs line up.
+ *
+ * It's a bus consumer in the thread it's created in, drains every sample
+ * still on the bus when woken. Data is mapped from file, which is synced
+ * on destruction. Without file, or when another process holds it, history
+ * is kept in anonymous memory.
+ */
+
+class SensorHistory : public QObject
+{
+    Q_OBJECT
+
+public:
+    SensorHistory(SampleBus *b, const QString &path, QObject *parent = 0);
+    ~SensorHistory();
+
+    bool isPersistent();
+
+    uint64_t getHead();                             // raw points ever appended
+    int getRaw(HistoryPoint *out, int n);           // newest first, returns count
+    bool getRawAt(uint64_t n, HistoryPoint *out);   // n-th point if still in ring, 1 is the first
+    int getBuckets(int tier, HistoryBucket *out, int n);  // newest closed first
+    int64_t getPeriod(int tier);
+
+    void sync();
+
+private:
+    SampleBus *bus;
+    SampleSubscriber *samples;
+    HistoryData *data;
+    int fd;
+    uint64_t lastSeq;
+
+    bool map(const QString &path);
+    void reset();
+    void append(const Sample &s);
+    void accumulate(HistoryTier *t, const HistoryPoint &p);
+    void closeBucket(HistoryTier *t);
+
+private slots:
+    void drain();
+
+signals:
+    void appended();                    // one or more raw points were added
+};
+
+#endif // SENSORHISTORY_H
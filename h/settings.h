@@ -23,9 +23,19 @@
 #include <QString>
 #include <QSettings>
 #include <QFile>
+#include <QMetaType>
+#include "fancurve.h"
+
+/*
+ * Profile keeps fan curve of every sensor. Min/mid/max triplets are kept
+ * for the preset dialog and old profiles files; changing one of them
+ * rebuilds that sensor curve from triplet.
+ */
 
 class Profile {
 public:
+    Profile();
+
     QString getName();
     int getCpuMin();
     int getCpuMid();
@@ -40,6 +50,15 @@ public:
     int getGpuMethod();
     int getGpuProfile();
     int getCpuPolicy();
+    bool isPidControl();
+    int getTargetTemp();
+
+    FanCurve *getCpuCurve();
+    FanCurve *getGpuCurve();
+    FanCurve *getMchCurve();
+    void setCpuCurve(const FanCurve &);
+    void setGpuCurve(const FanCurve &);
+    void setMchCurve(const FanCurve &);
 
     void setName(QString);
     void setCpuMin(int);
@@ -56,6 +75,8 @@ public:
     void setGpuMethod(int);
     void setGpuProfile(int);
     void setCpuPolicy(int);
+    void setPidControl(bool);
+    void setTargetTemp(int);
 
 private:
     QString name;
@@ -65,8 +86,17 @@ private:
     int treshold;
     int gpuMethod, gpuProfile;
     int cpuPolicy;
+    bool pidControl;            // hold targetTemp instead of fan curves
+    int targetTemp;
+
+    FanCurve cpuCurve, gpuCurve, mchCurve;
+    bool cpuCurveStale, gpuCurveStale, mchCurveStale;     // triplet changed
+
+    FanCurve *curve(FanCurve *c, bool *stale, int min, int mid, int max);
 };
 
+Q_DECLARE_METATYPE(Profile)             // passed by value to governor and scheduler threads
+
 class ProfileList : public QList<Profile*> {
 public:
     ProfileList();
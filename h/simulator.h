@@ -0,0 +1,133 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QTimer>
+
+#define SIM_TICK 100                // ms of wall time between model steps
+#define SIM_FAN_LEVELS 8
+#define SIM_THREADS 4               // two cores with two threads each
+#define SIM_MIN_FREQ 800000
+#define SIM_MAX_FREQ 2400000
+#define SIM_FULL_LOAD_POWER 35.0     // W of heat input at 100% cpu load
+
+/* Heat input of the cpu from given time of the script */
+
+struct HeatStep {
+    double time;                // s
+    double power;               // W
+};
+
+struct ACStep {
+    double time;
+    bool connected;
+};
+
+/*
+ * Simulator creates fake /proc and /sys tree of a ThinkPad under root
+ * (thinkpad_acpi thermal and fan, coretemp hwmon, cpufreq, tp_smapi)
+ * and keeps its values moving by a lumped thermal model:
+ *
+ *   C dT/dt = P * f/fmax - (passive + fan[level]) * (T - ambient)
+ *
+ * Fan commands written to the fan file are picked up on the next step.
+ * "level auto" is emulated by firmware like linear ramp, "watchdog <s>"
+ * returns fan to auto when no command came for that long (wall time).
+ *
+ * Script is a text file with lines
+ *   <time> <power>          heat input from time, s and W
+ *   ac <time> <0|1>         AC adapter state from time
+ *   ambient <C>
+ *   capacity <J/K>
+ *   passive <W/K>
+ *   fan <level> <W/K>       cooling added by fan level
+ */
+
+class Simulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    Simulator(const QString &r);
+
+    bool loadScript(const QString &file);
+    bool createTree();
+    void step(double dt);
+
+    void setSpeedup(int n);
+    void setDuration(double s);
+    void setLog(bool s);
+
+    double getTime();
+    double getCpuTemp();
+    int getFanLevel();
+
+public slots:
+    void start();
+
+private slots:
+    void tick();
+
+signals:
+    void finished();
+
+private:
+    QString root;
+    QTimer timer;
+    QList<HeatStep> heat;
+    QList<ACStep> ac;
+
+    double capacity;
+    double passive;
+    double ambient;
+    double fanCooling[SIM_FAN_LEVELS];
+
+    double time;
+    double duration;            // 0 - run forever
+    double lastLog;
+    int speedup;
+    bool log;
+
+    double cpuTemp;
+    int fanLevel;
+    QString fanMode;            // "auto", "full-speed" or level number
+    int watchdog;               // s, 0 - disabled
+    double lastCommand;         // simulated time of last fan command
+    bool acConnected;
+    double batCapacity;         // mWh
+    double busyJiffies;         // /proc/stat counters
+    double idleJiffies;
+
+    double heatAt(double t);
+    bool acAt(double t);
+    double freqScale();
+    void readFanCommand();
+    void writeValues();
+
+    QString path(const QString &p);
+    bool writeFile(const QString &p, const QString &val);
+    QString readFile(const QString &p);
+};
+
+#endif // SIMULATOR_H
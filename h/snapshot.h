@@ -0,0 +1,190 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <QObject>
+#include "devices.h"
+#include "samplebus.h"
+
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SNAPSHOT_SHM_NAME "/thinkctl-sensors"
+#define SNAPSHOT_MAGIC 0x544b4331           // "TKC1"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_RING_SIZE 64
+#define SNAPSHOT_MAX_RETRIES 100            // slot stays odd if writer died inside it
+#define SNAPSHOT_STALE_MS 12000             // no new snapshot that long, writer may be gone
+#define SNAPSHOT_REOPEN_MS 2000             // between checks for a new ring
+#define SNAPSHOT_POLL_INTERVAL 500          // ms, fastest thermal cadence of writer
+#define SNAPSHOT_FEED_MAX 8                 // snapshots taken in one poll
+
+/*
+ * Fixed layout snapshot of all sampled values. It's shared with other
+ * processes, so only fixed size fields are used here.
+ */
+
+struct SensorSnapshot {
+    uint64_t timestamp;                     // ms since epoch
+    int16_t thermal[THERMAL_SLOTS];         // SENSOR_NONE for absent sensors
+    int16_t cpuTemp;
+    int16_t fanLevel;
+    int32_t fanSpeed;
+
+    int8_t acConnected;
+    int8_t batInstalled;
+    int16_t batChargeLvl;                   // percent
+    int32_t batVoltage;                     // mV
+    int32_t batRemainingCapacity;           // mWh
+
+    int8_t powerSaving;                     // scheduler battery saver mode
+    int8_t pad[3];
+    float wakeupRate;                       // sampling wakeups per second
+};
+
+/*
+ * Every slot is protected by its own sequence counter. Writer makes it odd
+ * while slot is updated, reader retries if counter was odd or changed
+ * during copy. head counts published snapshots, latest one is in
+ * slot[(head - 1) % SNAPSHOT_RING_SIZE].
+ */
+
+struct SnapshotSlot {
+    volatile uint32_t seq;
+    uint32_t pad;
+    SensorSnapshot data;
+};
+
+struct SnapshotRing {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t pad;
+    volatile uint64_t head;
+    SnapshotSlot slot[SNAPSHOT_RING_SIZE];
+};
+
+/* Single writer side, lives in process which samples sensors */
+
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    bool isOpened();
+    void publish(const SensorSnapshot &);
+
+private:
+    SnapshotRing *ring;
+    int fd;                             // locked while we write
+};
+
+/*
+ * Reader side for GUI and other tools, never blocks the writer. A slot
+ * which doesn't settle after SNAPSHOT_MAX_RETRIES copies is skipped. When
+ * ring is missing, closed or stops advancing, reader looks for a ring of
+ * a restarted writer, at most once per SNAPSHOT_REOPEN_MS.
+ */
+
+class SnapshotReader {
+public:
+    SnapshotReader();
+    ~SnapshotReader();
+
+    bool isOpened();
+    int latest(SensorSnapshot *out, int n);     // newest first, returns count
+
+private:
+    SnapshotRing *ring;
+    dev_t dev;                          // identity of mapped object
+    ino_t ino;
+    uint64_t lastHead;
+    QElapsedTimer advanced;             // since head last moved
+    QElapsedTimer checked;              // since last look for a new ring
+
+    bool open();
+    void close();
+    void checkWriter();
+};
+
+/* Takes every sample from the bus, adds all batteries as one and publishes them */
+
+class SnapshotPublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    SnapshotPublisher(SampleBus *, const QList<Battery *> &);
+
+private:
+    SnapshotWriter writer;
+    SampleSubscriber *samples;
+    QList<Battery *> bats;
+
+    bool powerSaving;
+    double wakeupRate;
+
+public slots:
+    void publish();
+    void setPowerSaving(bool);
+    void setWakeupRate(double);
+};
+
+/*
+ * For GUI while thinkctld samples sensors. Feeder polls the ring and
+ * publishes every new snapshot on the bus as a sample, so its subscribers
+ * work as with local sensors. It's the only producer of that bus.
+ * Snapshots carry no per core temperatures and no cpu load, sample gets
+ * hottest cpu temperature only. Samples keep time of their snapshots.
+ */
+
+class SnapshotFeeder : public QObject
+{
+    Q_OBJECT
+
+public:
+    SnapshotFeeder(SampleBus *, QObject *parent = 0);
+
+    bool isPowerSaving();
+    double getWakeupRate();
+    void stop();                        // bus may get other producer after it
+
+private:
+    SnapshotReader reader;
+    SampleBus *bus;
+    QTimer *timer;
+    uint64_t lastTimestamp;             // of newest snapshot published
+    int32_t trend[THERMAL_SLOTS];       // EWMA of values, Q8
+
+    bool powerSaving;
+    double wakeupRate;
+
+    void feed(const SensorSnapshot &);
+
+public slots:
+    void poll();
+
+signals:
+    void powerSavingChanged(bool);
+    void wakeupRateUpdated(double);
+};
+
+#endif // SNAPSHOT_H
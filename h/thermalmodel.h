@@ -0,0 +1,62 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef THERMALMODEL_H
+#define THERMALMODEL_H
+
+#define THERMAL_PARAMS 5
+#define THERMAL_FORGET 0.98             // RLS forgetting factor, ~50 samples of memory
+#define THERMAL_MIN_SAMPLES 10          // before that prediction is not used
+#define THERMAL_MAX_RESIDUAL 1.5        // C/s, filtered fit error above it disables prediction
+#define THERMAL_HORIZON 5.0             // s, how far ahead fan reacts
+#define THERMAL_MAX_LEAD 10             // C, prediction is clamped around measured temp
+#define THERMAL_MAX_DT 10.0             // s, longer gaps restart the model
+
+/*
+ * First-order RC model of one thermal zone, fitted online:
+ *
+ *   dT/dt = heat(load) - (g0 + g1 * rpm) * (T - Tamb)
+ *
+ * Expanded it's linear in parameters over regressors 1, T, rpm, rpm*T and
+ * load, which are fitted by recursive least squares with forgetting, so
+ * the model follows dust, ambient and paste changes. Prediction
+ * integrates the model with current load and rpm held constant.
+ */
+
+class ThermalZoneModel {
+public:
+    ThermalZoneModel();
+
+    void reset();
+    void update(int temp, int rpm, int load, double dt);   // load in %, 0 for zones without it
+    int predict(double horizon);                // last temp if model isn't trusted
+    bool isTrained();
+
+private:
+    double theta[THERMAL_PARAMS];
+    double cov[THERMAL_PARAMS][THERMAL_PARAMS];
+    double prevX[THERMAL_PARAMS];       // regressors of previous sample
+    int prevTemp;                       // SENSOR_NONE if there is no previous sample
+    int samples;
+    double residual;                    // filtered |prediction error| of dT/dt
+
+    void regressors(int temp, int rpm, int load, double *x);
+};
+
+#endif // THERMALMODEL_H
@@ -0,0 +1,88 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <stdint.h>
+
+#define CPU_MAX_CORES 64
+#define CPU_MAX_PACKAGES 8
+
+/* Logical cpu and the physical core it belongs to */
+
+struct CpuThread {
+    int cpu;
+    int package;
+    int core;                   // index in CpuTemps::core
+};
+
+/*
+ * Temperatures of one refresh. Cores are physical cores numbered over
+ * all packages, unknown values are SENSOR_NONE.
+ */
+
+struct CpuTemps {
+    int16_t core[CPU_MAX_CORES];
+    int16_t package[CPU_MAX_PACKAGES];
+    int16_t max;                // hottest core or package
+    int16_t avg;                // average of cores (or packages)
+    int cores;
+    int packages;
+};
+
+/*
+ * CpuTopology finds online cpus, their packages and cores, and the
+ * temperature inputs for them: hwmon coretemp/k10temp first, then
+ * thermal zones by type. Inputs are kept open and read by refresh().
+ */
+
+class CpuTopology {
+public:
+    CpuTopology();
+    ~CpuTopology();
+
+    int getThreadsCount();
+    int getCoresCount();
+    int getPackagesCount();
+    QList<CpuThread> getThreads();
+
+    void refresh(CpuTemps *out);
+
+private:
+    QList<CpuThread> threads;
+    QList<int> coreIds;                 // package * 1024 + core_id, by index
+    int packagesCnt;
+
+    QVector<int> coreFd;                // -1 if no input for core
+    QVector<int> packageFd;
+
+    void discoverThreads();
+    void discoverHwmon();
+    void discoverThermalZones();
+    int coreIndex(int package, int coreId);
+};
+
+QList<int> parseCpuList(const char *str);
+
+#endif // TOPOLOGY_H
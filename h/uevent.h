@@ -0,0 +1,65 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef UEVENT_H
+#define UEVENT_H
+
+#include <QObject>
+#include <QString>
+#include "eventloop.h"
+
+#define UEVENT_BUF_SIZE 8192            // kernel limits one uevent to 2048 bytes of env
+#define UEVENT_RCVBUF (256 * 1024)      // bursts on resume and dock
+
+/*
+ * Kernel uevents from netlink, no udev needed. Socket is in EventLoop, so
+ * process wakes only when the kernel reports something, and only
+ * power_supply, thermal and rfkill events go further. When socket buffer
+ * overflowed, events are lost, then every signal is sent with empty name
+ * so listeners resynchronize.
+ */
+
+class UeventMonitor : public QObject,
+        public EventHandler
+{
+    Q_OBJECT
+
+public:
+    UeventMonitor(EventLoop *);
+    ~UeventMonitor();
+
+    bool isOpen();
+
+    void handleEvent(int fd, uint32_t events);
+
+private:
+    EventLoop *loop;
+    int sock;
+    QString mainsName;                  // power_supply name of AC adapter, empty if none
+
+    void parse(const char *buf, int len);
+
+signals:
+    void powerSupplyChanged(const QString &name);   // battery or AC
+    void acChanged(bool online);                    // mains supply only
+    void thermalChanged(const QString &zone);       // trip point crossed
+    void rfkillChanged(const QString &type);
+};
+
+#endif // UEVENT_H
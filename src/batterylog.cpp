@@ -0,0 +1,512 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/batterylog.h"
+
+#include <QDebug>
+#include <QDir>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BATLOG_HEADER_SIZE 8                // magic and version
+#define BATLOG_READ_SIZE 65536
+#define BATLOG_MAX_GAP 900                  // s, longer pauses are suspend or shutdown
+#define BATLOG_MIN_SPAN 300                 // s on battery needed for discharge rate
+
+#define BATLOG_KEY 0x01                     // absolute values, first record of an hour
+#define BATLOG_AC 0x02
+#define BATLOG_INSTALLED 0x04
+
+static int putVarint(uint8_t *p, uint64_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+/* Returns bytes taken, 0 if varint doesn't end before len */
+
+static int getVarint(const uint8_t *p, int len, uint64_t *v)
+{
+    uint64_t r = 0;
+
+    for (int n = 0; n < len && n < 10; n++) {
+        r |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            *v = r;
+            return n + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static time_t (*logClock)(time_t *) = time;
+
+static uint32_t hourOf(time_t t)
+{
+    return (uint32_t)(t / 3600);
+}
+
+BatteryLog::BatteryLog(Battery *bat, const QString &dir, QObject *parent) : QObject(parent)
+{
+    QString base = dir + "/" + bat->getName();
+
+    battery = bat;
+    logFd = indexFd = -1;
+    index = NULL;
+    opened = writable = false;
+    logSize = 0;
+    pending = false;
+    memset(&last, 0, sizeof(last));
+
+    if (!QDir().mkpath(dir)) {
+        qDebug() << "Cannot create battery history dir" << dir;
+        return;
+    }
+
+    if (!openLog(base + ".log") || !openIndex(base + ".idx")) {
+        qDebug() << "Battery history is disabled for" << bat->getName();
+        return;
+    }
+    opened = true;
+
+    if (writable) {
+        recover();
+        connect(battery, SIGNAL(snapshotChanged(uint)), this, SLOT(record(uint)));
+        record(BAT_ALL);
+    }
+}
+
+BatteryLog::~BatteryLog()
+{
+    if (index != NULL)
+        munmap(index, sizeof(BatteryLogIndex));
+    if (indexFd != -1)
+        close(indexFd);
+    if (logFd != -1)
+        close(logFd);               // drops the writer lock too
+}
+
+void BatteryLog::setClock(time_t (*f)(time_t *))
+{
+    logClock = f;
+}
+
+bool BatteryLog::isOpen()
+{
+    return opened;
+}
+
+bool BatteryLog::isWritable()
+{
+    return opened && writable;
+}
+
+/* Second writer of the same log, or one without write access, gets it read-only */
+
+bool BatteryLog::openLog(const QString &path)
+{
+    QByteArray name = path.toLocal8Bit();
+    uint32_t header[2];
+    struct stat st;
+
+    logFd = open(name.constData(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    writable = logFd != -1 && flock(logFd, LOCK_EX | LOCK_NB) == 0;
+
+    if (!writable) {
+        if (logFd != -1)
+            close(logFd);
+        logFd = open(name.constData(), O_RDONLY | O_CLOEXEC);
+    }
+    if (logFd == -1) {
+        qDebug() << "Cannot open" << path;
+        return false;
+    }
+
+    if (fstat(logFd, &st) == -1)
+        return false;
+
+    if (st.st_size == 0 && writable) {
+        header[0] = BATLOG_MAGIC;
+        header[1] = BATLOG_VERSION;
+        if (write(logFd, header, sizeof(header)) != sizeof(header)) {
+            qDebug() << "Cannot write" << path;
+            return false;
+        }
+        return true;
+    }
+
+    if (pread(logFd, header, sizeof(header), 0) != sizeof(header) ||
+            header[0] != BATLOG_MAGIC || header[1] != BATLOG_VERSION) {
+        qDebug() << "Unknown battery history format in" << path;
+        writable = false;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Reader uses index only when it's whole and valid, a writer may have died
+ * before it was sized or filled. Without it, reads scan the log from start.
+ */
+
+bool BatteryLog::openIndex(const QString &path)
+{
+    struct stat st;
+
+    indexFd = open(path.toLocal8Bit().constData(), (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+    if (indexFd == -1) {
+        qDebug() << "Cannot open" << path;
+        return !writable;
+    }
+
+    if (writable && ftruncate(indexFd, sizeof(BatteryLogIndex)) == -1) {
+        qDebug() << "Cannot resize" << path;
+        return false;
+    }
+
+    if (!writable && (fstat(indexFd, &st) == -1 || st.st_size < (off_t)sizeof(BatteryLogIndex))) {
+        qDebug() << "Incomplete index" << path;
+        return true;
+    }
+
+    void *p = mmap(NULL, sizeof(BatteryLogIndex), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, indexFd, 0);
+    if (p == MAP_FAILED) {
+        qDebug() << "Cannot map" << path;
+        return false;
+    }
+
+    index = (BatteryLogIndex *)p;
+
+    if (!writable && (index->magic != BATLOG_MAGIC || index->version != BATLOG_VERSION ||
+                      index->hours != BATLOG_INDEX_HOURS)) {
+        qDebug() << "Unknown index format in" << path;
+        munmap(p, sizeof(BatteryLogIndex));
+        index = NULL;
+        return true;
+    }
+
+    /* Index is only a shortcut into the log, recover() rebuilds a lost one */
+    if (writable && (index->magic != BATLOG_MAGIC || index->version != BATLOG_VERSION ||
+                     index->hours != BATLOG_INDEX_HOURS)) {
+        memset((void *)index, 0, sizeof(BatteryLogIndex));
+        index->version = BATLOG_VERSION;
+        index->hours = BATLOG_INDEX_HOURS;
+        index->magic = BATLOG_MAGIC;
+    }
+
+    return true;
+}
+
+/*
+ * Decodes one record on top of previous one in r. Returns bytes taken,
+ * 0 if record is cut or damaged.
+ */
+
+int BatteryLog::decode(const uint8_t *p, int len, BatteryLogRecord *r)
+{
+    uint64_t v[6];
+    int n = 1;
+
+    if (len < 1 || (p[0] & ~(BATLOG_KEY | BATLOG_AC | BATLOG_INSTALLED)))
+        return 0;
+
+    for (int i = 0; i < 6; i++) {
+        int k = getVarint(p + n, len - n, &v[i]);
+        if (k == 0)
+            return 0;
+        n += k;
+    }
+
+    if (p[0] & BATLOG_KEY) {
+        r->time = (time_t)v[0];
+        r->voltage = (int)unzigzag(v[1]);
+        r->remainingCapacity = (int)unzigzag(v[2]);
+        r->lastFullCapacity = (int)unzigzag(v[3]);
+        r->chargeLvl = (int)unzigzag(v[4]);
+        r->cyclesCount = (int)unzigzag(v[5]);
+    } else {
+        r->time += (time_t)v[0];
+        r->voltage += (int)unzigzag(v[1]);
+        r->remainingCapacity += (int)unzigzag(v[2]);
+        r->lastFullCapacity += (int)unzigzag(v[3]);
+        r->chargeLvl += (int)unzigzag(v[4]);
+        r->cyclesCount += (int)unzigzag(v[5]);
+    }
+
+    r->acConnected = p[0] & BATLOG_AC;
+    r->installed = p[0] & BATLOG_INSTALLED;
+
+    return n;
+}
+
+/*
+ * Finds the end of log from the newest indexed hour, or from the start if
+ * index is empty, restores last record for delta encoding and cuts a torn
+ * tail. Hours met on the way are put into index again.
+ */
+
+void BatteryLog::recover()
+{
+    uint8_t buf[BATLOG_READ_SIZE];
+    struct stat st;
+    uint64_t pos = BATLOG_HEADER_SIZE;
+    uint32_t newest = 0;
+
+    if (fstat(logFd, &st) == -1)
+        return;
+
+    for (int i = 0; i < BATLOG_INDEX_HOURS; i++) {
+        const BatteryLogSlot &s = index->slot[i];
+        if (s.hour > newest && (s.hour - 1) % BATLOG_INDEX_HOURS == (uint32_t)i && s.offset < (uint64_t)st.st_size) {
+            newest = s.hour;
+            pos = s.offset;
+        }
+    }
+
+    for (;;) {
+        int len = pread(logFd, buf, sizeof(buf), pos);
+        int n = 0;
+
+        if (len <= 0)
+            break;
+
+        while (n < len) {
+            BatteryLogRecord r = last;
+            int k = decode(buf + n, len - n, &r);
+
+            if (k == 0)
+                break;
+            if ((buf[n] & BATLOG_KEY) && r.time > 0) {
+                BatteryLogSlot &s = index->slot[hourOf(r.time) % BATLOG_INDEX_HOURS];
+                s.hour = hourOf(r.time) + 1;
+                s.offset = pos + n;
+            }
+            last = r;
+            n += k;
+        }
+
+        pos += n;
+        if (n == 0 || len < (int)sizeof(buf))
+            break;
+    }
+
+    if (pos < (uint64_t)st.st_size) {
+        qDebug() << "Cutting" << (qint64)(st.st_size - pos) << "damaged bytes from battery history of" << battery->getName();
+        if (ftruncate(logFd, pos) == -1)
+            qDebug() << "Cannot truncate battery history:" << strerror(errno);
+    }
+
+    logSize = pos;
+}
+
+/*
+ * Plug, insert, cycle and full capacity changes are recorded at once,
+ * voltage and charge drift almost every tick, so they are recorded at
+ * most once per BATLOG_MIN_INTERVAL.
+ */
+
+void BatteryLog::record(uint dirty)
+{
+    const BatterySnapshot &b = battery->getSnapshot();
+    time_t now = logClock(NULL);
+    BatteryLogRecord r;
+
+    if (!isWritable())
+        return;
+
+    if (dirty & (BAT_VOLTAGE | BAT_REMAINING_CAP | BAT_CHARGE_LVL))
+        pending = true;
+
+    if (!(dirty & (BAT_INSTALLED | BAT_AC_CONNECTED | BAT_CYCLES | BAT_FULL_CAP)) &&
+            !(pending && now - last.time >= BATLOG_MIN_INTERVAL))
+        return;
+
+    r.time = now < last.time ? last.time : now;            // clock stepped back
+    r.installed = b.installed;
+    r.acConnected = b.acConnected;
+    r.voltage = b.voltage;
+    r.remainingCapacity = b.remainingCapacity;
+    r.lastFullCapacity = b.lastFullCapacity;
+    r.chargeLvl = b.chargeLvl;
+    r.cyclesCount = b.cyclesCount;
+
+    append(r);
+    pending = false;
+}
+
+void BatteryLog::append(const BatteryLogRecord &r)
+{
+    uint8_t buf[BATLOG_MAX_RECORD];
+    bool key = last.time == 0 || hourOf(r.time) != hourOf(last.time);
+    int n = 1;
+
+    buf[0] = (key ? BATLOG_KEY : 0) | (r.acConnected ? BATLOG_AC : 0) | (r.installed ? BATLOG_INSTALLED : 0);
+
+    if (key) {
+        n += putVarint(buf + n, (uint64_t)r.time);
+        n += putVarint(buf + n, zigzag(r.voltage));
+        n += putVarint(buf + n, zigzag(r.remainingCapacity));
+        n += putVarint(buf + n, zigzag(r.lastFullCapacity));
+        n += putVarint(buf + n, zigzag(r.chargeLvl));
+        n += putVarint(buf + n, zigzag(r.cyclesCount));
+    } else {
+        n += putVarint(buf + n, (uint64_t)(r.time - last.time));
+        n += putVarint(buf + n, zigzag((int64_t)r.voltage - last.voltage));
+        n += putVarint(buf + n, zigzag((int64_t)r.remainingCapacity - last.remainingCapacity));
+        n += putVarint(buf + n, zigzag((int64_t)r.lastFullCapacity - last.lastFullCapacity));
+        n += putVarint(buf + n, zigzag((int64_t)r.chargeLvl - last.chargeLvl));
+        n += putVarint(buf + n, zigzag((int64_t)r.cyclesCount - last.cyclesCount));
+    }
+
+    if (write(logFd, buf, n) != n) {
+        qDebug() << "Cannot append battery history:" << strerror(errno);
+        if (ftruncate(logFd, logSize) == -1)              // don't leave half a record before the next one
+            writable = false;
+        return;
+    }
+
+    /* Slot goes after the record, so it never points past the end of log */
+    if (key) {
+        BatteryLogSlot &s = index->slot[hourOf(r.time) % BATLOG_INDEX_HOURS];
+        s.offset = logSize;
+        s.hour = hourOf(r.time) + 1;
+    }
+
+    logSize += n;
+    last = r;
+}
+
+/*
+ * Records from the first indexed hour inside the range. Ranges older than
+ * the index are read from the start of log.
+ */
+
+QList<BatteryLogRecord> BatteryLog::read(time_t from, time_t to)
+{
+    QList<BatteryLogRecord> out;
+    uint8_t buf[BATLOG_READ_SIZE];
+    uint32_t first = hourOf(from);
+    uint32_t end = hourOf(to);
+    uint32_t now = hourOf(logClock(NULL));
+    uint64_t pos = 0;
+    struct stat st;
+    BatteryLogRecord r;
+
+    if (!isOpen() || from > to || fstat(logFd, &st) == -1)
+        return out;
+
+    if (index == NULL || first + BATLOG_INDEX_HOURS <= now)
+        pos = BATLOG_HEADER_SIZE;
+    else
+        for (uint32_t h = first; h <= end && h <= now; h++) {
+            const BatteryLogSlot &s = index->slot[h % BATLOG_INDEX_HOURS];
+            if (s.hour == h + 1) {
+                pos = s.offset;
+                break;
+            }
+        }
+
+    if (pos == 0)
+        return out;
+
+    memset(&r, 0, sizeof(r));
+
+    while (pos < (uint64_t)st.st_size) {
+        int len = pread(logFd, buf, sizeof(buf), pos);
+        int n = 0;
+
+        if (len <= 0)
+            break;
+
+        while (n < len) {
+            int k = decode(buf + n, len - n, &r);
+            if (k == 0)
+                break;
+            if (r.time > to)
+                return out;
+            if (r.time >= from)
+                out.append(r);
+            n += k;
+        }
+
+        if (n == 0)
+            break;
+        pos += n;
+    }
+
+    return out;
+}
+
+/*
+ * Average power drawn from battery: capacity lost between neighbour
+ * records on battery over time they span. Gaps longer than BATLOG_MAX_GAP
+ * and capacity jumps up (recalibration, plug between records) are left out.
+ */
+
+int BatteryLog::dischargeRate(time_t from, time_t to)
+{
+    QList<BatteryLogRecord> recs = read(from, to);
+    qint64 energy = 0;                  // mWh
+    qint64 span = 0;                    // s
+
+    for (int i = 1; i < recs.size(); i++) {
+        const BatteryLogRecord &a = recs.at(i - 1);
+        const BatteryLogRecord &b = recs.at(i);
+        time_t dt = b.time - a.time;
+
+        if (!a.installed || !b.installed || a.acConnected || b.acConnected)
+            continue;
+        if (dt <= 0 || dt > BATLOG_MAX_GAP || b.remainingCapacity > a.remainingCapacity)
+            continue;
+
+        energy += a.remainingCapacity - b.remainingCapacity;
+        span += dt;
+    }
+
+    if (span < BATLOG_MIN_SPAN)
+        return 0;
+
+    return (int)(energy * 3600 / span);
+}
@@ -0,0 +1,239 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/cpufreq.h"
+#include "h/devices.h"
+#include "h/topology.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define CPUFREQ_PATH "/sys/devices/system/cpu/cpu"
+#define CPUFREQ_ONLINE_PATH "/sys/devices/system/cpu/online"
+#define CPUFREQ_AVAIL_FREQ_PATH "/sys/devices/system/cpu/cpu0/cpufreq/scaling_available_frequencies"
+#define CPUFREQ_HW_MIN_PATH "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_min_freq"
+#define CPUFREQ_HW_MAX_PATH "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq"
+
+static int openCoreFile(int core, const char *name)
+{
+    QByteArray path = hwPath(QString(CPUFREQ_PATH "%1/cpufreq/%2").arg(core).arg(name)).toLocal8Bit();
+    int fd;
+
+    fd = open(path.constData(), O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        fd = open(path.constData(), O_RDONLY | O_CLOEXEC);      // still usable for caching
+
+    return fd;
+}
+
+/* Online cpus may have gaps, e.g. with SMT siblings switched off */
+
+CpuFreqController::CpuFreqController()
+{
+    QList<int> cpus = parseCpuList(getStringValueFromFile(hwPath(CPUFREQ_ONLINE_PATH)).toLocal8Bit().constData());
+
+    for (int i = 0; i < cpus.size(); i++) {
+        CoreFreqFiles c;
+
+        c.governorFd = openCoreFile(cpus.at(i), "scaling_governor");
+        if (c.governorFd == -1)                     // core without cpufreq
+            continue;
+
+        c.setspeedFd = openCoreFile(cpus.at(i), "scaling_setspeed");
+        c.minFreqFd = openCoreFile(cpus.at(i), "scaling_min_freq");
+        c.maxFreqFd = openCoreFile(cpus.at(i), "scaling_max_freq");
+
+        refreshCore(&c);
+        cores.append(c);
+    }
+
+    if (cores.isEmpty())
+        qDebug() << "No cpufreq interface found";
+
+    QFile f(hwPath(CPUFREQ_AVAIL_FREQ_PATH));
+    QTextStream ts(&f);
+    if (f.open(QIODevice::ReadOnly))
+        availFreq = ts.readLine().split(' ', QString::SkipEmptyParts);
+
+    hwMinFreq = getIntValueFromFile(hwPath(CPUFREQ_HW_MIN_PATH));
+    hwMaxFreq = getIntValueFromFile(hwPath(CPUFREQ_HW_MAX_PATH));
+}
+
+CpuFreqController::~CpuFreqController()
+{
+    for (int i = 0; i < cores.size(); i++) {
+        const CoreFreqFiles &c = cores.at(i);
+
+        close(c.governorFd);
+        if (c.setspeedFd != -1)
+            close(c.setspeedFd);
+        if (c.minFreqFd != -1)
+            close(c.minFreqFd);
+        if (c.maxFreqFd != -1)
+            close(c.maxFreqFd);
+    }
+}
+
+int CpuFreqController::getCoresCount()
+{
+    return cores.size();
+}
+
+QStringList CpuFreqController::getAvailFreq()
+{
+    return availFreq;
+}
+
+int CpuFreqController::getHwMinFreq()
+{
+    return hwMinFreq;
+}
+
+int CpuFreqController::getHwMaxFreq()
+{
+    return hwMaxFreq;
+}
+
+/*
+ * Other tools may change these files too, so values are read back before
+ * they are compared with the policy. Reads are cheap, it's writes which
+ * make cpufreq do work.
+ */
+
+void CpuFreqController::refreshCore(CoreFreqFiles *c)
+{
+    c->governor = readStringFromFd(c->governorFd);
+    c->setspeed = c->setspeedFd != -1 ? readIntFromFd(c->setspeedFd) : 0;
+    c->minFreq = c->minFreqFd != -1 ? readIntFromFd(c->minFreqFd) : 0;
+    c->maxFreq = c->maxFreqFd != -1 ? readIntFromFd(c->maxFreqFd) : 0;
+}
+
+/*
+ * Apply policy in one pass over cores. Limits go first, so the
+ * requested userspace speed is always inside them.
+ */
+
+void CpuFreqController::applyPolicy(const CpuFreqPolicy &p)
+{
+    bool ok = true;
+
+    for (int i = 0; i < cores.size(); i++) {
+        CoreFreqFiles &c = cores[i];
+
+        refreshCore(&c);
+
+        if (p.maxFreq > 0 && p.maxFreq < c.minFreq) {     // lowering both, min first
+            if (p.minFreq > 0)
+                ok &= writeInt(c.minFreqFd, &c.minFreq, p.minFreq);
+            ok &= writeInt(c.maxFreqFd, &c.maxFreq, p.maxFreq);
+        } else {
+            if (p.maxFreq > 0)
+                ok &= writeInt(c.maxFreqFd, &c.maxFreq, p.maxFreq);
+            if (p.minFreq > 0)
+                ok &= writeInt(c.minFreqFd, &c.minFreq, p.minFreq);
+        }
+
+        if (!p.governor.isEmpty() && p.governor != c.governor) {
+            ok &= writeString(c.governorFd, &c.governor, p.governor);
+            c.setspeed = 0;                 // governor start resets speed
+        }
+
+        if (p.setspeed > 0 && c.governor == "userspace")
+            ok &= writeInt(c.setspeedFd, &c.setspeed, p.setspeed);
+    }
+
+    if (!ok)
+        qDebug() << "Cannot write to cpu frequency files";
+}
+
+void CpuFreqController::applyProfilePolicy(int n)
+{
+    CpuFreqPolicy p;
+
+    p.minFreq = p.maxFreq = 0;          // profiles don't own limits
+
+    if (n == 0 || n > availFreq.size()) {
+        p.governor = "ondemand";
+        p.setspeed = 0;
+    } else {
+        p.governor = "userspace";
+        p.setspeed = availFreq.at(n-1).toInt();     // -1 to remove "ondemand"
+    }
+
+    applyPolicy(p);
+}
+
+void CpuFreqController::setGovernor(QString s)
+{
+    CpuFreqPolicy p;
+
+    p.governor = s;
+    p.setspeed = p.minFreq = p.maxFreq = 0;
+
+    applyPolicy(p);
+}
+
+void CpuFreqController::setFreq(int fq)
+{
+    CpuFreqPolicy p;
+
+    p.governor = "userspace";
+    p.setspeed = fq;
+    p.minFreq = p.maxFreq = 0;
+
+    applyPolicy(p);
+}
+
+bool CpuFreqController::writeString(int fd, QString *cached, const QString &val)
+{
+    if (*cached == val)
+        return true;
+
+    QByteArray b = val.toLocal8Bit().append('\n');     // as echo does, keeps plain files readable
+    if (pwrite(fd, b.constData(), b.size(), 0) != b.size())
+        return false;
+
+    *cached = val;
+
+    return true;
+}
+
+bool CpuFreqController::writeInt(int fd, int *cached, int val)
+{
+    char buf[16];
+    int len;
+
+    if (*cached == val)
+        return true;
+    if (fd == -1)
+        return false;
+
+    len = snprintf(buf, sizeof(buf), "%d\n", val);
+    if (pwrite(fd, buf, len, 0) != len)
+        return false;
+
+    *cached = val;
+
+    return true;
+}
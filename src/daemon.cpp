@@ -0,0 +1,480 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "h/daemon.h"
+#include "h/fangovernor.h"
+
+#include <QCoreApplication>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static int signalFd[2];
+
+static void termSignalHandler(int)
+{
+    char c = 1;
+    ssize_t r = write(signalFd[0], &c, 1);
+    (void)r;
+}
+
+static void fillSockAddr(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, hwPath(THINKCTLD_SOCKET_PATH).toLocal8Bit().constData(), sizeof(addr->sun_path) - 1);
+}
+
+DaemonServer::DaemonServer(Governor *g, Profile *p, const QString &group)
+{
+    struct sockaddr_un addr;
+    struct group *gr = getgrnam(group.toLocal8Bit().constData());
+
+    gov = g;
+    profile = p;
+    listenNotifier = NULL;
+    signalNotifier = NULL;
+    listenFd = -1;
+    pidFd = -1;
+    groupId = gr != NULL ? gr->gr_gid : (gid_t)-1;
+
+    /* SIGTERM and SIGINT are turned into a normal event loop exit */
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, signalFd) == -1) {
+        qDebug() << "Cannot create signal socket pair:" << strerror(errno);
+        signalFd[0] = signalFd[1] = -1;
+        return;
+    }
+    signalNotifier = new QSocketNotifier(signalFd[1], QSocketNotifier::Read, this);
+    connect(signalNotifier, SIGNAL(activated(int)), this, SLOT(signalReceived()));
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = termSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!lockPidFile())
+        return;
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        qDebug() << "Cannot create control socket";
+        return;
+    }
+
+    fillSockAddr(&addr);
+    unlink(hwPath(THINKCTLD_SOCKET_PATH).toLocal8Bit().constData());
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listenFd, 4) == -1) {
+        qDebug() << "Cannot listen on" << hwPath(THINKCTLD_SOCKET_PATH);
+        close(listenFd);
+        listenFd = -1;
+        return;
+    }
+
+    QByteArray path = hwPath(THINKCTLD_SOCKET_PATH).toLocal8Bit();
+
+    if (groupId == (gid_t)-1)
+        qDebug() << "No group" << group << "- only root may control the fan";
+    else if (chown(path.constData(), (uid_t)-1, groupId) == -1)
+        qDebug() << "Cannot give control socket to group" << group;
+    chmod(path.constData(), 0660);
+
+    listenNotifier = new QSocketNotifier(listenFd, QSocketNotifier::Read, this);
+    connect(listenNotifier, SIGNAL(activated(int)), this, SLOT(newConnection()));
+}
+
+DaemonServer::~DaemonServer()
+{
+    QList<int> fds = clients.keys();
+
+    for (int i = 0; i < fds.size(); i++)
+        dropClient(fds.at(i));
+
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(hwPath(THINKCTLD_SOCKET_PATH).toLocal8Bit().constData());
+    }
+
+    if (signalFd[0] != -1) {
+        close(signalFd[0]);
+        close(signalFd[1]);
+    }
+
+    if (pidFd != -1)
+        close(pidFd);                           // file stays, next daemon locks it again
+}
+
+/*
+ * Lock is dropped by the kernel when we exit in any way, so a pid file
+ * left by a crashed daemon doesn't block the next one.
+ */
+
+bool DaemonServer::lockPidFile()
+{
+    QByteArray path = hwPath(THINKCTLD_PID_PATH).toLocal8Bit();
+    QByteArray pid = QByteArray::number(getpid()).append('\n');
+
+    pidFd = open(path.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (pidFd == -1) {
+        qDebug() << "Cannot open" << path;
+        return false;
+    }
+
+    if (flock(pidFd, LOCK_EX | LOCK_NB) == -1) {
+        qDebug() << "thinkctld is already running";
+        close(pidFd);
+        pidFd = -1;
+        return false;
+    }
+
+    if (ftruncate(pidFd, 0) == -1 || write(pidFd, pid.constData(), pid.size()) != pid.size())
+        qDebug() << "Cannot write" << path;
+
+    return true;
+}
+
+bool DaemonServer::isListening()
+{
+    return listenFd != -1;
+}
+
+void DaemonServer::newConnection()
+{
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd == -1)
+        return;
+
+    if (!isPeerAllowed(fd)) {
+        close(fd);
+        return;
+    }
+
+    QSocketNotifier *n = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(n, SIGNAL(activated(int)), this, SLOT(readClient(int)));
+    clients.insert(fd, n);
+}
+
+void DaemonServer::readClient(int fd)
+{
+    char buf[256];
+    int len = read(fd, buf, sizeof(buf));
+
+    if (len <= 0) {
+        if (len == 0 || errno != EAGAIN)
+            dropClient(fd);
+        return;
+    }
+
+    QByteArray &data = pending[fd];
+    data.append(buf, len);
+
+    int nl;
+    while ((nl = data.indexOf('\n')) != -1) {
+        processCommand(data.left(nl));
+        data.remove(0, nl + 1);
+    }
+
+    if (data.size() > 1024)                     // garbage without newlines
+        dropClient(fd);
+}
+
+/* Root, our own user and members of control group, primary or not */
+
+bool DaemonServer::isPeerAllowed(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return false;
+
+    if (cred.uid == 0 || cred.uid == geteuid())
+        return true;
+
+    if (groupId != (gid_t)-1) {
+        struct passwd *pw = getpwuid(cred.uid);
+        gid_t groups[NGROUPS_MAX];
+        int n = NGROUPS_MAX;
+
+        if (cred.gid == groupId)
+            return true;
+
+        if (pw != NULL && getgrouplist(pw->pw_name, pw->pw_gid, groups, &n) != -1)
+            for (int i = 0; i < n; i++)
+                if (groups[i] == groupId)
+                    return true;
+    }
+
+    qDebug() << "Refusing control connection from uid" << cred.uid;
+    return false;
+}
+
+void DaemonServer::dropClient(int fd)
+{
+    delete clients.take(fd);
+    pending.remove(fd);
+    close(fd);
+}
+
+/* Integer arguments from first on, false if any of them isn't a number */
+
+static bool parseInts(const QList<QByteArray> &args, int first, int *out)
+{
+    bool ok = true;
+
+    for (int i = first; i < args.size() && ok; i++)
+        out[i - first] = args.at(i).toInt(&ok);
+
+    return ok;
+}
+
+/*
+ * Every command is checked as a whole before anything is applied, a
+ * rejected one leaves fan and profile as they were.
+ */
+
+void DaemonServer::processCommand(const QByteArray &line)
+{
+    QList<QByteArray> args = line.simplified().split(' ');
+    QByteArray cmd = args.value(0);
+
+    if (cmd == "mode" && (args.value(1) == "0" || args.value(1) == "1")) {
+        gov->setMode(args.at(1) == "1");
+
+    } else if (cmd == "level" && args.size() == 2) {
+        bool ok;
+        int l = args.at(1).toInt(&ok);
+
+        if (args.at(1) == "auto")
+            gov->setLevelAuto();
+        else if (args.at(1) == "full-speed")
+            gov->setFullSpeed();
+        else if (ok && l >= 0 && l <= FAN_CURVE_MAX_LEVEL)
+            gov->setLevel(l);
+        else
+            qDebug() << "Fan level rejected:" << line;
+
+    } else if (cmd == "profile" && (args.size() == 11 || args.size() == 13)) {
+        int v[12];
+        FanCurve c;
+        QString err;
+
+        if (!parseInts(args, 1, v)) {
+            qDebug() << "Profile rejected, not a number:" << line;
+            return;
+        }
+        for (int i = 0; i < 9; i += 3)
+            if (!c.setTriplet(v[i], v[i + 1], v[i + 2], v[9], &err)) {
+                qDebug() << "Profile rejected:" << err;
+                return;
+            }
+        if (args.size() == 13 && (v[10] < 0 || v[10] > 1 || v[11] <= 0 || v[11] >= FAN_CURVE_TEMPS)) {
+            qDebug() << "Profile rejected, wrong pid control" << v[10] << v[11];
+            return;
+        }
+
+        profile->setCpuMin(v[0]);
+        profile->setCpuMid(v[1]);
+        profile->setCpuMax(v[2]);
+        profile->setGpuMin(v[3]);
+        profile->setGpuMid(v[4]);
+        profile->setGpuMax(v[5]);
+        profile->setMchMin(v[6]);
+        profile->setMchMid(v[7]);
+        profile->setMchMax(v[8]);
+        profile->setTreshold(v[9]);
+        if (args.size() == 13) {
+            profile->setPidControl(v[10]);
+            profile->setTargetTemp(v[11]);
+        }
+        emit profileUpdated(*profile);
+
+    } else if (cmd == "curve" && args.size() >= 3) {
+        FanCurve c;
+        QString err;
+        QByteArray points;
+
+        for (int i = 2; i < args.size(); i++)
+            points.append(args.at(i)).append(' ');
+
+        if (args.at(1) != "cpu" && args.at(1) != "gpu" && args.at(1) != "mch") {
+            qDebug() << "Fan curve for unknown sensor:" << args.at(1);
+            return;
+        }
+        if (!c.fromString(QString(points), profile->getTreshold(), &err)) {
+            qDebug() << "Fan curve rejected:" << err;
+            return;
+        }
+
+        if (args.at(1) == "cpu")
+            profile->setCpuCurve(c);
+        else if (args.at(1) == "gpu")
+            profile->setGpuCurve(c);
+        else
+            profile->setMchCurve(c);
+        emit profileUpdated(*profile);
+
+    } else {
+        qDebug() << "Unknown command:" << line;
+    }
+}
+
+void DaemonServer::signalReceived()
+{
+    char c;
+    ssize_t r = read(signalFd[1], &c, 1);
+    (void)r;
+
+    QCoreApplication::quit();
+}
+
+DaemonClient::DaemonClient(QObject *parent) : QObject(parent)
+{
+    fd = -1;
+    notifier = NULL;
+
+    retry = new QTimer(this);
+    retry->setInterval(THINKCTLD_RECONNECT_INTERVAL);
+    connect(retry, SIGNAL(timeout()), this, SLOT(reconnect()));
+
+    open();
+}
+
+DaemonClient::~DaemonClient()
+{
+    delete notifier;
+    if (fd != -1)
+        close(fd);
+}
+
+bool DaemonClient::open()
+{
+    struct sockaddr_un addr;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    fillSockAddr(&addr);
+
+    if (fd != -1 && ::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd == -1)
+        return false;
+
+    /* Daemon never writes, socket gets readable only when it closes */
+    notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(readDaemon()));
+
+    return true;
+}
+
+void DaemonClient::lost()
+{
+    qDebug() << "Lost connection to thinkctld";
+
+    delete notifier;
+    notifier = NULL;
+    close(fd);
+    fd = -1;
+
+    retry->start();
+    emit disconnected();
+}
+
+void DaemonClient::readDaemon()
+{
+    char buf[64];
+
+    if (read(fd, buf, sizeof(buf)) <= 0)
+        lost();
+}
+
+void DaemonClient::reconnect()
+{
+    if (!open())
+        return;
+
+    qDebug() << "Connected to thinkctld again";
+    retry->stop();
+    emit reconnected();
+}
+
+bool DaemonClient::isConnected()
+{
+    return fd != -1;
+}
+
+void DaemonClient::sendMode(bool st)
+{
+    sendLine(st ? "mode 1" : "mode 0");
+}
+
+void DaemonClient::sendLevel(QString l)
+{
+    sendLine(QByteArray("level ").append(l.toAscii()));
+}
+
+void DaemonClient::sendProfile(Profile *p)
+{
+    QString s;
+
+    s.append("profile ");
+    s.append(QString::number(p->getCpuMin())).append(' ');
+    s.append(QString::number(p->getCpuMid())).append(' ');
+    s.append(QString::number(p->getCpuMax())).append(' ');
+    s.append(QString::number(p->getGpuMin())).append(' ');
+    s.append(QString::number(p->getGpuMid())).append(' ');
+    s.append(QString::number(p->getGpuMax())).append(' ');
+    s.append(QString::number(p->getMchMin())).append(' ');
+    s.append(QString::number(p->getMchMid())).append(' ');
+    s.append(QString::number(p->getMchMax())).append(' ');
+    s.append(QString::number(p->getTreshold())).append(' ');
+    s.append(QString::number(p->isPidControl())).append(' ');
+    s.append(QString::number(p->getTargetTemp()));
+
+    sendLine(s.toAscii());
+
+    sendLine(QString("curve cpu ").append(p->getCpuCurve()->toString()).toAscii());
+    sendLine(QString("curve gpu ").append(p->getGpuCurve()->toString()).toAscii());
+    sendLine(QString("curve mch ").append(p->getMchCurve()->toString()).toAscii());
+}
+
+void DaemonClient::sendLine(const QByteArray &line)
+{
+    if (fd == -1)
+        return;
+
+    QByteArray data(line);
+    data.append('\n');
+
+    if (send(fd, data.constData(), data.size(), MSG_NOSIGNAL) != data.size())
+        lost();
+}
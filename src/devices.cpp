@@ -18,6 +18,16 @@
 
 
 #include <h/devices.h>
+#include <h/samplebus.h>
+
+#include <QDir>
+#include <QFileInfo>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Block of sensor places in /proc/acpi/ibm/thermal */
 
@@ -47,11 +57,11 @@
 
 
 
-#define CORES_THERM_PATH "/sys/class/thermal/thermal_zone"
 #define THINKPAD_ACPI_THERMAL_PATH "/proc/acpi/ibm/thermal"
 #define THINKPAD_ACPI_FAN_PATH "/proc/acpi/ibm/fan"
 
 #define CPU_PATH "/sys/devices/system/cpu/cpu"
+#define CPU_STAT_PATH "/proc/stat"
 #define CPU_AVAIL_CORES_PATH "/sys/devices/system/cpu/present"
 #define CPU_AVAIL_FREQ_PATH "/sys/devices/system/cpu/cpu0/cpufreq/scaling_available_frequencies"
 #define CPU_CUR_FREQ_PATH "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_cur_freq"
@@ -64,88 +74,169 @@
 #define THINKPAD_UWB_PATH "/proc/acpi/ibm/uwb"
 #define THINKPAD_BT_PATH "/proc/acpi/ibm/bluetooth"
 
+#define SMAPI_PATH "/sys/devices/platform/smapi"
+#define SMAPI_BATTERIES 2               // main and bay or slice
+#define POWER_SUPPLY_PATH "/sys/class/power_supply"
+#define PSY_UEVENT_SIZE 4096
 
-#include <X11/Xatom.h>
-#include <X11/extensions/XInput.h>
 
-void setXDevProp(unsigned long dev, char *propty, int val, int val2 = -1, int val3 = -1, int val4 = -1);
-void setXDevProp32(unsigned long dev, char *propty, int fmt, int val, int val2 = -1);
-void setXdevPropFloat(unsigned long dev, char *propty, float val, float val2 = -1);
-long int findDeviceId(char *devname);
 
 
+Sensor::Sensor(const int16_t *vPtr, int p, int c)
+{
+    valuesPtr = vPtr;
+    positionNum = p;
+    critTemp = c;
+}
 
-Timer::Timer()
+int Sensor::getTemp()
 {
-    connect(&t, SIGNAL(timeout()), this, SLOT(timeIsOut()));
-    t.start(1000);
+    return valuesPtr[positionNum-1];
 }
 
-void Timer::setTimerInterval(int i)
+int Sensor::getTemp(const int16_t *thermal)
 {
-    t.setInterval(i);
+    return thermal[positionNum-1];
 }
 
-void Timer::timeIsOut()
+int Sensor::getCritTemp()
 {
-    emit timeout();
+    return critTemp;
 }
 
-Sensor::Sensor(QStringList *vPtr, int p, int c)
+SensorsArray::SensorsArray()
 {
-    valuesPtr = vPtr;
-    positionNum = p;
-    critTemp = c;
+    for (int i = 0; i < THERMAL_SLOTS; i++) {
+        values[i] = SENSOR_NONE;
+        trend[i] = SENSOR_NONE << EWMA_FRAC_BITS;
+    }
+
+    maxRise = 0;
+    bus = NULL;
+
+    thermalFd = open(hwPath(THINKPAD_ACPI_THERMAL_PATH).toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (thermalFd == -1)
+        qDebug() << "Cannot open" << hwPath(THINKPAD_ACPI_THERMAL_PATH);
+
+    fanFd = open(hwPath(THINKPAD_ACPI_FAN_PATH).toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+
+    cpu = new Cpu();
+    gpu = new Gpu(values, GPU, GPU_CT);
+    mch = new Sensor(values, MCH, MCH_CT);
+    ich = new Sensor(values, ICH, ICH_CT);
+    aps = new Sensor(values, APS, APS_CT);
+    pwr = new Sensor(values, PWR, PWR_CT);
+    pcmcia = new Sensor(values, PCM, PCM_CT);
+    mainBatFirst = new Sensor(values, MFB, MB_CT);
+    mainBatSecond = new Sensor(values, MSB, MB_CT);
+    bayBatFirst = new Sensor(values, BFB, BB_CT);
+    bayBatSecond = new Sensor(values, BSB, BB_CT);
+
+    updateThermValues();
 }
 
-QString Sensor::getTemp()
+SensorsArray::~SensorsArray()
 {
-    QString s = valuesPtr->value(positionNum-1);
+    delete cpu;
+    delete gpu;
+    delete mch;
+    delete ich;
+    delete aps;
+    delete pwr;
+    delete pcmcia;
+    delete mainBatFirst;
+    delete mainBatSecond;
+    delete bayBatFirst;
+    delete bayBatSecond;
 
-    if (s == "-128")
-        return "none";
-    else
-        return s;
+    if (thermalFd != -1)
+        close(thermalFd);
+    if (fanFd != -1)
+        close(fanFd);
 }
 
-int Sensor::getCritTemp()
+void SensorsArray::getThermValues(int16_t *out)
 {
-    return critTemp;
+    memcpy(out, values, sizeof(values));
 }
 
-SensorsArray::SensorsArray()
+ZoneStats SensorsArray::getThermStats()
 {
-    thermalSrc.setFileName(THINKPAD_ACPI_THERMAL_PATH);
-    thermalSrc.open(QIODevice::ReadOnly);
-    stream.setDevice(&thermalSrc);
-    values = stream.readLine().split(' ');
+    return stats;
+}
 
-    cpu = new Cpu();
-    gpu = new Gpu(&values, GPU, GPU_CT);
-    mch = new Sensor(&values, MCH, MCH_CT);
-    ich = new Sensor(&values, ICH, ICH_CT);
-    aps = new Sensor(&values, APS, APS_CT);
-    pwr = new Sensor(&values, PWR, PWR_CT);
-    pcmcia = new Sensor(&values, PCM, PCM_CT);
-    mainBatFirst = new Sensor(&values, MFB, MB_CT);
-    mainBatSecond = new Sensor(&values, MSB, MB_CT);
-    bayBatFirst = new Sensor(&values, BFB, BB_CT);
-    bayBatSecond = new Sensor(&values, BSB, BB_CT);
+int SensorsArray::getMaxRise()
+{
+    return maxRise;
+}
+
+void SensorsArray::setSampleBus(SampleBus *b)
+{
+    bus = b;
+    updateThermValues();                    // so bus is never empty
 }
 
+/*
+ * Read the whole thermal file with one pread() into a stack buffer and
+ * parse it in place. No allocations are made on this path.
+ */
+
 void SensorsArray::updateThermValues()
 {
-    stream.seek(0);
-    values = stream.readLine().split(' ');
+    char buf[128];
+    int len = -1;
+
+    if (thermalFd != -1)
+        len = pread(thermalFd, buf, sizeof(buf), 0);
+
+    if (len > 0)
+        parseThermValues(buf, len, values, THERMAL_SLOTS);
+
+    maxRise = ewmaMaxRise(trend, values, THERMAL_SLOTS);     // against average before this sample
+    ewmaUpdate(trend, values, THERMAL_SLOTS);
+    reduceZones(values, THERMAL_SLOTS, &stats);
+
+    cpu->refresh();
+
+    if (bus) {
+        Sample smp;
+        int n = -1;
+
+        memcpy(smp.thermal, values, sizeof(values));
+        smp.thermStats = stats;
+        smp.maxRise = maxRise;
+        smp.cpuLoad = cpu->getLoad();
+        smp.cpu = *cpu->getTemps();
+
+        smp.fanSpeed = 0;
+        smp.fanLevel = FAN_LEVEL_UNKNOWN;
+        if (fanFd != -1)
+            n = pread(fanFd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            int speed = 0, level = FAN_LEVEL_UNKNOWN;
+            parseFanStatus(buf, n, &speed, &level);
+            smp.fanSpeed = speed;
+            smp.fanLevel = level;
+        }
+
+        bus->publish(smp);
+    }
 
     emit thermalValuesUpdated();
 }
 
 Fan::Fan()
 {
-    fanSrc.setFileName(THINKPAD_ACPI_FAN_PATH);
+    commanded = FAN_LEVEL_UNKNOWN;
+    writesIssued = writesSuppressed = 0;
+    watchdog = 0;
+    watchdogArmed = false;
+    writable = true;
+
+    fanSrc.setFileName(hwPath(THINKPAD_ACPI_FAN_PATH));
     if (fanSrc.open(QIODevice::ReadWrite) == false) {
-        qErrnoWarning("Cannot open fan for writing.");
+        qDebug() << "Fan is read-only, it's left to firmware";
+        writable = false;
         fanSrc.open(QIODevice::ReadOnly);
     }
     stream.setDevice(&fanSrc);
@@ -175,21 +266,89 @@ QString Fan::getStatus()
     return stream.readLine().section(':', 1).trimmed();
 }
 
+/*
+ * One pwrite per command, thinkpad_acpi takes whole command from a single
+ * write and ignores offset. Buffered stream used to delay writes until
+ * next read seeked it.
+ */
+
+bool Fan::command(int l)
+{
+    if (!writable)
+        return false;
+
+    if (l == commanded) {
+        writesSuppressed++;
+        return true;
+    }
+
+    QByteArray b = "level ";
+    if (l == FAN_LEVEL_AUTO)
+        b += "auto";
+    else if (l == FAN_LEVEL_FULL_SPEED)
+        b += "full-speed";
+    else
+        b += QByteArray::number(l);
+
+    writesIssued++;
+    if (!write(b)) {
+        commanded = FAN_LEVEL_UNKNOWN;
+        return false;
+    }
+
+    commanded = l;
+    lastChange.start();
+
+    return true;
+}
+
+/* Permission errors won't go away, fan is not commanded after the first one */
+
+bool Fan::write(const QByteArray &cmd)
+{
+    if (pwrite(fanSrc.handle(), cmd.constData(), cmd.size(), 0) != cmd.size()) {
+        if (errno == EBADF || errno == EACCES || errno == EPERM) {
+            qDebug() << "Fan doesn't take commands (" << strerror(errno) << "), it's left to firmware";
+            writable = false;
+        } else
+            qDebug() << "Cannot write" << cmd << "to fan";
+        return false;
+    }
+
+    lastWrite.start();
+
+    return true;
+}
+
+/*
+ * Going up is never delayed, it's the safe direction. Going down waits
+ * until the current level has been held FAN_MIN_DWELL_MS, short dips of
+ * temperature then don't make the fan audibly change speed twice.
+ */
+
+bool Fan::requestLevel(int l)
+{
+    if (l < commanded && lastChange.isValid() && lastChange.elapsed() < FAN_MIN_DWELL_MS) {
+        writesSuppressed++;
+        return false;
+    }
+
+    return command(l);
+}
+
 void Fan::setLevel(int l)           // To-do: add check for module fan parametr
 {
-    QString s = "level ";
-    s = s+=QString::number(l);
-    stream << s;
+    command(l);
 }
 
 void Fan::setLevelAuto()
 {
-    stream << "level auto";
+    command(FAN_LEVEL_AUTO);
 }
 
 void Fan::setFullSpeed()
 {
-    stream << "level full-speed";
+    command(FAN_LEVEL_FULL_SPEED);
 }
 
 void Fan::setFanOff()
@@ -197,36 +356,146 @@ void Fan::setFanOff()
     setLevel(0);
 }
 
+int Fan::getCommandedLevel()
+{
+    return commanded;
+}
+
+void Fan::forgetLevel()
+{
+    commanded = FAN_LEVEL_UNKNOWN;
+}
+
+unsigned long Fan::getWritesIssued()
+{
+    return writesIssued;
+}
+
+unsigned long Fan::getWritesSuppressed()
+{
+    return writesSuppressed;
+}
+
+void Fan::setWatchdog(int seconds)
+{
+    if (seconds != watchdog)
+        watchdogArmed = false;
+    watchdog = seconds;
+}
+
+/*
+ * Rewritten at a third of timeout, so ticks up to THERMAL_SLOW_INTERVAL
+ * and saver coalescing still fit twice before it expires. If it expired
+ * anyway, loop was stalled and firmware has the fan in auto now.
+ */
+
+void Fan::kickWatchdog()
+{
+    if (!writable || (watchdogArmed && watchdog == 0))
+        return;
+
+    if (watchdogArmed && lastWrite.isValid()) {
+        qint64 idle = lastWrite.elapsed();
+
+        if (idle > watchdog * 1000) {
+            qDebug() << "Fan watchdog expired after" << idle << "ms, fan is in auto mode";
+            commanded = FAN_LEVEL_AUTO;
+        } else if (idle < watchdog * 1000 / 3)
+            return;
+    }
+
+    QByteArray b = "watchdog ";
+    b += QByteArray::number(watchdog);
+
+    if (!write(b)) {
+        if (writable)
+            qDebug() << "Fan watchdog disabled";
+        watchdog = 0;                       // don't retry every tick
+    }
+    watchdogArmed = true;
+}
+
 Cpu::Cpu()
 {
     critTemp = CPU_CT;
-    availCores = this->getAvailCores();
+    availCores = topology.getThreadsCount();
 
-    for (int i = 0; i < availCores; i++) {
-        QString str;
-        str.append(CORES_THERM_PATH).append(QString::number(i)).append("/temp");
+    load = 0;
+    prevBusy = prevTotal = 0;
+    statFd = open(hwPath(CPU_STAT_PATH).toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (statFd == -1)
+        qDebug() << "Cannot open" << hwPath(CPU_STAT_PATH);
 
-        QFile *f = new QFile(str);
-        f->open(QIODevice::ReadOnly);
-        file.append(f);
-    }
+    refresh();
+}
+
+Cpu::~Cpu()
+{
+    if (statFd != -1)
+        close(statFd);
+}
+
+void Cpu::refresh()
+{
+    topology.refresh(&temps);
+    refreshLoad();
+}
+
+/* Busy share of all cpus since previous refresh, from "cpu" line of /proc/stat */
+
+void Cpu::refreshLoad()
+{
+    char buf[256];
+    unsigned long long v[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned long long busy = 0, total = 0;
+    int len;
+
+    if (statFd == -1)
+        return;
+
+    len = pread(statFd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return;
+    buf[len] = '\0';
+
+    char *p = buf + 3;                      // skip "cpu"
+    for (int i = 0; i < 8; i++)
+        v[i] = strtoull(p, &p, 10);
+
+    for (int i = 0; i < 8; i++)
+        total += v[i];
+    busy = total - v[3] - v[4];             // minus idle and iowait
+
+    if (total > prevTotal)
+        load = (int)((busy - prevBusy) * 100 / (total - prevTotal));
+
+    prevBusy = busy;
+    prevTotal = total;
+}
+
+int Cpu::getLoad()
+{
+    return load;
 }
 
 int Cpu::getAvailCores()
 {
-    QFile f(CPU_AVAIL_CORES_PATH);
-    QTextStream ts(&f);
-    QStringList strLst;
+    return availCores;
+}
 
-    f.open(QIODevice::ReadOnly);
-    strLst = ts.readLine().split('-');
+int Cpu::getPhysCores()
+{
+    return topology.getCoresCount();
+}
 
-    return strLst.size();
+int Cpu::getPackages()
+{
+    return topology.getPackagesCount();
 }
 
 QStringList Cpu::getAvailFreq()
 {
-    QFile f(CPU_AVAIL_FREQ_PATH);
+    QFile f(hwPath(CPU_AVAIL_FREQ_PATH));
     QTextStream ts(&f);
     QStringList sl;
 
@@ -238,18 +507,17 @@ QStringList Cpu::getAvailFreq()
 
 int Cpu::getTemp()
 {
-    int sum = 0;
-    int average;
-
-    for (int i = 0; i < availCores; i++) {
-        QTextStream ts(file.at(i));
-        sum += ts.readLine().toInt();
-        ts.seek(0);
-    }
+    return temps.max;
+}
 
-    average = sum/availCores/1000;             // divide on 1000 for delete zeroes in the end
+int Cpu::getAvgTemp()
+{
+    return temps.avg;
+}
 
-    return average;
+const CpuTemps *Cpu::getTemps()
+{
+    return &temps;
 }
 
 int Cpu::getCritTemp()
@@ -259,7 +527,7 @@ int Cpu::getCritTemp()
 
 int Cpu::getCurFreq()
 {
-    QFile f(CPU_CUR_FREQ_PATH);
+    QFile f(hwPath(CPU_CUR_FREQ_PATH));
     QTextStream ts(&f);
 
     f.open(QIODevice::ReadOnly);
@@ -269,7 +537,7 @@ int Cpu::getCurFreq()
 
 QString Cpu::getCurGovernor()
 {
-    QFile f(CPU_CUR_GOVNR_PATH);
+    QFile f(hwPath(CPU_CUR_GOVNR_PATH));
     QTextStream ts(&f);
 
     f.open(QIODevice::ReadOnly);
@@ -277,51 +545,6 @@ QString Cpu::getCurGovernor()
     return ts.readLine();
 }
 
-void Cpu::setGovernor(QString s)
-{
-    QString pStr;
-
-    for (int i = 0; i < availCores; i++) {
-        pStr.append(CPU_PATH).append(QString::number(i)).append("/cpufreq/scaling_governor");
-        QFile *f = new QFile(pStr);
-        QTextStream *ts = new QTextStream(f);
-
-        if (f->open(QIODevice::WriteOnly) == false)
-            qDebug() << "Cannot write to cpu scaling governor files.";
-        else
-            *ts << s;
-
-        f->close();
-        delete ts;
-        delete f;
-        pStr.clear();
-    }
-}
-
-void Cpu::setFreq(int fq)
-{
-    QString pStr;
-
-    if (getCurGovernor() != "userspace")
-        setGovernor("userspace");
-
-    for (int i = 0; i < availCores; i++) {
-        pStr.append(CPU_PATH).append(QString::number(i)).append("/cpufreq/scaling_setspeed");
-        QFile *f = new QFile(pStr);
-        QTextStream *ts = new QTextStream(f);
-
-        if (f->open(QIODevice::WriteOnly) == false)
-            qDebug() << "Cannot write to cpu frequency set files";
-        else
-            *ts << fq;
-
-        f->close();
-        delete ts;
-        delete f;
-        pStr.clear();
-    }
-}
-
 Radeon::Radeon()
 {
     profilesList = (QStringList() << "auto" << "low" << "mid" << "high");
@@ -334,7 +557,7 @@ QStringList Radeon::getProfiles()
 
 int Radeon::getCurProfile()
 {
-    QFile f(GPU_METHOD_PATH);
+    QFile f(hwPath(GPU_METHOD_PATH));
     QTextStream ts(&f);
 
     f.open(QIODevice::ReadOnly);
@@ -344,7 +567,7 @@ int Radeon::getCurProfile()
 
 void Radeon::setProfile(int p)
 {
-    QFile f(GPU_PROFILE_PATH);
+    QFile f(hwPath(GPU_PROFILE_PATH));
     QTextStream ts(&f);
 
     if (f.open(QIODevice::WriteOnly) == false)
@@ -376,7 +599,7 @@ bool Gpu::isPresent() { return present; }
 /*
 QString Gpu::getCurMethod()
 {
-    QFile f(GPU_METHOD_PATH);
+    QFile f(hwPath(GPU_METHOD_PATH));
     QTextStream ts(&f);
 
     f.open(QIODevice::ReadOnly);
@@ -387,7 +610,7 @@ QString Gpu::getCurMethod()
 /*
 QString Gpu::getCurProfile()
 {
-    QFile f(GPU_PROFILE_PATH);
+    QFile f(hwPath(GPU_PROFILE_PATH));
     QTextStream ts(&f);
 
     f.open(QIODevice::ReadOnly);
@@ -403,7 +626,7 @@ int Gpu::getCurProfile()
 /*
 void Gpu::setMethod(QString s)
 {
-    QFile f(GPU_METHOD_PATH);
+    QFile f(hwPath(GPU_METHOD_PATH));
     QTextStream ts(&f);
 
     if (f.open(QIODevice::WriteOnly) == false)
@@ -418,7 +641,7 @@ void Gpu::setMethod(QString s)
 /*
 void Gpu::setProfile(QString s)
 {
-    QFile f(GPU_PROFILE_PATH);
+    QFile f(hwPath(GPU_PROFILE_PATH));
     QTextStream ts(&f);
 
     if (f.open(QIODevice::WriteOnly) == false)
@@ -435,111 +658,503 @@ void Gpu::setProfile(int p)
     gpu->setProfile(p);
 }
 
-/* Battery class implementation */
+/* Battery backends implementation */
+
+static const char *smapiDynamicFiles[] = {
+    "installed", "state", "remaining_percent", "remaining_running_time",
+    "remaining_charging_time", "cycle_count", "voltage", "remaining_capacity",
+    "last_full_capacity"
+};
+
+SmapiBattery::SmapiBattery(int batNum)
+{
+    batPath.append(hwPath(SMAPI_PATH "/BAT")).append(QString::number(batNum)).append("/");
+
+    dirFd = open(batPath.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    acFd = open(hwPath(SMAPI_PATH "/ac_connected").toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+
+    for (int i = 0; i < DYNAMIC_FILES; i++) {
+        fd[i] = dirFd != -1 ? openat(dirFd, smapiDynamicFiles[i], O_RDONLY | O_CLOEXEC) : -1;
+        if (fd[i] == -1)
+            qDebug() << "Cannot open" << QString(batPath).append(smapiDynamicFiles[i]);
+    }
+}
+
+SmapiBattery::~SmapiBattery()
+{
+    for (int i = 0; i < DYNAMIC_FILES; i++)
+        if (fd[i] != -1)
+            close(fd[i]);
+
+    if (acFd != -1)
+        close(acFd);
+    if (dirFd != -1)
+        close(dirFd);
+}
+
+QString SmapiBattery::getName()
+{
+    return QString(batPath).section('/', -2, -2);
+}
+
+/* Failed reads give 0 or empty string, so closed fds need no checks */
+
+void SmapiBattery::read(BatterySnapshot *s)
+{
+    s->acConnected = readIntFromFd(acFd);
+    s->installed = readIntFromFd(fd[INSTALLED]);
+    s->state = readStringFromFd(fd[STATE]);
+
+    if (!s->installed)
+        return;
+
+    s->chargeLvl = readIntFromFd(fd[CHARGE_LVL]);
+    s->runningTime = readIntFromFd(fd[RUNNING_TIME]);       // "not_discharging" reads as 0
+    s->chargingTime = readIntFromFd(fd[CHARGING_TIME]);
+    s->cyclesCount = readIntFromFd(fd[CYCLES]);
+    s->voltage = readIntFromFd(fd[VOLTAGE]);
+    s->remainingCapacity = readIntFromFd(fd[REMAINING_CAP]);
+    s->lastFullCapacity = readIntFromFd(fd[FULL_CAP]);
+}
+
+void SmapiBattery::readIdentity(BatterySnapshot *s)
+{
+    s->firstUseDate = readString("first_use_date");
+    s->manufacturer = readString("manufacturer");
+    s->model = readString("model");
+    s->type = readString("chemistry");
+    s->manufactureDate = readString("manufacture_date");
+    s->designCapacity = readString("design_capacity").toInt();
+    s->designVoltage = readString("design_voltage").toInt();
+}
+
+/* For attributes read once, so fd isn't kept */
+
+QString SmapiBattery::readString(const char *name)
+{
+    int f = dirFd != -1 ? openat(dirFd, name, O_RDONLY | O_CLOEXEC) : -1;
+
+    if (f == -1) {
+        qDebug() << "Cannot open" << QString(batPath).append(name);
+        return QString();
+    }
+
+    QString out = readStringFromFd(f);
+    close(f);
+
+    return out;
+}
+
+int SmapiBattery::getStartThreshold()
+{
+    return getIntValueFromFile(QString(batPath).append("start_charge_thresh"));
+}
 
-Battery::Battery(int batNum)
+int SmapiBattery::getStopThreshold()
 {
-    batPath.append("/sys/devices/platform/smapi/BAT").append(QString::number(batNum)).append("/");
+    return getIntValueFromFile(QString(batPath).append("stop_charge_thresh"));
 }
 
-bool Battery::isInstalled()
+void SmapiBattery::setStartThreshold(int n)
 {
-    return (bool)getIntValueFromFile(QString(batPath).append("installed"));
+    setIntValueToFile(QString(batPath).append("start_charge_thresh"), n);
 }
 
-bool Battery::isACConnected()
+void SmapiBattery::setStopThreshold(int n)
 {
-    return (bool)getIntValueFromFile("/sys/devices/platform/smapi/ac_connected");
+    setIntValueToFile(QString(batPath).append("stop_charge_thresh"), n);
 }
 
-QString Battery::getState()
+/*
+ * Point vals[i] to value of POWER_SUPPLY_<keys[i]> line of uevent text
+ * in buf, NULL if there is no such line. Lines are split in place.
+ */
+
+static void parseUevent(char *buf, const char *const *keys, int n, const char **vals)
 {
-    return getStringValueFromFile(QString(batPath).append("state"));
+    char *line = buf;
+
+    for (int i = 0; i < n; i++)
+        vals[i] = NULL;
+
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+
+        if (next)
+            *next++ = '\0';
+
+        char *eq = strchr(line, '=');
+
+        if (eq && !strncmp(line, "POWER_SUPPLY_", 13)) {
+            *eq = '\0';
+            for (int i = 0; i < n; i++)
+                if (!strcmp(line + 13, keys[i])) {
+                    vals[i] = eq + 1;
+                    break;
+                }
+        }
+
+        line = next;
+    }
 }
 
-int Battery::getChargeLvl()
+static long long ueventInt(const char *v)
 {
-    return getIntValueFromFile(QString(batPath).append("remaining_percent"));
+    return v ? strtoll(v, NULL, 10) : 0;
 }
 
-int Battery::getRemainingRunningTime()
+PowerSupplyBattery::PowerSupplyBattery(const QString &dir, const QString &acDir)
 {
-    return getIntValueFromFile(QString(batPath).append("remaining_running_time"));
+    batPath = QString(dir).append("/");
+
+    ueventFd = open(QString(batPath).append("uevent").toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (ueventFd == -1)
+        qDebug() << "Cannot open" << QString(batPath).append("uevent");
+
+    acFd = acDir.isEmpty() ? -1 : open(QString(acDir).append("/online").toLocal8Bit().constData(),
+                                       O_RDONLY | O_CLOEXEC);
+}
+
+PowerSupplyBattery::~PowerSupplyBattery()
+{
+    if (ueventFd != -1)
+        close(ueventFd);
+    if (acFd != -1)
+        close(acFd);
+}
+
+QString PowerSupplyBattery::getName()
+{
+    return QString(batPath).section('/', -2, -2);
+}
+
+/*
+ * Batteries report either energy (uWh, uW) or charge (uAh, uA), the
+ * latter is converted with present voltage, so snapshot is in mWh and mW.
+ */
+
+void PowerSupplyBattery::read(BatterySnapshot *s)
+{
+    enum { PRESENT, STATUS, CAPACITY, CYCLE_COUNT, VOLTAGE_NOW, ENERGY_NOW, ENERGY_FULL,
+           POWER_NOW, CHARGE_NOW, CHARGE_FULL, CURRENT_NOW, KEYS };
+    static const char *const keys[KEYS] = {
+        "PRESENT", "STATUS", "CAPACITY", "CYCLE_COUNT", "VOLTAGE_NOW", "ENERGY_NOW",
+        "ENERGY_FULL", "POWER_NOW", "CHARGE_NOW", "CHARGE_FULL", "CURRENT_NOW"
+    };
+    char buf[PSY_UEVENT_SIZE];
+    const char *v[KEYS];
+    int len = pread(ueventFd, buf, sizeof(buf) - 1, 0);
+
+    s->acConnected = readIntFromFd(acFd);
+
+    if (len <= 0) {
+        s->installed = false;
+        s->state = "none";
+        return;
+    }
+
+    buf[len] = '\0';
+    parseUevent(buf, keys, KEYS, v);
+
+    s->installed = ueventInt(v[PRESENT]);
+    if (!s->installed) {
+        s->state = "none";
+        return;
+    }
+
+    if (v[STATUS] && !strcmp(v[STATUS], "Charging"))
+        s->state = "charging";
+    else if (v[STATUS] && !strcmp(v[STATUS], "Discharging"))
+        s->state = "discharging";
+    else
+        s->state = "idle";
+
+    long long uv = ueventInt(v[VOLTAGE_NOW]);
+    long long remaining, full, power;
+
+    if (v[ENERGY_NOW]) {
+        remaining = ueventInt(v[ENERGY_NOW]) / 1000;
+        full = ueventInt(v[ENERGY_FULL]) / 1000;
+        power = ueventInt(v[POWER_NOW]) / 1000;
+    } else {
+        remaining = ueventInt(v[CHARGE_NOW]) * uv / 1000000000LL;
+        full = ueventInt(v[CHARGE_FULL]) * uv / 1000000000LL;
+        power = ueventInt(v[CURRENT_NOW]) * uv / 1000000000LL;
+    }
+
+    power = qAbs(power);                // some drivers sign it by direction
+
+    s->chargeLvl = ueventInt(v[CAPACITY]);
+    s->cyclesCount = ueventInt(v[CYCLE_COUNT]);
+    s->voltage = uv / 1000;
+    s->remainingCapacity = remaining;
+    s->lastFullCapacity = full;
+    s->runningTime = s->state == "discharging" && power > 0 ? remaining * 60 / power : 0;
+    s->chargingTime = s->state == "charging" && power > 0 && full > remaining ?
+                (full - remaining) * 60 / power : 0;
 }
 
-int Battery::getChargingTime()
+void PowerSupplyBattery::readIdentity(BatterySnapshot *s)
 {
-    return getIntValueFromFile(QString(batPath).append("remaining_charging_time"));
+    enum { MANUFACTURER, MODEL_NAME, TECHNOLOGY, ENERGY_FULL_DESIGN, CHARGE_FULL_DESIGN,
+           VOLTAGE_MIN_DESIGN, MANUFACTURE_YEAR, MANUFACTURE_MONTH, MANUFACTURE_DAY, KEYS };
+    static const char *const keys[KEYS] = {
+        "MANUFACTURER", "MODEL_NAME", "TECHNOLOGY", "ENERGY_FULL_DESIGN", "CHARGE_FULL_DESIGN",
+        "VOLTAGE_MIN_DESIGN", "MANUFACTURE_YEAR", "MANUFACTURE_MONTH", "MANUFACTURE_DAY"
+    };
+    char buf[PSY_UEVENT_SIZE];
+    const char *v[KEYS];
+    int len = pread(ueventFd, buf, sizeof(buf) - 1, 0);
+
+    if (len <= 0)
+        return;
+
+    buf[len] = '\0';
+    parseUevent(buf, keys, KEYS, v);
+
+    long long uv = ueventInt(v[VOLTAGE_MIN_DESIGN]);
+
+    s->manufacturer = v[MANUFACTURER];
+    s->model = v[MODEL_NAME];
+    s->type = v[TECHNOLOGY];
+    s->designVoltage = uv / 1000;
+    s->designCapacity = v[ENERGY_FULL_DESIGN] ? ueventInt(v[ENERGY_FULL_DESIGN]) / 1000 :
+                                                ueventInt(v[CHARGE_FULL_DESIGN]) * uv / 1000000000LL;
+
+    if (v[MANUFACTURE_YEAR])                    // no first use date in this class
+        s->manufactureDate = QString("%1-%2-%3").arg(v[MANUFACTURE_YEAR])
+                .arg(ueventInt(v[MANUFACTURE_MONTH]), 2, 10, QChar('0'))
+                .arg(ueventInt(v[MANUFACTURE_DAY]), 2, 10, QChar('0'));
 }
 
-int Battery::getCyclesCount()
+int PowerSupplyBattery::getStartThreshold()
 {
-    return getIntValueFromFile(QString(batPath).append("cycle_count"));
+    return getIntValueFromFile(QString(batPath).append("charge_control_start_threshold"));
 }
 
-int Battery::getCurrentVoltage()
+int PowerSupplyBattery::getStopThreshold()
 {
-    return getIntValueFromFile(QString(batPath).append("voltage"));
+    return getIntValueFromFile(QString(batPath).append("charge_control_end_threshold"));
 }
 
-int Battery::getRemainingCapacity()
+void PowerSupplyBattery::setStartThreshold(int n)
 {
-    return getIntValueFromFile(QString(batPath).append("remaining_capacity"));
+    setIntValueToFile(QString(batPath).append("charge_control_start_threshold"), n);
 }
 
-QString Battery::getFirstUseDate()
+void PowerSupplyBattery::setStopThreshold(int n)
 {
-    return getStringValueFromFile(QString(batPath).append("first_use_date"));
+    setIntValueToFile(QString(batPath).append("charge_control_end_threshold"), n);
 }
 
-QString Battery::getManufacturer()
+/* Battery class implementation */
+
+Battery::Battery(AbstractBatteryBackend *b)
 {
-    return getStringValueFromFile(QString(batPath).append("manufacturer"));
+    backend = b;
+
+    snap.installed = false;
+    snap.acConnected = false;
+    snap.chargeLvl = snap.runningTime = snap.chargingTime = 0;
+    snap.cyclesCount = snap.voltage = snap.remainingCapacity = snap.lastFullCapacity = 0;
+    snap.designCapacity = snap.designVoltage = 0;
+
+    read();                             // snapshot is valid before first refresh()
 }
 
-QString Battery::getModel()
+Battery::~Battery()
 {
-    return getStringValueFromFile(QString(batPath).append("model"));
+    delete backend;
 }
 
-QString Battery::getType()
+QString Battery::getName()
 {
-    return getStringValueFromFile(QString(batPath).append("chemistry"));
+    return backend->getName();
 }
 
-int Battery::getDesignCapacity()
+const BatterySnapshot &Battery::getSnapshot()
 {
-    return getIntValueFromFile(QString(batPath).append("design_capacity"));
+    return snap;
 }
 
-int Battery::getDesignVoltage()
+void Battery::refresh()
 {
-    return getIntValueFromFile(QString(batPath).append("design_voltage"));
+    uint dirty = read();
+
+    if (dirty)
+        emit snapshotChanged(dirty);
 }
 
-QString Battery::getManufactureDate()
+/* One pass over dynamic fields, returns mask of changed ones */
+
+uint Battery::read()
 {
-    return getStringValueFromFile(QString(batPath).append("manufacture_date"));
+    BatterySnapshot n = snap;           // strings are shared, copy is cheap
+    uint dirty = 0;
+
+    backend->read(&n);
+
+    if (n.installed != snap.installed)
+        dirty |= BAT_INSTALLED;
+    if (n.acConnected != snap.acConnected)
+        dirty |= BAT_AC_CONNECTED;
+    if (n.state != snap.state)
+        dirty |= BAT_STATE;
+    if (n.chargeLvl != snap.chargeLvl)
+        dirty |= BAT_CHARGE_LVL;
+    if (n.runningTime != snap.runningTime)
+        dirty |= BAT_RUNNING_TIME;
+    if (n.chargingTime != snap.chargingTime)
+        dirty |= BAT_CHARGING_TIME;
+    if (n.cyclesCount != snap.cyclesCount)
+        dirty |= BAT_CYCLES;
+    if (n.voltage != snap.voltage)
+        dirty |= BAT_VOLTAGE;
+    if (n.remainingCapacity != snap.remainingCapacity)
+        dirty |= BAT_REMAINING_CAP;
+    if (n.lastFullCapacity != snap.lastFullCapacity)
+        dirty |= BAT_FULL_CAP;
+
+    if (n.installed && (dirty & BAT_INSTALLED)) {   // new battery, possibly another one
+        backend->readIdentity(&n);
+        dirty |= BAT_IDENTITY;
+    }
+
+    snap = n;
+
+    return dirty;
 }
 
 int Battery::getStartChargingTreshold()
 {
-    return getIntValueFromFile(QString(batPath).append("start_charge_thresh"));
+    return backend->getStartThreshold();
 }
 
 int Battery::getStopChargingTreshold()
 {
-    return getIntValueFromFile(QString(batPath).append("stop_charge_thresh"));
+    return backend->getStopThreshold();
 }
 
 void Battery::setStartChargingTreshold(int n)
 {
-    setIntValueToFile(QString(batPath).append("start_charge_thresh"), n);
+    backend->setStartThreshold(n);
 }
 
 void Battery::setStopChargingTreshold(int n)
 {
-    setIntValueToFile(QString(batPath).append("stop_charge_thresh"), n);
+    backend->setStopThreshold(n);
+}
+
+/*
+ * tp_smapi is preferred when it's loaded, it has thresholds on machines
+ * where power_supply doesn't. Peripheral batteries (scope Device) of
+ * power_supply class are skipped.
+ */
+
+QList<Battery *> findBatteries()
+{
+    QList<Battery *> bats;
+
+    if (QFile::exists(hwPath(SMAPI_PATH))) {
+        for (int i = 0; i < SMAPI_BATTERIES; i++)
+            if (QFile::exists(hwPath(SMAPI_PATH "/BAT").append(QString::number(i))))
+                bats.append(new Battery(new SmapiBattery(i)));
+
+        if (!bats.isEmpty())
+            return bats;
+    }
+
+    QString root = hwPath(POWER_SUPPLY_PATH);
+    QStringList supplies = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    QString acDir = findMainsSupply();
+
+    for (int i = 0; i < supplies.size(); i++) {
+        QString dir = QString(root).append('/').append(supplies.at(i));
+
+        if (getStringValueFromFile(QString(dir).append("/type")) == "Battery" &&
+                !(QFile::exists(QString(dir).append("/scope")) &&
+                  getStringValueFromFile(QString(dir).append("/scope")) == "Device"))
+            bats.append(new Battery(new PowerSupplyBattery(dir, acDir)));
+    }
+
+    return bats;
+}
+
+QString findMainsSupply()
+{
+    QString root = hwPath(POWER_SUPPLY_PATH);
+    QStringList supplies = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+
+    for (int i = 0; i < supplies.size(); i++) {
+        QString dir = QString(root).append('/').append(supplies.at(i));
+
+        if (getStringValueFromFile(QString(dir).append("/type")) == "Mains")
+            return dir;
+    }
+
+    return QString();
+}
+
+/*
+ * All installed batteries as one. Capacities add up, times are computed
+ * for the summed capacity. Identity strings, voltage and cycles don't
+ * and stay empty.
+ */
+
+BatterySnapshot sumBatteries(const QList<Battery *> &bats)
+{
+    static const char *states[] = { "none", "idle", "discharging", "charging" };
+    BatterySnapshot t;
+    int state = 0;
+    long long drainPower = 0, chargePower = 0;      // mW, of packs in use
+
+    t.installed = false;
+    t.acConnected = false;
+    t.chargeLvl = t.runningTime = t.chargingTime = 0;
+    t.cyclesCount = t.voltage = t.remainingCapacity = t.lastFullCapacity = 0;
+    t.designCapacity = t.designVoltage = 0;
+
+    for (int i = 0; i < bats.size(); i++) {
+        const BatterySnapshot &s = bats.at(i)->getSnapshot();
+
+        t.acConnected |= s.acConnected;
+        if (!s.installed)
+            continue;
+
+        for (int j = state + 1; j < 4; j++)
+            if (s.state == states[j])
+                state = j;
+
+        if (!t.installed)
+            t.chargeLvl = s.chargeLvl;          // if there are no capacities
+        t.installed = true;
+        t.remainingCapacity += s.remainingCapacity;
+        t.lastFullCapacity += s.lastFullCapacity;
+        t.designCapacity += s.designCapacity;
+
+        /* Backends give times only, power is what they were derived from */
+        if (s.state == "discharging" && s.runningTime > 0)
+            drainPower += (long long)s.remainingCapacity * 60 / s.runningTime;
+        if (s.state == "charging" && s.chargingTime > 0 && s.lastFullCapacity > s.remainingCapacity)
+            chargePower += (long long)(s.lastFullCapacity - s.remainingCapacity) * 60 / s.chargingTime;
+    }
+
+    if (t.lastFullCapacity > 0)
+        t.chargeLvl = qMin(100, t.remainingCapacity * 100 / t.lastFullCapacity);
+
+    /*
+     * ThinkPads drain and charge packs one after another, so the whole
+     * goes at the power of the pack in use. Adding per pack times would
+     * count an idle pack as empty, or as full when charging.
+     */
+    if (drainPower > 0)
+        t.runningTime = (long long)t.remainingCapacity * 60 / drainPower;
+    if (chargePower > 0 && t.lastFullCapacity > t.remainingCapacity)
+        t.chargingTime = (long long)(t.lastFullCapacity - t.remainingCapacity) * 60 / chargePower;
+
+    t.state = states[state];
+
+    return t;
 }
 
 WirelessDevice::WirelessDevice(QString s)
@@ -599,9 +1214,9 @@ void WirelessDevice::turnOn()
 
 WirelessSwitchers::WirelessSwitchers()
 {
-    wan = new WirelessDevice(THINKPAD_WAN_PATH);
-    uwb = new WirelessDevice(THINKPAD_UWB_PATH);
-    bt = new WirelessDevice(THINKPAD_BT_PATH);
+    wan = new WirelessDevice(hwPath(THINKPAD_WAN_PATH));
+    uwb = new WirelessDevice(hwPath(THINKPAD_UWB_PATH));
+    bt = new WirelessDevice(hwPath(THINKPAD_BT_PATH));
 }
 
 MachineInfo::MachineInfo()
@@ -642,589 +1257,238 @@ QString MachineInfo::getType() { return type; }
 QString MachineInfo::getModel() { return model; }
 float MachineInfo::getBiosVersion() { return biosVer; }
 
-TrackPoint::TrackPoint()
-{
-    devID = findDeviceId("TPPS/2 IBM TrackPoint");
-
-    if (devID != -1) {
-        devPresented = true;
-
-        settings = new QSettings("thinkctl", "input");
-
-        if (isSettingsExists(settings)) {
-            settings->beginGroup("TrackPoint");
-            setEnabled(devEnabled = settings->value("device_enabled").toInt());
-            setPressToSelectEnabled(pressToSelectState = settings->value("set_press_to_select_enabled").toBool());
-            setMiddleBtnEnabled(middleBtnState = settings->value("set_middle_button_emulation_enabled").toBool());
-            setScrollingEnabled(scrollingState = settings->value("set_scrolling_enabled").toBool());
-            setSpeed(speed = settings->value("speed").toInt());
-            setSensitivity(sensitivity = settings->value("sensitivity").toInt());
-            setInertia(inertia = settings->value("inertia").toInt());
-            settings->endGroup();
-
-            applySettings();
-        } else {                                                // set initial values
-            setEnabled(devEnabled = true);
-            setPressToSelectEnabled(pressToSelectState = false);
-            setMiddleBtnEnabled(middleBtnState = false);
-            setScrollingEnabled(scrollingState = false);
-            setSpeed(speed = 170);
-            setSensitivity(sensitivity = 150);
-            setInertia(inertia = 45);
-        }
-
-    } else {
-        devPresented = false;
-        qDebug() << "Cannot find trackpoint device";
-    }
-}
-
-TrackPoint::~TrackPoint()
-{
-    settings->beginGroup("TrackPoint");
-    settings->setValue("device_enabled", devEnabled);
-    settings->setValue("set_press_to_select_enabled", pressToSelectState);
-    settings->setValue("set_middle_button_emulation_enabled", middleBtnState);
-    settings->setValue("set_scrolling_enabled", scrollingState);
-    settings->setValue("speed", speed);
-    settings->setValue("sensitivity", sensitivity);
-    settings->setValue("inertia", inertia);
-    settings->endGroup();
-
-    delete settings;
-}
-
-int TrackPoint::getSpeedValue()
+bool isSettingsExists(const QSettings *s)
 {
-    QFile f("/sys/devices/platform/i8042/serio1/serio2/speed");
-    if (!f.exists())
-        f.setFileName("/sys/devices/platform/i8042/serio1/speed");
-
-    QTextStream ts(&f);
-    f.open(QIODevice::ReadOnly);
+    QFile f(s->fileName());
 
-    return ts.readLine().toInt();
+    if (f.exists())
+        return true;
+    else
+        return false;
 }
 
-int TrackPoint::getSensitivityValue()
-{
-    QFile f("/sys/devices/platform/i8042/serio1/serio2/sensitivity");
-    if (!f.exists())
-        f.setFileName("/sys/devices/platform/i8042/serio1/sensitivity");
-
-    QTextStream ts(&f);
-    f.open(QIODevice::ReadOnly);
-
-    return ts.readLine().toInt();
-}
+/*
+ * All hardware files are looked up under this root. It is empty on real
+ * machine, THINKCTL_ROOT or --root point it to a tree made by simulator.
+ */
 
-bool TrackPoint::getState()
-{
-    return devEnabled == 1 ? true : false;
-}
+static QString hwRoot = QString::fromLocal8Bit(getenv("THINKCTL_ROOT"));
 
-bool TrackPoint::getScrollingState()
+void setHwRoot(const QString &root)
 {
-    return scrollingState;
+    hwRoot = root;
+    while (hwRoot.endsWith('/'))
+        hwRoot.chop(1);
 }
 
-bool TrackPoint::getPressToSelectState()
+QString getHwRoot()
 {
-    return pressToSelectState;
+    return hwRoot;
 }
 
-bool TrackPoint::getMiddleBtnState()
+QString hwPath(const QString &path)
 {
-    return middleBtnState == 1 ? true : false;
+    return hwRoot.isEmpty() ? path : QString(hwRoot).append(path);
 }
 
-int TrackPoint::getCurSpeed()
+QString historyDir()
 {
-    return speed;
-}
+    if (geteuid() == 0)
+        return hwPath(HISTORY_SYSTEM_DIR);
 
-int TrackPoint::getCurSensitivity()
-{
-    return sensitivity;
+    QSettings s("thinkctl", "settings");
+    return QFileInfo(s.fileName()).absolutePath() + "/history";
 }
 
-int TrackPoint::getCurInertia()
+int getIntValueFromFile(QString path)
 {
-    return inertia;
-}
+    int out = 0;
+    QFile f(path);
+    QTextStream ts(&f);
 
-void TrackPoint::setEnabled(bool st)
-{    
-    if (st)
-        devEnabled = 1;
+    if (f.open(QIODevice::ReadOnly))
+        out = ts.readLine().toInt();
     else
-        devEnabled = 0;
-
-    setXDevProp(devID, "Device Enabled", devEnabled);
-}
-
-void TrackPoint::setPressToSelectEnabled(bool st)
-{
-    QFile f("/sys/devices/platform/i8042/serio1/serio2/press_to_select");
-    if (!f.exists())
-        f.setFileName("/sys/devices/platform/i8042/serio1/press_to_select");
-
-    pressToSelectState = st;
-
-    if (f.open(QIODevice::WriteOnly)) {
-        if (st)
-            f.write("1");
-        else
-            f.write("0");
-    } else {
-        qDebug() << "Cannot open trackpoint press_to_select file for writing";
-    }
+        qDebug() << "Cannot open" << path;
 
     f.close();
-}
 
-void TrackPoint::setScrollingEnabled(bool st)
-{
-    if (st) {
-        setXDevProp(devID, "Evdev Wheel Emulation", 1);
-        setXDevProp(devID, "Evdev Wheel Emulation Button", 2);
-        setXDevProp(devID, "Evdev Wheel Emulation Axes", 6, 7, 4, 5);
-        scrollingState = true;
-    } else {
-        setXDevProp(devID, "Evdev Wheel Emulation", 0);
-        scrollingState = false;
-    }
-}
-
-void TrackPoint::setMiddleBtnEnabled(bool st)
-{
-    if (st) {
-        setXDevProp(devID, "Evdev Middle Button Emulation", 1);
-        middleBtnState = true;
-    } else {
-        setXDevProp(devID, "Evdev Middle Button Emulation", 0);
-        middleBtnState = false;
-    }
+    return out;
 }
 
-void TrackPoint::setSpeed(int n)
+void setIntValueToFile(QString path, int val)
 {
-    QFile f("/sys/devices/platform/i8042/serio1/serio2/speed");
-    if (!f.exists())
-        f.setFileName("/sys/devices/platform/i8042/serio1/speed");
-
+    QFile f(path);
     QTextStream ts(&f);
 
-    speed = n;
-
     if (f.open(QIODevice::WriteOnly))
-        ts << n;
+        ts << val;
     else
-        qDebug() << "Cannot open trackpoint speed file for writing";
+        qDebug() << "Cannot write to" << path;
 
     f.close();
 }
 
-void TrackPoint::setSensitivity(int n)
+QString getStringValueFromFile(QString path)
 {
-    QFile f("/sys/devices/platform/i8042/serio1/serio2/sensitivity");
-    if (!f.exists())
-        f.setFileName("/sys/devices/platform/i8042/serio1/sensitivity");
-
+    QString out;
+    QFile f(path);
     QTextStream ts(&f);
 
-    sensitivity = n;
-
-    if (f.open(QIODevice::WriteOnly))
-        ts << n;
-    else
-        qDebug() << "Cannot open trackpoint sensitivity file for writing";
-
-    f.close();
-}
-
-void TrackPoint::setInertia(int n)
-{
-    setXDevProp32(devID, "Evdev Wheel Emulation Inertia", 16, n);
-    inertia = n;
-}
-
-void TrackPoint::applySettings()
-{
-    setEnabled(devEnabled);
-    setScrollingEnabled(scrollingState);
-}
-
-TouchPad::TouchPad()
-{
-    devID = findDeviceId("SynPS/2 Synaptics TouchPad");
-
-    if (devID != -1) {
-        devPresented = true;
-
-        settings = new QSettings("thinkctl", "input");
-
-        if (isSettingsExists(settings)) {
-            settings->beginGroup("TouchPad");
-            setEnabled(devEnabled = settings->value("device_enabled").toInt());
-            setTwoFingerVertScrolling(twoFingerVertScrolling = settings->value("two_finger_vertical_scrolling_enabled").toBool());
-            setEdgeVertScrolling(edgeVertScrolling = settings->value("edge_vertical_scrolling_enabled").toBool());
-            setVertScrollingSpeed(vertScrollingSpeed = settings->value("vertical_scrolling_speed").toInt());
-            setTwoFingerHorizScrolling(twoFingerHorizScrolling = settings->value("two_finger_horizontal_scrolling_enabled").toBool());
-            setEdgeHorizScrolling(edgeHorizScrolling = settings->value("edge_horizontal_scrolling_enabled").toBool());
-            setHorizScrollingSpeed(horizScrollingSpeed = settings->value("horizontal_scrolling_speed").toInt());
-            setEdgeCoasting(edgeCoasting = settings->value("edge_coasting_enabled").toBool());
-            setCoastingAccel(coastingAccel = settings->value("coasting_acceleration").toInt());
-            setCoastingDecel(coastingDecel = settings->value("coasting_deceleration").toInt());
-            settings->endGroup();
-        } else {
-            setEnabled(devEnabled = true);
-            setTwoFingerVertScrolling(twoFingerVertScrolling = false);
-            setTwoFingerHorizScrolling(twoFingerHorizScrolling = false);
-            setEdgeVertScrolling(edgeVertScrolling = false);
-            setEdgeHorizScrolling(edgeHorizScrolling = false);
-            setVertScrollingSpeed(vertScrollingSpeed = 1);
-            setHorizScrollingSpeed(horizScrollingSpeed = 1);
-            setEdgeCoasting(edgeCoasting = false);
-            setCoastingAccel(coastingAccel = 1);
-            setCoastingDecel(coastingDecel = 1);
-        }
-
-    } else {
-        devPresented = false;
-        qDebug() << "Cannot find touchpad device";
-    }
-}
-
-TouchPad::~TouchPad()
-{
-    settings->beginGroup("TouchPad");
-    settings->setValue("device_enabled", devEnabled);
-    settings->setValue("two_finger_vertical_scrolling_enabled", twoFingerVertScrolling);
-    settings->setValue("edge_vertical_scrolling_enabled", edgeVertScrolling);
-    settings->setValue("vertical_scrolling_speed", vertScrollingSpeed);
-    settings->setValue("two_finger_horizontal_scrolling_enabled", twoFingerHorizScrolling);
-    settings->setValue("edge_horizontal_scrolling_enabled", edgeHorizScrolling);
-    settings->setValue("horizontal_scrolling_speed", horizScrollingSpeed);
-    settings->setValue("edge_coasting_enabled", edgeCoasting);
-    settings->setValue("coasting_acceleration", coastingAccel);
-    settings->setValue("coasting_deceleration", coastingDecel);
-    settings->endGroup();
-
-    delete settings;
-}
-
-bool TouchPad::isPresent()
-{
-    return devPresented;
-}
-
-bool TouchPad::getState()
-{
-    return devEnabled == 1 ? true : false;
-}
-
-bool TouchPad::getTwoFingetVertScrolling()
-{
-    return twoFingerVertScrolling == 1 ? true : false;
-}
-
-bool TouchPad::getTwoFingerHorizScrolling()
-{
-    return twoFingerHorizScrolling == 1 ? true : false;
-}
-
-int TouchPad::getVertScrollingSpeed()
-{
-    return vertScrollingSpeed;
-}
-
-int TouchPad::getHorizScrollingSpeed()
-{
-    return horizScrollingSpeed;
-}
-
-bool TouchPad::getEdgeVertScrollingState()
-{
-    return edgeVertScrolling;
-}
-
-bool TouchPad::getEdgeHorizScrollingState()
-{
-    return edgeHorizScrolling;
-}
-
-bool TouchPad::getEdgeCoastingState()
-{
-    return edgeCoasting;
-}
-
-int TouchPad::getCoastingAccel()
-{
-    return (int)coastingAccel;
-}
-
-int TouchPad::getCoastingDecel()
-{
-    return (int)coastingDecel;
-}
-
-void TouchPad::setEnabled(bool st)
-{
-    if (st)
-        devEnabled = 1;
+    if (f.exists() && f.open(QIODevice::ReadOnly))
+        out = ts.readLine();
     else
-        devEnabled = 0;
+        qDebug() << "Cannot open" << path;
 
-    setXDevProp(devID, "Device Enabled", devEnabled);
+    return out;
 }
 
-void TouchPad::setTwoFingerVertScrolling(bool st)
-{
-    if (st)
-        twoFingerVertScrolling = 1;
-    else
-        twoFingerVertScrolling = 0;
-
-    setXDevProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
-}
+/* Read decimal value from the beginning of already opened sysfs file */
 
-void TouchPad::setTwoFingerHorizScrolling(bool st)
+int readIntFromFd(int fd)
 {
-    if (st)
-        twoFingerHorizScrolling = 1;
-    else
-        twoFingerHorizScrolling = 0;
+    char buf[32];
+    int len = pread(fd, buf, sizeof(buf) - 1, 0);
 
-    setXDevProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
-}
+    if (len <= 0)
+        return 0;
 
-void TouchPad::setVertScrollingSpeed(int n)
-{
-    vertScrollingSpeed = n;
-    setXDevProp32(devID, "Synaptics Scrolling Distance", 32, vertScrollingSpeed, horizScrollingSpeed);
-}
+    buf[len] = '\0';
 
-void TouchPad::setHorizScrollingSpeed(int n)
-{
-    horizScrollingSpeed = n;
-    setXDevProp32(devID, "Synaptics Scrolling Distance", 32, vertScrollingSpeed, horizScrollingSpeed);
+    return (int)strtol(buf, NULL, 10);
 }
 
-void TouchPad::setEdgeVertScrolling(bool st)
-{
-    if (st)
-        edgeVertScrolling = 1;
-    else
-        edgeVertScrolling = 0;
-
-    setXDevProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
-}
+/* Read first line of already opened sysfs file */
 
-void TouchPad::setEdgeHorizScrolling(bool st)
+QString readStringFromFd(int fd)
 {
-    if (st)
-        edgeHorizScrolling = 1;
-    else
-        edgeHorizScrolling = 0;
+    char buf[64];
+    int len = pread(fd, buf, sizeof(buf) - 1, 0);
 
-    setXDevProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
-}
+    if (len <= 0)
+        return QString();
 
-void TouchPad::setEdgeCoasting(bool st)
-{
-    if (st)
-        edgeCoasting = 1;
-    else
-        edgeCoasting = 0;
-
-    setXDevProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
-}
-
-void TouchPad::setCoastingAccel(int n)
-{
-    coastingAccel = (float)n;
-    setXdevPropFloat(devID, "Synaptics Coasting Speed", coastingDecel, coastingAccel);
-}
+    buf[len] = '\0';
+    char *nl = strchr(buf, '\n');
+    if (nl)
+        *nl = '\0';
 
-void TouchPad::setCoastingDecel(int n)
-{
-    coastingDecel = (float)n;
-    setXdevPropFloat(devID, "Synaptics Coasting Speed", coastingDecel, coastingAccel);
+    return QString(buf);
 }
 
-void TouchPad::applySettings()
-{
-    setXDevProp(devID, "Device Enabled", devEnabled);
-    setXDevProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
-    setXDevProp(devID, "Synaptics Scrolling Distance", vertScrollingSpeed, horizScrollingSpeed);
-}
+/*
+ * Parse "temperatures:\t52 40 -128 ..." line of thinkpad thermal file.
+ * Values are stored from the first slot, slots which are absent in the
+ * line stay untouched. Returns number of parsed values.
+ */
 
-long int findDeviceId(char *devname)
+int parseThermValues(const char *buf, int len, int16_t *vals, int n)
 {
-    Display *dp;
-    XID dev;
-    XDeviceInfo *devs;
-    int n_dev;
+    const char *p = buf;
+    const char *end = buf + len;
+    int cnt = 0;
 
-    dp = XOpenDisplay(NULL);
-    devs = XListInputDevices(dp, &n_dev);               // get pointer to Input Devices structures
+    while (p < end && *p != ':')                // skip "temperatures:" prefix
+        p++;
+    if (p < end)
+        p++;
 
-    for (int i = 0; i < n_dev; i++) {                   // find device id by name
-        if (strcmp(devs[i].name, devname) == 0) {
-            dev = devs[i].id;
-            XCloseDisplay(dp);
-            return (long int)dev;                       // change XID unsigned long to long int bc of
-        }                                               // return value and bug in include order
-    }
+    while (p < end && cnt < n) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
 
-    XCloseDisplay(dp);
-    return -1;                                          // device not found
-}
-
-void setXDevProp(unsigned long dev, char *propty, int val, int val2, int val3, int val4)
-{
-    Display *dp;
-    XDevice *xdev;
-    Atom prop;
-    unsigned char data[4];
-//    data[0] = (unsigned char)val;
-    int numOfVal;
-
-    if (val4 != -1) {
-        data[0] = (unsigned char)val;
-        data[1] = (unsigned char)val2;
-        data[2] = (unsigned char)val3;
-        data[3] = (unsigned char)val4;
-        numOfVal = 4;
-    } else if (val3 != -1) {
-        data[0] = (unsigned char)val;
-        data[1] = (unsigned char)val2;
-        data[2] = (unsigned char)val3;
-        numOfVal = 3;
-    } else if (val2 != -1) {
-        data[0] = (unsigned char)val;
-        data[1] = (unsigned char)val2;
-        numOfVal = 2;
-    } else {
-        data[0] = (unsigned char)val;
-        numOfVal = 1;
-    }
+        if (p == end || *p == '\n')
+            break;
 
-    dp = XOpenDisplay(NULL);
-    xdev = XOpenDevice(dp, dev);
-    prop = XInternAtom(dp, propty, false);
+        bool neg = false;
+        int v = 0;
 
-    XChangeDeviceProperty(dp, xdev, prop, XA_INTEGER, 8, PropModeReplace, data, numOfVal);
-    XCloseDevice(dp, xdev);
-    XCloseDisplay(dp);
-}
+        if (*p == '-') {
+            neg = true;
+            p++;
+        }
 
-void setXDevProp32(unsigned long dev, char *propty, int fmt, int val, int val2)
-{
-    Display *dp;
-    XDevice *xdev;
-    Atom prop;
+        while (p < end && *p >= '0' && *p <= '9')
+            v = v*10 + (*p++ - '0');
 
-    int data[2];
-    int numOfVal;
+        vals[cnt++] = (int16_t)(neg ? -v : v);
 
-    if (val2 != -1) {
-        data[1] = val2;
-        data[0] = val;
-        numOfVal = 2;
-    } else {
-        data[0] = val;
-        numOfVal = 1;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n')   // skip garbage
+            p++;
     }
 
-    dp = XOpenDisplay(NULL);
-    xdev = XOpenDevice(dp, dev);
-    prop = XInternAtom(dp, propty, false);
-
-    XChangeDeviceProperty(dp, xdev, prop, XA_INTEGER, fmt, PropModeReplace, (unsigned char*)data, numOfVal);
-    XCloseDevice(dp, xdev);
-    XCloseDisplay(dp);
+    return cnt;
 }
 
-void setXdevPropFloat(unsigned long dev, char *propty, float val, float val2)
-{
-    Display *dp;
-    XDevice *xdev;
-    Atom prop;
-    Atom tpe;
-
-    float data[2];
-    int numOfVal;
+/*
+ * Fan file starts with "status:", "speed:" and "level:" lines. Parsed in
+ * place like thermal values, fields which aren't found are left alone.
+ */
+
+void parseFanStatus(const char *buf, int len, int *speed, int *level)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+
+    while (p < end) {
+        const char *line = p;
+        const char *v;
+
+        while (p < end && *p != '\n')
+            p++;
+        for (v = line; v < p && *v != ':'; v++)
+            ;
+        if (v < p)
+            v++;
+        while (v < p && (*v == ' ' || *v == '\t'))
+            v++;
+
+        int n = p - v;
+        bool named = p - line >= 6;             // long enough for "speed:" or "level:"
+
+        if (named && strncmp(line, "speed:", 6) == 0) {
+            int sp = 0;
+            while (v < p && *v >= '0' && *v <= '9')
+                sp = sp*10 + (*v++ - '0');
+            *speed = sp;
+        } else if (named && strncmp(line, "level:", 6) == 0) {
+            if (n > 0 && *v >= '0' && *v <= '9')
+                *level = *v - '0';
+            else if (n >= 4 && strncmp(v, "auto", 4) == 0)
+                *level = FAN_LEVEL_AUTO;
+            else if (n >= 10 && (strncmp(v, "full-speed", 10) == 0 || strncmp(v, "disengaged", 10) == 0))
+                *level = FAN_LEVEL_FULL;
+            else
+                *level = FAN_LEVEL_UNKNOWN;
+        }
 
-    if (val2 != -1){
-        data[1] = val2;
-        data[0] = val;
-        numOfVal = 2;
-    } else {
-        data[0] = val;
-        numOfVal = 1;
+        p++;
     }
-
-    dp = XOpenDisplay(NULL);
-    xdev = XOpenDevice(dp, dev);
-    prop = XInternAtom(dp, propty, false);
-    tpe = XInternAtom(dp, "FLOAT", false);
-
-    XChangeDeviceProperty(dp, xdev, prop, tpe, 32, PropModeReplace, (unsigned char*)data, numOfVal);
-    XCloseDevice(dp, xdev);
-    XCloseDisplay(dp);
-}
-
-bool isSettingsExists(const QSettings *s)
-{
-    QFile f(s->fileName());
-
-    if (f.exists())
-        return true;
-    else
-        return false;
-}
-
-int getIntValueFromFile(QString path)
-{
-    int out;
-    QFile f(path);
-    QTextStream ts(&f);
-
-    if (f.open(QIODevice::ReadOnly))
-        out = ts.readLine().toInt();
-    else
-        qDebug() << "Cannot open" << path;
-
-    f.close();
-
-    return out;
 }
 
-void setIntValueToFile(QString path, int val)
+int fanLevelToInt(QString l)
 {
-    QFile f(path);
-    QTextStream ts(&f);
+    bool ok;
+    int n = l.toInt(&ok);
 
-    if (f.open(QIODevice::WriteOnly))
-        ts << val;
+    if (ok)
+        return n;
+    else if (l == "auto")
+        return FAN_LEVEL_AUTO;
+    else if (l == "full-speed" || l == "disengaged")
+        return FAN_LEVEL_FULL;
     else
-        qDebug() << "Cannot write to" << path;
-
-    f.close();
+        return FAN_LEVEL_UNKNOWN;
 }
 
-QString getStringValueFromFile(QString path)
+QString fanLevelToString(int l)
 {
-    QString out;
-    QFile f(path);
-    QTextStream ts(&f);
-
-    if (f.exists() && f.open(QIODevice::ReadOnly))
-        out = ts.readLine();
+    if (l >= 0)
+        return QString::number(l);
+    else if (l == FAN_LEVEL_AUTO)
+        return "auto";
+    else if (l == FAN_LEVEL_FULL)
+        return "full-speed";
     else
-        qDebug() << "Cannot open" << path;
-
-    return out;
+        return "unknown";
 }
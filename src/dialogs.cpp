@@ -24,6 +24,8 @@
 #include "ui_trackpoint.h"
 #include "ui_touchpad.h"
 
+#include <QMessageBox>
+
 FanPresetDialog::FanPresetDialog(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::FanPresetDialog)
@@ -39,8 +41,31 @@ FanPresetDialog::~FanPresetDialog()
     delete ui;
 }
 
+/*
+ * Values are checked as curves would be built from them. Rejected ones
+ * aren't put into profile, dialog stays open to correct them.
+ */
+
 void FanPresetDialog::setValues()
 {
+    const char *sensors[] = { "CPU", "GPU", "MCH" };
+    QSpinBox *boxes[][3] = {
+        { ui->cpuMinSpinBox, ui->cpuMidSpinBox, ui->cpuMaxSpinBox },
+        { ui->gpuMinSpinBox, ui->gpuMidSpinBox, ui->gpuMaxSpinBox },
+        { ui->mchMinSpinBox, ui->mchMidSpinBox, ui->mchMaxSpinBox }
+    };
+
+    for (int i = 0; i < 3; i++) {
+        FanCurve c;
+        QString err;
+
+        if (!c.setTriplet(boxes[i][0]->value(), boxes[i][1]->value(), boxes[i][2]->value(),
+                          ui->tresholdSpinBox->value(), &err)) {
+            QMessageBox::warning(this, "Fan preset", QString("%1 thresholds are wrong: %2").arg(sensors[i]).arg(err));
+            return;
+        }
+    }
+
     pf->setCpuMin(ui->cpuMinSpinBox->value());
     pf->setCpuMid(ui->cpuMidSpinBox->value());
     pf->setCpuMax(ui->cpuMaxSpinBox->value());
@@ -55,6 +80,10 @@ void FanPresetDialog::setValues()
 
     pf->setTreshold(ui->tresholdSpinBox->value());
 
+    pf->setPidControl(ui->pidCheckBox->isChecked());
+    pf->setTargetTemp(ui->targetSpinBox->value());
+
+    emit profileEdited();
     this->close();
 }
 
@@ -76,6 +105,9 @@ void FanPresetDialog::showDialog(Profile *p)
 
     ui->tresholdSpinBox->setValue(p->getTreshold());
 
+    ui->pidCheckBox->setChecked(p->isPidControl());
+    ui->targetSpinBox->setValue(p->getTargetTemp());
+
     this->show();
 }
 
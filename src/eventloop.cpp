@@ -0,0 +1,163 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "h/eventloop.h"
+
+#include <QDebug>
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+EventLoop::EventLoop()
+{
+    notifier = NULL;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        qDebug() << "Cannot create epoll descriptor";
+        return;
+    }
+
+    notifier = new QSocketNotifier(epollFd, QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(dispatch()));
+}
+
+EventLoop::~EventLoop()
+{
+    QList<EventSource*> lst = sources.values();
+
+    for (int i = 0; i < lst.size(); i++) {
+        if (lst.at(i)->timer)
+            close(lst.at(i)->fd);
+        delete lst.at(i);
+    }
+
+    delete notifier;
+
+    if (epollFd != -1)
+        close(epollFd);
+}
+
+bool EventLoop::addSource(int fd, uint32_t events, EventHandler *h, bool timer)
+{
+    struct epoll_event ev;
+    EventSource *src = new EventSource;
+
+    src->fd = fd;
+    src->timer = timer;
+    src->handler = h;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = src;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        delete src;
+        return false;
+    }
+
+    sources.insert(fd, src);
+
+    return true;
+}
+
+bool EventLoop::addFd(int fd, uint32_t events, EventHandler *h)
+{
+    if (epollFd == -1)
+        return false;
+
+    return addSource(fd, events, h, false);
+}
+
+/* Handler may remove descriptors from inside dispatch, so free them later */
+
+void EventLoop::removeFd(int fd)
+{
+    struct epoll_event ev;
+    EventSource *src = sources.take(fd);
+
+    if (src == NULL)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &ev);
+
+    src->handler = NULL;
+    removed.append(src);
+}
+
+int EventLoop::addTimer(EventHandler *h)
+{
+    if (epollFd == -1)
+        return -1;
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd == -1)
+        return -1;
+
+    if (!addSource(tfd, EPOLLIN, h, true)) {
+        close(tfd);
+        return -1;
+    }
+
+    return tfd;
+}
+
+void EventLoop::setTimer(int tfd, int ms, bool repeat)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+
+    if (repeat)
+        its.it_interval = its.it_value;
+
+    timerfd_settime(tfd, 0, &its, NULL);
+}
+
+void EventLoop::removeTimer(int tfd)
+{
+    removeFd(tfd);
+    close(tfd);
+}
+
+void EventLoop::dispatch()
+{
+    struct epoll_event ev[EVENTLOOP_MAX_EVENTS];
+    int n = epoll_wait(epollFd, ev, EVENTLOOP_MAX_EVENTS, 0);
+
+    for (int i = 0; i < n; i++) {
+        EventSource *src = (EventSource *)ev[i].data.ptr;
+
+        if (src->handler == NULL)
+            continue;
+
+        if (src->timer) {
+            uint64_t expirations;
+            if (read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue;
+        }
+
+        src->handler->handleEvent(src->fd, ev[i].events);
+    }
+
+    while (!removed.isEmpty())
+        delete removed.takeFirst();
+}
@@ -0,0 +1,199 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/fancurve.h"
+#include "h/devices.h"
+
+#include <QStringList>
+
+FanCurve::FanCurve()
+{
+    hysteresis = 0;
+    setTriplet(50, 60, 70, 3);
+}
+
+/*
+ * Points must have rising temperatures inside the table and not falling
+ * levels 0..FAN_CURVE_MAX_LEVEL. Temperatures where level changes must be
+ * more than hysteresis apart, otherwise level could never go down by one
+ * step.
+ */
+
+bool FanCurve::validate(const QVector<FanPoint> &p, int hyst, QString *err)
+{
+    QString e;
+    int lastStep = -FAN_CURVE_TEMPS;
+
+    if (p.isEmpty() || p.size() > FAN_CURVE_MAX_POINTS)
+        e = QString("curve must have 1 to %1 points").arg(FAN_CURVE_MAX_POINTS);
+    else if (hyst < 0 || hyst > FAN_CURVE_MAX_HYSTERESIS)
+        e = QString("hysteresis must be 0 to %1 degrees").arg(FAN_CURVE_MAX_HYSTERESIS);
+
+    for (int i = 0; i < p.size() && e.isEmpty(); i++) {
+        if (p.at(i).temp < 0 || p.at(i).temp >= FAN_CURVE_TEMPS)
+            e = QString("temperature %1 is out of range").arg(p.at(i).temp);
+        else if (p.at(i).level < 0 || p.at(i).level > FAN_CURVE_MAX_LEVEL)
+            e = QString("level %1 is out of range").arg(p.at(i).level);
+        else if (i > 0 && p.at(i).temp <= p.at(i-1).temp)
+            e = QString("temperatures are not rising at %1").arg(p.at(i).temp);
+        else if (i > 0 && p.at(i).level < p.at(i-1).level)
+            e = QString("level goes down at %1").arg(p.at(i).temp);
+        else if (i > 0 && p.at(i).level != p.at(i-1).level) {
+            if (p.at(i).temp - lastStep <= hyst)
+                e = QString("level steps at %1 and %2 are closer than hysteresis").arg(lastStep).arg(p.at(i).temp);
+            lastStep = p.at(i).temp;
+        }
+    }
+
+    if (err)
+        *err = e;
+
+    return e.isEmpty();
+}
+
+bool FanCurve::setPoints(const QVector<FanPoint> &p, int hyst, QString *err)
+{
+    if (!validate(p, hyst, err))
+        return false;
+
+    points = p;
+    hysteresis = hyst;
+    buildTable();
+
+    return true;
+}
+
+/* Old min/mid/max profile: levels 0, 1, 5 and 7 with hard steps */
+
+bool FanCurve::setTriplet(int min, int mid, int max, int hyst, QString *err)
+{
+    QVector<FanPoint> p;
+    int t[6] = {min - 1, min, mid - 1, mid, max - 1, max};
+    int l[6] = {0, 1, 1, 5, 5, 7};
+
+    for (int i = 0; i < 6; i++) {
+        FanPoint fp = {t[i], l[i]};
+        p.append(fp);
+    }
+
+    return setPoints(p, hyst, err);
+}
+
+bool FanCurve::fromString(const QString &s, int hyst, QString *err)
+{
+    QStringList l = s.split(' ', QString::SkipEmptyParts);
+    QVector<FanPoint> p;
+
+    for (int i = 0; i < l.size(); i++) {
+        FanPoint fp;
+        bool ok1, ok2;
+
+        fp.temp = l.at(i).section(':', 0, 0).toInt(&ok1);
+        fp.level = l.at(i).section(':', 1, 1).toInt(&ok2);
+        if (!ok1 || !ok2) {
+            if (err)
+                *err = QString("wrong point \"%1\"").arg(l.at(i));
+            return false;
+        }
+
+        p.append(fp);
+    }
+
+    return setPoints(p, hyst, err);
+}
+
+QString FanCurve::toString()
+{
+    QString s;
+
+    for (int i = 0; i < points.size(); i++) {
+        if (i)
+            s.append(' ');
+        s.append(QString::number(points.at(i).temp)).append(':').append(QString::number(points.at(i).level));
+    }
+
+    return s;
+}
+
+QVector<FanPoint> FanCurve::getPoints()
+{
+    return points;
+}
+
+int FanCurve::getHysteresis()
+{
+    return hysteresis;
+}
+
+void FanCurve::setHysteresis(int hyst)
+{
+    QString err;
+
+    if (validate(points, hyst, &err))
+        hysteresis = hyst;
+    else
+        qDebug() << "Hysteresis" << hyst << "rejected:" << err;
+}
+
+void FanCurve::buildTable()
+{
+    int j = 0;
+
+    for (int t = 0; t < FAN_CURVE_TEMPS; t++) {
+        while (j < points.size() - 1 && points.at(j+1).temp <= t)
+            j++;
+
+        const FanPoint &a = points.at(j);
+
+        if (t <= a.temp || j == points.size() - 1) {
+            table[t] = a.level;
+        } else {
+            const FanPoint &b = points.at(j+1);
+            table[t] = a.level + (b.level - a.level) * (t - a.temp) / (b.temp - a.temp);
+        }
+    }
+}
+
+int FanCurve::level(int temp, int curLevel)
+{
+    if (temp == SENSOR_NONE)
+        return 0;
+
+    int t = qBound(0, temp, FAN_CURVE_TEMPS - 1);
+    int up = table[t];
+
+    if (up >= curLevel)
+        return up;
+
+    int down = table[qMin(t + hysteresis, FAN_CURVE_TEMPS - 1)];    // still above step - hysteresis?
+
+    return down < curLevel ? down : curLevel;
+}
+
+bool FanCurve::isNear(int temp, int degrees)
+{
+    if (temp == SENSOR_NONE)
+        return false;
+
+    for (int i = 1; i < points.size(); i++)
+        if (points.at(i).level != points.at(i-1).level && qAbs(temp - points.at(i).temp) <= degrees)
+            return true;
+
+    return false;
+}
@@ -0,0 +1,246 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/fangovernor.h"
+
+Governor::Governor(SensorsArray *sa, SampleBus *bus, Profile *p)
+{
+    snsArray = sa;
+    profile = *p;
+
+    samples = new SampleSubscriber(bus, 0, this);
+    connect(samples, SIGNAL(sampleReady()), this, SLOT(refresh()));
+
+    daemon = NULL;
+    mode = false;
+    modelTime = -1;
+    setWatchdog(FAN_WATCHDOG_TIMEOUT);
+    resetCurves();
+    resetPid();
+}
+
+/*
+ * Governor works on its own copy of the profile, the copy is made in the
+ * caller's thread when this slot is invoked through queued connection.
+ */
+
+void Governor::profileChanged(const Profile &p)
+{
+    profile = p;
+    resetCurves();
+    resetPid();
+
+    if (daemon)
+        daemon->sendProfile(&profile);
+}
+
+/*
+ * When thinkctld is running it owns the fan. Governor then only forwards
+ * mode, level and profile changes to it and never writes the fan itself.
+ */
+
+void Governor::attachDaemon(DaemonClient *d)
+{
+    daemon = d;
+    mode = false;
+
+    daemon->sendProfile(&profile);
+}
+
+void Governor::setMode(bool st)
+{
+    if (daemon)
+        daemon->sendMode(st);
+    else
+        mode = st;
+
+    forgetLevel();                  // fan may have been changed in manual mode
+    resetCurves();
+    resetPid();
+}
+
+void Governor::setLevel(int l)
+{
+    if (daemon)
+        daemon->sendLevel(QString::number(l));
+    else
+        Fan::setLevel(l);
+}
+
+void Governor::setLevelAuto()
+{
+    if (daemon)
+        daemon->sendLevel("auto");
+    else
+        Fan::setLevelAuto();
+}
+
+void Governor::setFullSpeed()
+{
+    if (daemon)
+        daemon->sendLevel("full-speed");
+    else
+        Fan::setFullSpeed();
+}
+
+void Governor::fanOff(bool s)
+{
+    if (s == true) {
+        prevLevel = getLevel().toInt();     // fix-it: avoid situations when getLevel return text
+        this->setFanOff();
+    } else
+        this->setLevel(prevLevel);
+}
+
+void Governor::fanFullSpeed(bool s)
+{
+    if (s == true) {
+        prevLevel = getLevel().toInt();
+        this->setFullSpeed();
+    } else
+        this->setLevel(prevLevel);
+}
+
+/*
+ * Watchdog is kept up in manual mode too, there fan can be stopped by
+ * the user. With thinkctld attached it's daemon's job.
+ */
+
+void Governor::refresh()
+{
+    Sample s;
+
+    if (daemon == NULL)
+        kickWatchdog();
+
+    if (mode == false || !samples->latest(&s))
+        return;
+
+    if (profile.isPidControl())
+        this->adjustFanPid(s);
+    else {
+        this->updateModels(s);
+        this->adjustFanSpeed(s);
+    }
+}
+
+void Governor::resetCurves()
+{
+    cpuLvl = gpuLvl = mchLvl = 0;
+}
+
+/*
+ * Models describe the machine, not the profile, so they survive profile
+ * changes. After a pause in preset mode dt is long and they restart.
+ * Only cpu has load input, other zones see its heat through fan rpm.
+ */
+
+void Governor::updateModels(const Sample &s)
+{
+    double dt = modelTime == -1 ? 0 : (s.timestamp - modelTime) / 1000.0;
+
+    modelTime = s.timestamp;
+
+    cpuModel.update(s.cpu.max, s.fanSpeed, s.cpuLoad, dt);
+    gpuModel.update(snsArray->gpu->getTemp(s.thermal), s.fanSpeed, 0, dt);
+    mchModel.update(snsArray->mch->getTemp(s.thermal), s.fanSpeed, 0, dt);
+}
+
+void Governor::resetPid()
+{
+    pidIntegral = 0;
+    pidDeriv = 0;
+    pidPrevTemp = SENSOR_NONE;
+    pidLevel = -1;
+    pidTime = -1;
+}
+
+/*
+ * err > 0 means cpu is hotter than target. Derivative is taken from the
+ * measurement, so target change doesn't kick the fan. Integral is frozen
+ * while output is saturated in the direction of error (anti-windup).
+ * Level is written only when output leaves current level by more than
+ * half a level plus hysteresis.
+ */
+
+void Governor::adjustFanPid(const Sample &s)
+{
+    int temp = s.cpu.max;
+    double dt = pidTime == -1 ? 0 : (s.timestamp - pidTime) / 1000.0;
+
+    if (temp == SENSOR_NONE)
+        return;
+
+    pidTime = s.timestamp;
+
+    if (dt > PID_MAX_DT) {
+        pidIntegral = 0;
+        dt = 0;
+    }
+
+    double err = temp - profile.getTargetTemp();
+
+    if (dt > 0 && pidPrevTemp != SENSOR_NONE)
+        pidDeriv += PID_D_FILTER * ((temp - pidPrevTemp) / dt - pidDeriv);
+    pidPrevTemp = temp;
+
+    double ff = PID_KFF * s.cpuLoad;
+    double u = PID_KP * err + pidIntegral + PID_KD * pidDeriv + ff;
+
+    if (!(u >= PID_MAX_LEVEL && err > 0) && !(u <= 0 && err < 0))
+        pidIntegral = qBound(-(double)PID_MAX_LEVEL, pidIntegral + PID_KI * err * dt, (double)PID_MAX_LEVEL);
+
+    u = qBound(0.0, u, (double)PID_MAX_LEVEL);
+
+    int level = pidLevel;
+    if (pidLevel == -1 || qAbs(u - pidLevel) > 0.5 + PID_LEVEL_HYSTERESIS)
+        level = qRound(u);
+
+    if (requestLevel(level))                // PID_MAX_LEVEL is "level disengaged"
+        pidLevel = level;
+}
+
+/*
+ * Every sensor picks a level from its profile curve, hysteresis is kept
+ * per sensor by passing its previous level. Curve is looked up at the
+ * higher of measured and predicted temperature, so fan spins up before
+ * a load spike crosses the threshold, but is never slowed by prediction.
+ * Fan follows the hottest sensor, Fan drops repeated levels.
+ */
+
+static int aheadTemp(int temp, ThermalZoneModel *m)
+{
+    if (temp == SENSOR_NONE)
+        return temp;
+
+    return qMax(temp, m->predict(THERMAL_HORIZON));
+}
+
+void Governor::adjustFanSpeed(const Sample &s)
+{
+    int cpuTemp = aheadTemp(s.cpu.max, &cpuModel);
+    int gpuTemp = aheadTemp(snsArray->gpu->getTemp(s.thermal), &gpuModel);
+    int mchTemp = aheadTemp(snsArray->mch->getTemp(s.thermal), &mchModel);
+
+    cpuLvl = profile.getCpuCurve()->level(cpuTemp, cpuLvl);
+    gpuLvl = profile.getGpuCurve()->level(gpuTemp, gpuLvl);
+    mchLvl = profile.getMchCurve()->level(mchTemp, mchLvl);
+
+    requestLevel(qMax(cpuLvl, qMax(gpuLvl, mchLvl)));
+}
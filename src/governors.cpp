@@ -19,157 +19,106 @@
 
 #include "h/governors.h"
 
-Governor::Governor(SensorsArray *sa, Profile *p)
+#include <poll.h>
+#include <sys/epoll.h>
+
+NotifyQueue::NotifyQueue(QObject *parent) : QObject(parent)
 {
-    snsArray = sa;
-    plPtr = p;
+    inFlight = NULL;
+    dropped = 0;
 
-    mode = false;
-    cpuTdTmp = 0;
-    gpuTdTmp = 0;
-    mchTdTmp = 0;
+    if (!QDBusConnection::sessionBus().isConnected())
+        qDebug() << "Cannot connect to dbus session";
 }
 
-void Governor::profileChanged(Profile *p)
+NotifyQueue::~NotifyQueue()
 {
-    plPtr = p;
+    delete inFlight;                    // reply, if any, is ignored
 }
 
-void Governor::setMode(bool st)
-{
-    mode = st;
-}
+unsigned long NotifyQueue::getDropped() { return dropped; }
 
-void Governor::fanOff(bool s)
+void NotifyQueue::post(const QString &body, uint replacesId)
 {
-    if (s == true) {
-        prevLevel = getLevel().toInt();     // fix-it: avoid situations when getLevel return text
-        this->setFanOff();
-    } else
-        this->setLevel(prevLevel);
-}
+    if (inFlight && current.body == body) {
+        dropped++;
+        return;
+    }
 
-void Governor::fanFullSpeed(bool s)
-{
-    if (s == true) {
-        prevLevel = getLevel().toInt();
-        this->setFullSpeed();
-    } else
-        this->setLevel(prevLevel);
+    for (int i = 0; i < backlog.size(); i++) {
+        NotifyMsg &m = backlog[i];
+
+        if (m.body == body || (replacesId && m.replacesId == replacesId)) {
+            m.body = body;
+            dropped++;
+            return;
+        }
+    }
+
+    if (backlog.size() == NOTIFY_MAX_BACKLOG) {
+        backlog.removeFirst();
+        dropped++;
+    }
+
+    NotifyMsg m;
+    m.body = body;
+    m.replacesId = replacesId;
+    backlog.append(m);
+
+    if (!inFlight)
+        dispatch();
 }
 
-void Governor::refresh()
+void NotifyQueue::dispatch()
 {
-    if (mode == true)
-        this->adjustFanSpeed();
-}
+    if (backlog.isEmpty())
+        return;
 
-/*
- * If temperature is bigger than cpuMin(mid,max) then next if statement will be executed.
- * In this next statement treshold may or may not be set.
- * Algorithm: if temperature equal to cpuMin then treshold must be set, if temp get
- * lower to cpuMin-treshold (ex. 60-3 = 57) then treshold is set to zero and temp in
- * range 57-59 will not trigger cpuMid level execution.
- *
- * min = 75     mid = 80    max = 85
- * lvl - setLevel
- * td - treshold value. In this example is 3.
- *
- *              td=3     75        td=3(lvl(0))  80       td=3(lvl(1))  85      td=3(lvl(5))
- * --------------|-------|---------------|-------|--------------|-------|------------------
- *         lvl(0)                  lvl(1)                 lvl(5)                 lvl(7)
- */
+    current = backlog.takeFirst();
 
-void Governor::adjustFanSpeed()
+    QDBusMessage msg = QDBusMessage::createMethodCall("org.freedesktop.Notifications",
+                                                      "/org/freedesktop/Notifications",
+                                                      "org.freedesktop.Notifications", "Notify");
+    QList<QVariant> args;
+
+    args.append(QString("ThinkControl"));   // app_name
+    args.append(current.replacesId);        // replaces_id
+    args.append("");                        // app_icon
+    args.append("");                        // summary
+    args.append(current.body);              // body
+    args.append(QStringList());             // actions
+    args.append(QVariantMap());             // hints
+    args.append(int(10000));                // timeout
+    msg.setArguments(args);
+
+    inFlight = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(msg, NOTIFY_TIMEOUT_MS), this);
+    connect(inFlight, SIGNAL(finished(QDBusPendingCallWatcher*)), this, SLOT(callFinished(QDBusPendingCallWatcher*)));
+}
+
+void NotifyQueue::callFinished(QDBusPendingCallWatcher *w)
 {
-    int cpuTmp = snsArray->cpu->getTemp();
-    int gpuTmp = snsArray->gpu->getTemp().toInt();
-    int mchTmp = snsArray->mch->getTemp().toInt();
+    if (w->isError())
+        qDebug() << "Notification wasn't shown:" << w->error().message();
 
-    if (cpuTmp < plPtr->getCpuMin() - cpuTdTmp && gpuTmp < plPtr->getGpuMin() - gpuTdTmp &&
-            mchTmp < plPtr->getMchMin() - mchTdTmp) {                                               // Temp < Min
-//        if (!previousLevel == 0)
-            this->setLevel(0);
-    }
-    else if (cpuTmp < plPtr->getCpuMid() - cpuTdTmp && gpuTmp < plPtr->getGpuMid() - gpuTdTmp &&
-             mchTmp < plPtr->getMchMid() - mchTdTmp) {                                              // Min < Temp < Mid
-//        if (!previousLevel == 1)
-            this->setLevel(1);
-
-        if (cpuTmp == plPtr->getCpuMin())
-            cpuTdTmp = plPtr->getTreshold();
-        else if (cpuTmp <= plPtr->getCpuMin() - plPtr->getTreshold())
-            cpuTdTmp = 0;
-
-        if (gpuTmp == plPtr->getGpuMin())
-            gpuTdTmp = plPtr->getTreshold();
-        else if (gpuTmp <= plPtr->getGpuMin() - plPtr->getTreshold())
-            gpuTdTmp = 0;
-
-        if (mchTmp == plPtr->getMchMin())
-            mchTdTmp = plPtr->getTreshold();
-        else if (mchTmp <= plPtr->getMchMin() - plPtr->getTreshold())
-            mchTdTmp = 0;
-    }
-    else if (cpuTmp < plPtr->getCpuMax() - cpuTdTmp && gpuTmp < plPtr->getGpuMax() - gpuTdTmp &&
-             mchTmp < plPtr->getMchMax() - mchTdTmp) {                                              // Mid < Temp < Max
-//        if (!previousLevel == 5)
-            this->setLevel(5);
-
-        if (cpuTmp == plPtr->getCpuMid())
-            cpuTdTmp = plPtr->getTreshold();
-        else if (cpuTmp <= plPtr->getCpuMid() - plPtr->getTreshold())
-            cpuTdTmp = 0;
-
-        if (gpuTmp == plPtr->getGpuMid())
-            gpuTdTmp = plPtr->getTreshold();
-        else if (gpuTmp <= plPtr->getGpuMid() - plPtr->getTreshold())
-            gpuTdTmp = 0;
-
-        if (mchTmp == plPtr->getMchMid())
-            mchTdTmp = plPtr->getTreshold();
-        else if (mchTmp <= plPtr->getMchMid() - plPtr->getTreshold())
-            mchTdTmp = 0;
-    }
-    else {                                                                              // Temp > Max
-//        if (!previousLevel == 7)
-            this->setLevel(7);
-
-        if (cpuTmp == plPtr->getCpuMax())
-            cpuTdTmp = plPtr->getTreshold();
-        else if (cpuTmp <= plPtr->getCpuMax() - plPtr->getTreshold())
-            cpuTdTmp = 0;
-
-        if (gpuTmp == plPtr->getGpuMax())
-            gpuTdTmp = plPtr->getTreshold();
-        else if (gpuTmp <= plPtr->getGpuMax() - plPtr->getTreshold())
-            gpuTdTmp = 0;
-
-        if (mchTmp == plPtr->getMchMax())
-            mchTdTmp = plPtr->getTreshold();
-        else if (mchTmp <= plPtr->getMchMax() - plPtr->getTreshold())
-            mchTdTmp = 0;
-    }
+    w->deleteLater();
+    inFlight = NULL;
+    dispatch();
 }
 
 Notifications::Notifications()
 {
     settings = new QSettings("thinkctl", "settings");
-    notify = new QDBusInterface("org.freedesktop.Notifications", "/org/freedesktop/Notifications",
-                                      "org.freedesktop.Notifications", QDBusConnection::sessionBus());
+    queue = new NotifyQueue();
 
     if (isSettingsExists())
         loadSettings();
     else
         addInitialSettings();
-
-    if (!notify->isValid())
-        qDebug() << "Cannot connect to dbus session";
 }
 
 Notifications::~Notifications()
 {
-    delete notify;
+    delete queue;
     delete settings;
 }
 
@@ -214,18 +163,7 @@ bool Notifications::isSettingsExists()
 
 void Notifications::sendMsg(QString str, bool constant)
 {
-    QList<QVariant> args;
-
-    args.append(QString("ThinkControl"));   // app_name
-    constant ? args.append(uint(29)) : args.append(uint(0)); // replaces_id
-    args.append("");                        // app_icon
-    args.append("");                        // summary
-    args.append(str);                       // body
-    args.append(QStringList());             // actions
-    args.append(QVariantMap());             // hints
-    args.append(int(10000));                // timeout
-
-    notify->callWithArgumentList(QDBus::AutoDetect, "Notify", args);
+    queue->post(str, constant ? NOTIFY_VOLUME_ID : 0);
 }
 
 void Notifications::sendWarnNotify(QString dev)
@@ -269,7 +207,7 @@ void Notifications::sendVolumeLvl(int v, bool m)
     }
 }
 
-WLGovernor::WLGovernor(SensorsArray *sa, ProfileList *pls)
+WLGovernor::WLGovernor(SensorsArray *sa, SampleBus *bus, ProfileList *pls)
 {
     settings = new QSettings("thinkctl", "settings");
 
@@ -281,6 +219,9 @@ WLGovernor::WLGovernor(SensorsArray *sa, ProfileList *pls)
     snsArray = sa;
     pfls = pls;
 
+    samples = new SampleSubscriber(bus, 0, this);
+    connect(samples, SIGNAL(sampleReady()), this, SLOT(updateLevels()));
+
     updateLevels();
 }
 
@@ -331,14 +272,10 @@ bool WLGovernor::isSettingsExists()
     return f.exists();
 }
 
-WLevelsT WLGovernor::checkLevel(QString devname, WLDevice *dev, QString t, int ct)
+WLevelsT WLGovernor::checkLevel(QString devname, WLDevice *dev, int temp, int ct)
 {
-        int temp;
-
-        if (t == "none")
+        if (temp == SENSOR_NONE)
             return NSEN;
-        else
-            temp = t.toInt();
 
         if (temp < ct-warnLvlDiff*2) {
 
@@ -374,18 +311,25 @@ WLevelsT WLGovernor::checkLevel(QString devname, WLDevice *dev, QString t, int c
 
 void WLGovernor::updateLevels()
 {
-    cpu.level = checkLevel("cpu", &cpu, QString::number(snsArray->cpu->getTemp()), snsArray->cpu->getCritTemp());
-    gpu.level = checkLevel("gpu", &gpu, snsArray->gpu->getTemp(), snsArray->gpu->getCritTemp());
-    mch.level = checkLevel("mch", &mch, snsArray->mch->getTemp(), snsArray->mch->getCritTemp());
-    ich.level = checkLevel("ich", &ich, snsArray->ich->getTemp(), snsArray->ich->getCritTemp());
-    aps.level = checkLevel("aps", &aps, snsArray->aps->getTemp(), snsArray->aps->getCritTemp());
-    pwr.level = checkLevel("pwr", &pwr, snsArray->pwr->getTemp(), snsArray->pwr->getCritTemp());
-    pcmcia.level = checkLevel("pcmcia", &pcmcia, snsArray->pcmcia->getTemp(), snsArray->pcmcia->getCritTemp());
-    mainBatFirst.level = checkLevel("main battery", &mainBatFirst, snsArray->mainBatFirst->getTemp(), snsArray->mainBatFirst->getCritTemp());
-    mainBatSecond.level = checkLevel("main battery", &mainBatSecond, snsArray->mainBatSecond->getTemp(), snsArray->mainBatSecond->getCritTemp());
+    Sample s;
+
+    if (!samples->latest(&s))
+        return;
+
+    const int16_t *t = s.thermal;
+
+    cpu.level = checkLevel("cpu", &cpu, s.cpu.max, snsArray->cpu->getCritTemp());
+    gpu.level = checkLevel("gpu", &gpu, snsArray->gpu->getTemp(t), snsArray->gpu->getCritTemp());
+    mch.level = checkLevel("mch", &mch, snsArray->mch->getTemp(t), snsArray->mch->getCritTemp());
+    ich.level = checkLevel("ich", &ich, snsArray->ich->getTemp(t), snsArray->ich->getCritTemp());
+    aps.level = checkLevel("aps", &aps, snsArray->aps->getTemp(t), snsArray->aps->getCritTemp());
+    pwr.level = checkLevel("pwr", &pwr, snsArray->pwr->getTemp(t), snsArray->pwr->getCritTemp());
+    pcmcia.level = checkLevel("pcmcia", &pcmcia, snsArray->pcmcia->getTemp(t), snsArray->pcmcia->getCritTemp());
+    mainBatFirst.level = checkLevel("main battery", &mainBatFirst, snsArray->mainBatFirst->getTemp(t), snsArray->mainBatFirst->getCritTemp());
+    mainBatSecond.level = checkLevel("main battery", &mainBatSecond, snsArray->mainBatSecond->getTemp(t), snsArray->mainBatSecond->getCritTemp());
 //    mainBatSecond.level = checkLevel("main battery", &mainBatSecond, snsArray->mainBatSe->getTemp(), snsArray->mainBat->getCritTemp());
-    bayBatFirst.level = checkLevel("bay battery", &bayBatFirst, snsArray->bayBatFirst->getTemp(), snsArray->bayBatFirst->getCritTemp());
-    bayBatSecond.level = checkLevel("bay battery", &bayBatSecond, snsArray->bayBatSecond->getTemp(), snsArray->bayBatSecond->getCritTemp());
+    bayBatFirst.level = checkLevel("bay battery", &bayBatFirst, snsArray->bayBatFirst->getTemp(t), snsArray->bayBatFirst->getCritTemp());
+    bayBatSecond.level = checkLevel("bay battery", &bayBatSecond, snsArray->bayBatSecond->getTemp(t), snsArray->bayBatSecond->getCritTemp());
 }
 
 void WLGovernor::checkForCritActions()
@@ -434,51 +378,54 @@ void WLGovernor::setCritLvlAction(critLvlActionT action) { critLvlAction = actio
 void WLGovernor::setShutdownMethod(shutdownMethodT method) { shutdownMethod = method; }
 void WLGovernor::setFallbackProfile(int n) { fallbackProfile = n; }
 
-CritTempActions::CritTempActions()
+/* Not waited for, while one request is outstanding others are ignored */
+
+void CritTempActions::requestAction(const QString &method)
 {
-    dbus = new QDBusInterface("org.freedesktop.PowerManagement", "/org/freedesktop/PowerManagement",
-                              "org.freedesktop.PowerManagement", QDBusConnection::sessionBus());
+    if (!action.isFinished())
+        return;
 
-    if (!dbus->isValid())
-        qDebug() << "Cannot connect to dbus session";
-}
+    if (action.isError() && action.error().isValid())    // default reply is an error too
+        qDebug() << "Previous power management request failed:" << action.error().message();
 
-CritTempActions::~CritTempActions()
-{
-    delete dbus;
+    QDBusMessage msg = QDBusMessage::createMethodCall("org.freedesktop.PowerManagement",
+                                                      "/org/freedesktop/PowerManagement",
+                                                      "org.freedesktop.PowerManagement", method);
+
+    action = QDBusConnection::sessionBus().asyncCall(msg);
 }
 
 void CritTempActions::performSuspend()
 {
-    if (!actionWasCompleted)
-        dbus->call("Suspend");
+    requestAction("Suspend");
 }
 
 void CritTempActions::performHibernate()
 {
-    if (!actionWasCompleted)
-        dbus->call("Hibernate");
+    requestAction("Hibernate");
 }
 
 BatteryGovernor::BatteryGovernor()
 {
     settings = new QSettings("thinkctl", "batteries");
 
-    QFile f("/proc/modules");
-    QTextStream ts(&f);
-    f.open(QIODevice::ReadOnly);
-
-    if (ts.readAll().contains("tp_smapi"))
-        presence = true;
-    else
-        presence = false;
+    batteries = findBatteries();
+    presence = !batteries.isEmpty();
 
     if (presence == true) {
-        mainBat = new Battery(0);
+        mainBat = batteries.first();
+        connect(mainBat, SIGNAL(snapshotChanged(uint)), this, SLOT(mainBatChanged(uint)));
 
         if (isSettingsExists(settings))
             loadSettings();
-    }
+    } else
+        mainBat = NULL;
+}
+
+BatteryGovernor::~BatteryGovernor()
+{
+    qDeleteAll(batteries);
+    delete settings;
 }
 
 bool BatteryGovernor::isModulePresent()
@@ -486,82 +433,56 @@ bool BatteryGovernor::isModulePresent()
     return presence;
 }
 
+/*
+ * Stop threshold used to be saved as "stop_charging_threshold", it's
+ * read from there when the right key is missing. Unset values are 0 and
+ * aren't written, firmware keeps its own.
+ */
+
 void BatteryGovernor::loadSettings()
 {
+    int start, stop;
+
     settings->beginGroup("Main_Battery");
-    mainBat->setStartChargingTreshold(settings->value("start_charging_treshold").toInt());
-    mainBat->setStopChargingTreshold(settings->value("stop_charging_treshold").toInt());
+    start = settings->value("start_charging_treshold").toInt();
+    stop = settings->value("stop_charging_treshold",
+                           settings->value("stop_charging_threshold")).toInt();
     settings->endGroup();
+
+    if (start > 0)
+        mainBat->setStartChargingTreshold(start);
+    if (stop > 0)
+        mainBat->setStopChargingTreshold(stop);
 }
 
 void BatteryGovernor::saveSettings()
 {
     settings->beginGroup("Main_Battery");
     settings->setValue("start_charging_treshold", mainBat->getStartChargingTreshold());
-    settings->setValue("stop_charging_threshold", mainBat->getStopChargingTreshold());
+    settings->setValue("stop_charging_treshold", mainBat->getStopChargingTreshold());
+    settings->remove("stop_charging_threshold");
     settings->endGroup();
 }
 
-void BatteryGovernor::updateBatteriesState()
+QList<Battery *> BatteryGovernor::getBatteries()
 {
-    QString mainBatState = mainBat->getState();
-
-    if (mainBatState == "none")
-        if (mainBatPrevState != mainBatState)
-            emit mainBatInstalled(false);
-
-    else {
-        if (mainBatPrevState == "none")
-            emit mainBatInstalled(true);
-
-        emit mainBatValuesChanged();
-    }
-
-/*
-    switch (batStates.indexOf(mainBatState)) {
-
-    case 0:     // none
-
-        if (mainBatPrevState != mainBatState)
-            emit mainBatInstalled(false);
-
-        break;
-
-    case 1:     // idle
-
-        if (mainBatPrevState == "none")
-            emit mainBatInstalled(true);
-
-        if (mainBatPrevState != mainBatState)
-            emit mainBatStateChanged(mainBatState);
-
-        break;
-
-    case 2:     // charging
-
-        if (mainBatPrevState == "none")
-            emit mainBatInstalled(true);
-
-        if (mainBatPrevState != mainBatState)
-            emit mainBatStateChanged(mainBatState);
-
-        emit mainBatValuesChanged();
-        break;
-
-    case 3:     // discharging
-
-        if (mainBatPrevState == "none")
-            emit mainBatInstalled(true);
+    return batteries;
+}
 
-        if (mainBatPrevState != mainBatState)
-            emit mainBatStateChanged(mainBatState);
+void BatteryGovernor::updateBatteriesState()
+{
+    for (int i = 0; i < batteries.size(); i++)
+        batteries.at(i)->refresh();
+}
 
-        emit mainBatValuesChanged();
-        break;
-    }
+void BatteryGovernor::mainBatChanged(uint dirty)
+{
+    const BatterySnapshot &b = mainBat->getSnapshot();
 
-    mainBatPrevState = mainBatState;
-*/
+    if (dirty & BAT_INSTALLED)
+        emit mainBatInstalled(b.installed);
+    else if (b.installed)
+        emit mainBatValuesChanged(dirty);
 }
 
 void BatteryGovernor::mainBatSetStartChargeTreshold(int n)
@@ -671,56 +592,89 @@ void OSD::sendKosd(int n, bool m)
     osdDbus->callWithArgumentList(QDBus::AutoDetect, "showVolume", args);
 }
 
-TPVolume::TPVolume()
+TPVolume::TPVolume(EventLoop *l)
 {
     const char *mixName = "Console";
 //    const char *cardName = "hw:29";
     const char *cardName = "hw:4";
     const int mixIndex = 0;
 
+    loop = l;
+
     snd_mixer_selem_id_alloca(&selemId);
     snd_mixer_selem_id_set_index(selemId, mixIndex);
     snd_mixer_selem_id_set_name(selemId, mixName);
     elemCallback = showVolumeLvl;
 
-    if (snd_mixer_open(&handle, 0) < 0)
+    if (snd_mixer_open(&handle, 0) < 0) {
         qDebug() << "Cannot open alsa mixer handle";
+        handle = NULL;
+        return;
+    }
 
     if (snd_mixer_attach(handle, cardName) < 0) {
         qDebug() << "Cannot attach alsa mixer handle to device";
         snd_mixer_close(handle);
+        handle = NULL;
+        return;
     }
 
     if (snd_mixer_selem_register(handle, NULL, NULL) < 0) {
         qDebug() << "Cannot register alsa selem class";
         snd_mixer_close(handle);
+        handle = NULL;
+        return;
     }
 
     if (snd_mixer_load(handle) < 0) {
         qDebug() << "Cannot load alsa mixer elem";
         snd_mixer_close(handle);
+        handle = NULL;
+        return;
     }
 
     elem = snd_mixer_find_selem(handle, selemId);
     if (elem == NULL) {
         qDebug() << "Cannot find alsa selem";
         snd_mixer_close(handle);
+        handle = NULL;
+        return;
     }
 
     snd_mixer_elem_set_callback(elem, elemCallback);
 
-    timer = new QTimer;
-    connect(timer, SIGNAL(timeout()), this, SLOT(checkForEvent()));
-    timer->start(100);
+    /* wait for mixer descriptors instead of polling them */
+    int cnt = snd_mixer_poll_descriptors_count(handle);
+    if (cnt > 0) {
+        struct pollfd *pfds = new struct pollfd[cnt];
+
+        cnt = snd_mixer_poll_descriptors(handle, pfds, cnt);
+        for (int i = 0; i < cnt; i++) {
+            uint32_t ev = 0;
+
+            if (pfds[i].events & POLLIN)
+                ev |= EPOLLIN;
+            if (pfds[i].events & POLLOUT)
+                ev |= EPOLLOUT;
+
+            if (loop->addFd(pfds[i].fd, ev, this))
+                pollFds.append(pfds[i].fd);
+        }
+
+        delete[] pfds;
+    }
 }
 
 TPVolume::~TPVolume()
 {
-    delete timer;
-    snd_mixer_close(handle);
+    for (int i = 0; i < pollFds.size(); i++)
+        loop->removeFd(pollFds.at(i));
+
+    if (handle)
+        snd_mixer_close(handle);
 }
 
-void TPVolume::checkForEvent()
+void TPVolume::handleEvent(int, uint32_t)
 {
     snd_mixer_handle_events(handle);
 }
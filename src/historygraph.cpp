@@ -0,0 +1,234 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/historygraph.h"
+
+#include <QVector>
+
+#include <string.h>
+
+HistoryGraph::HistoryGraph(QWidget *parent) : QWidget(parent)
+{
+    history = NULL;
+    drawn = 0;
+    memset(&last, 0, sizeof(last));
+
+    setAttribute(Qt::WA_OpaquePaintEvent);          // plot covers whole widget
+}
+
+void HistoryGraph::setHistory(SensorHistory *h)
+{
+    if (history != NULL)
+        disconnect(history, SIGNAL(appended()), this, SLOT(pointsAppended()));
+
+    history = h;
+    drawn = 0;
+
+    if (history != NULL && isVisible()) {
+        connect(history, SIGNAL(appended()), this, SLOT(pointsAppended()));
+        update();
+    }
+}
+
+void HistoryGraph::showEvent(QShowEvent *)
+{
+    if (history == NULL)
+        return;
+
+    connect(history, SIGNAL(appended()), this, SLOT(pointsAppended()));
+    pointsAppended();                               // catch up with points missed while hidden
+}
+
+void HistoryGraph::hideEvent(QHideEvent *)
+{
+    if (history != NULL)
+        disconnect(history, SIGNAL(appended()), this, SLOT(pointsAppended()));
+}
+
+void HistoryGraph::resizeEvent(QResizeEvent *)
+{
+    drawn = 0;
+}
+
+void HistoryGraph::paintEvent(QPaintEvent *)
+{
+    if (drawn == 0 || plot.width() != width() || plot.height() != height())
+        rebuild();
+
+    QPainter p(this);
+    p.drawPixmap(0, 0, plot);
+
+    /* Labels are cheap and don't scroll, so they're not on the plot */
+    p.setPen(Qt::darkGray);
+    for (int t = GRAPH_TEMP_MIN + GRAPH_TEMP_GRID; t < GRAPH_TEMP_MAX; t += GRAPH_TEMP_GRID)
+        p.drawText(2, tempY(t) - 2, QString::number(t));
+
+    if (drawn == 0)
+        return;
+
+    int t = hottest(last);
+    int rpm = last.value[HISTORY_FAN];
+
+    p.setPen(Qt::red);
+    p.drawText(QRect(0, 2, width() - 4, 16), Qt::AlignRight | Qt::AlignTop,
+               t == SENSOR_NONE ? QString("none") : QString::number(t).append(" C"));
+    p.setPen(Qt::blue);
+    p.drawText(QRect(0, 18, width() - 4, 16), Qt::AlignRight | Qt::AlignTop,
+               rpm == SENSOR_NONE ? QString("none") : QString::number(rpm).append(" rpm"));
+}
+
+int HistoryGraph::tempY(int t)
+{
+    if (t < GRAPH_TEMP_MIN)
+        t = GRAPH_TEMP_MIN;
+    else if (t > GRAPH_TEMP_MAX)
+        t = GRAPH_TEMP_MAX;
+
+    return (height() - 1) - (t - GRAPH_TEMP_MIN) * (height() - 1) / (GRAPH_TEMP_MAX - GRAPH_TEMP_MIN);
+}
+
+int HistoryGraph::rpmY(int rpm)
+{
+    if (rpm < 0)
+        rpm = 0;
+    else if (rpm > GRAPH_RPM_MAX)
+        rpm = GRAPH_RPM_MAX;
+
+    return (height() - 1) - rpm * (height() - 1) / GRAPH_RPM_MAX;
+}
+
+int HistoryGraph::hottest(const HistoryPoint &p)
+{
+    int max = SENSOR_NONE;
+
+    for (int i = 0; i < THERMAL_SLOTS; i++)
+        if (p.value[i] > max)
+            max = p.value[i];
+
+    return max;
+}
+
+void HistoryGraph::drawBackground(QPainter &p, int x, int w)
+{
+    p.fillRect(x, 0, w, height(), QColor(255, 255, 255));
+
+    p.setPen(QColor(224, 224, 224));
+    for (int t = GRAPH_TEMP_MIN + GRAPH_TEMP_GRID; t < GRAPH_TEMP_MAX; t += GRAPH_TEMP_GRID)
+        p.drawLine(x, tempY(t), x + w - 1, tempY(t));
+}
+
+/* Joins a at column x - GRAPH_STEP with b at column x */
+
+void HistoryGraph::drawSegment(QPainter &p, int x, const HistoryPoint &a, const HistoryPoint &b)
+{
+    int x0 = x - GRAPH_STEP;
+
+    if (a.time == 0 || b.time < a.time || b.time - a.time > GRAPH_MAX_GAP)
+        return;
+
+    p.setPen(QColor(176, 176, 176));
+    for (int i = 0; i < THERMAL_SLOTS; i++)
+        if (a.value[i] != SENSOR_NONE && b.value[i] != SENSOR_NONE)
+            p.drawLine(x0, tempY(a.value[i]), x, tempY(b.value[i]));
+
+    int ta = hottest(a);
+    int tb = hottest(b);
+
+    if (ta != SENSOR_NONE && tb != SENSOR_NONE) {
+        p.setPen(Qt::red);
+        p.drawLine(x0, tempY(ta), x, tempY(tb));
+    }
+
+    if (a.value[HISTORY_FAN] != SENSOR_NONE && b.value[HISTORY_FAN] != SENSOR_NONE) {
+        p.setPen(Qt::blue);
+        p.drawLine(x0, rpmY(a.value[HISTORY_FAN]), x, rpmY(b.value[HISTORY_FAN]));
+    }
+}
+
+/* Whole plot from history, newest point at the right edge */
+
+void HistoryGraph::rebuild()
+{
+    if (plot.width() != width() || plot.height() != height())
+        plot = QPixmap(width(), height());
+
+    QPainter p(&plot);
+    drawBackground(p, 0, width());
+
+    drawn = 0;
+    if (history == NULL)
+        return;
+
+    int count = width() / GRAPH_STEP + 2;
+    if (count > HISTORY_RAW_SIZE)
+        count = HISTORY_RAW_SIZE;
+
+    QVector<HistoryPoint> pts(count);
+    int n = history->getRaw(pts.data(), count);
+
+    for (int i = n - 2; i >= 0; i--)
+        drawSegment(p, width() - 1 - i * GRAPH_STEP, pts[i + 1], pts[i]);
+
+    if (n > 0) {
+        last = pts[0];
+        drawn = history->getHead();
+    }
+}
+
+/*
+ * Scrolls plot by the new points and draws only their columns. If more
+ * points came than fit, e.g. after being hidden, plot is rebuilt.
+ */
+
+void HistoryGraph::pointsAppended()
+{
+    if (history == NULL || !isVisible())
+        return;
+
+    uint64_t head = history->getHead();
+
+    if (head == drawn)
+        return;
+
+    if (drawn == 0 || plot.width() != width() || plot.height() != height() ||
+            (head - drawn) * GRAPH_STEP >= (uint64_t)width()) {
+        drawn = 0;                                  // paintEvent() rebuilds it
+        update();
+        return;
+    }
+
+    int shift = (int)(head - drawn) * GRAPH_STEP;
+    int w = plot.width();
+    HistoryPoint pt;
+
+    plot.scroll(-shift, 0, plot.rect());
+
+    QPainter p(&plot);
+    drawBackground(p, w - shift, shift);
+
+    for (uint64_t i = drawn + 1; i <= head; i++) {
+        if (!history->getRawAt(i, &pt))
+            continue;
+        drawSegment(p, w - 1 - (int)(head - i) * GRAPH_STEP, last, pt);
+        last = pt;
+    }
+
+    drawn = head;
+    update();
+}
@@ -0,0 +1,622 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/input.h"
+
+#include <X11/Xatom.h>
+#include <X11/extensions/XInput.h>
+
+#include <string.h>
+
+XInputSession::XInputSession()
+{
+    display = XOpenDisplay(NULL);
+    batchDepth = 0;
+
+    if (!display)
+        qDebug() << "Cannot open X display for input devices";
+}
+
+XInputSession::~XInputSession()
+{
+    if (!display)
+        return;
+
+    QHash<long int, void *>::const_iterator it;
+    for (it = devices.constBegin(); it != devices.constEnd(); ++it)
+        XCloseDevice((Display *)display, (XDevice *)it.value());
+
+    XCloseDisplay((Display *)display);
+}
+
+bool XInputSession::isOpen()
+{
+    return display != NULL;
+}
+
+long int XInputSession::findDevice(const char *name)
+{
+    XDeviceInfo *devs;
+    long int id = -1;
+    int n;
+
+    if (!display)
+        return -1;
+
+    devs = XListInputDevices((Display *)display, &n);   // get pointer to Input Devices structures
+
+    for (int i = 0; i < n; i++) {                       // find device id by name
+        if (strcmp(devs[i].name, name) == 0) {
+            id = (long int)devs[i].id;                  // change XID unsigned long to long int bc of
+            break;                                      // return value and bug in include order
+        }
+    }
+
+    if (devs)
+        XFreeDeviceList(devs);
+
+    return id;
+}
+
+unsigned long XInputSession::atom(const char *name)
+{
+    QByteArray key(name);
+    QHash<QByteArray, unsigned long>::const_iterator it = atoms.constFind(key);
+
+    if (it != atoms.constEnd())
+        return it.value();
+
+    Atom a = XInternAtom((Display *)display, name, False);
+    atoms.insert(key, a);
+
+    return a;
+}
+
+void *XInputSession::device(long int dev)
+{
+    if (!display || dev == -1)
+        return NULL;
+
+    void *d = devices.value(dev, NULL);
+
+    if (!d) {
+        d = XOpenDevice((Display *)display, (XID)dev);
+        if (d)
+            devices.insert(dev, d);
+        else
+            qDebug() << "Cannot open input device" << dev;
+    }
+
+    return d;
+}
+
+void XInputSession::begin()
+{
+    batchDepth++;
+}
+
+void XInputSession::commit()
+{
+    if (batchDepth > 0 && --batchDepth == 0 && display)
+        XFlush((Display *)display);
+}
+
+void XInputSession::changed()
+{
+    if (batchDepth == 0)
+        XFlush((Display *)display);
+}
+
+void XInputSession::setProp(long int dev, const char *prop, int val, int val2, int val3, int val4)
+{
+    XDevice *xdev = (XDevice *)device(dev);
+    unsigned char data[4];
+    int numOfVal;
+
+    if (!xdev)
+        return;
+
+    data[0] = (unsigned char)val;
+    data[1] = (unsigned char)val2;
+    data[2] = (unsigned char)val3;
+    data[3] = (unsigned char)val4;
+
+    if (val4 != -1)
+        numOfVal = 4;
+    else if (val3 != -1)
+        numOfVal = 3;
+    else if (val2 != -1)
+        numOfVal = 2;
+    else
+        numOfVal = 1;
+
+    XChangeDeviceProperty((Display *)display, xdev, atom(prop), XA_INTEGER, 8, PropModeReplace, data, numOfVal);
+    changed();
+}
+
+/* Xlib takes format 16 values as shorts and format 32 ones as longs */
+
+void XInputSession::setProp32(long int dev, const char *prop, int fmt, int val, int val2)
+{
+    XDevice *xdev = (XDevice *)device(dev);
+    short data16[2];
+    long data32[2];
+    int numOfVal = val2 != -1 ? 2 : 1;
+
+    if (!xdev)
+        return;
+
+    data16[0] = (short)val;
+    data16[1] = (short)val2;
+    data32[0] = val;
+    data32[1] = val2;
+
+    XChangeDeviceProperty((Display *)display, xdev, atom(prop), XA_INTEGER, fmt, PropModeReplace,
+                          fmt == 16 ? (unsigned char *)data16 : (unsigned char *)data32, numOfVal);
+    changed();
+}
+
+void XInputSession::setPropFloat(long int dev, const char *prop, float val, float val2)
+{
+    XDevice *xdev = (XDevice *)device(dev);
+    long data[2];
+    int numOfVal = val2 != -1 ? 2 : 1;
+
+    if (!xdev)
+        return;
+
+    memset(data, 0, sizeof(data));
+    memcpy(&data[0], &val, sizeof(float));      // float in each long sized item
+    memcpy(&data[1], &val2, sizeof(float));
+
+    XChangeDeviceProperty((Display *)display, xdev, atom(prop), atom("FLOAT"), 32, PropModeReplace,
+                          (unsigned char *)data, numOfVal);
+    changed();
+}
+
+TrackPoint::TrackPoint(XInputSession *s)
+{
+    xi = s;
+    devID = xi->findDevice("TPPS/2 IBM TrackPoint");
+
+    if (devID != -1) {
+        devPresented = true;
+
+        settings = new QSettings("thinkctl", "input");
+        xi->begin();
+
+        if (isSettingsExists(settings)) {
+            settings->beginGroup("TrackPoint");
+            setEnabled(devEnabled = settings->value("device_enabled").toInt());
+            setPressToSelectEnabled(pressToSelectState = settings->value("set_press_to_select_enabled").toBool());
+            setMiddleBtnEnabled(middleBtnState = settings->value("set_middle_button_emulation_enabled").toBool());
+            setScrollingEnabled(scrollingState = settings->value("set_scrolling_enabled").toBool());
+            setSpeed(speed = settings->value("speed").toInt());
+            setSensitivity(sensitivity = settings->value("sensitivity").toInt());
+            setInertia(inertia = settings->value("inertia").toInt());
+            settings->endGroup();
+
+            applySettings();
+        } else {                                                // set initial values
+            setEnabled(devEnabled = true);
+            setPressToSelectEnabled(pressToSelectState = false);
+            setMiddleBtnEnabled(middleBtnState = false);
+            setScrollingEnabled(scrollingState = false);
+            setSpeed(speed = 170);
+            setSensitivity(sensitivity = 150);
+            setInertia(inertia = 45);
+        }
+
+        xi->commit();
+    } else {
+        devPresented = false;
+        qDebug() << "Cannot find trackpoint device";
+    }
+}
+
+TrackPoint::~TrackPoint()
+{
+    settings->beginGroup("TrackPoint");
+    settings->setValue("device_enabled", devEnabled);
+    settings->setValue("set_press_to_select_enabled", pressToSelectState);
+    settings->setValue("set_middle_button_emulation_enabled", middleBtnState);
+    settings->setValue("set_scrolling_enabled", scrollingState);
+    settings->setValue("speed", speed);
+    settings->setValue("sensitivity", sensitivity);
+    settings->setValue("inertia", inertia);
+    settings->endGroup();
+
+    delete settings;
+}
+
+int TrackPoint::getSpeedValue()
+{
+    QFile f("/sys/devices/platform/i8042/serio1/serio2/speed");
+    if (!f.exists())
+        f.setFileName("/sys/devices/platform/i8042/serio1/speed");
+
+    QTextStream ts(&f);
+    f.open(QIODevice::ReadOnly);
+
+    return ts.readLine().toInt();
+}
+
+int TrackPoint::getSensitivityValue()
+{
+    QFile f("/sys/devices/platform/i8042/serio1/serio2/sensitivity");
+    if (!f.exists())
+        f.setFileName("/sys/devices/platform/i8042/serio1/sensitivity");
+
+    QTextStream ts(&f);
+    f.open(QIODevice::ReadOnly);
+
+    return ts.readLine().toInt();
+}
+
+bool TrackPoint::getState()
+{
+    return devEnabled == 1 ? true : false;
+}
+
+bool TrackPoint::getScrollingState()
+{
+    return scrollingState;
+}
+
+bool TrackPoint::getPressToSelectState()
+{
+    return pressToSelectState;
+}
+
+bool TrackPoint::getMiddleBtnState()
+{
+    return middleBtnState == 1 ? true : false;
+}
+
+int TrackPoint::getCurSpeed()
+{
+    return speed;
+}
+
+int TrackPoint::getCurSensitivity()
+{
+    return sensitivity;
+}
+
+int TrackPoint::getCurInertia()
+{
+    return inertia;
+}
+
+void TrackPoint::setEnabled(bool st)
+{    
+    if (st)
+        devEnabled = 1;
+    else
+        devEnabled = 0;
+
+    xi->setProp(devID, "Device Enabled", devEnabled);
+}
+
+void TrackPoint::setPressToSelectEnabled(bool st)
+{
+    QFile f("/sys/devices/platform/i8042/serio1/serio2/press_to_select");
+    if (!f.exists())
+        f.setFileName("/sys/devices/platform/i8042/serio1/press_to_select");
+
+    pressToSelectState = st;
+
+    if (f.open(QIODevice::WriteOnly)) {
+        if (st)
+            f.write("1");
+        else
+            f.write("0");
+    } else {
+        qDebug() << "Cannot open trackpoint press_to_select file for writing";
+    }
+
+    f.close();
+}
+
+void TrackPoint::setScrollingEnabled(bool st)
+{
+    if (st) {
+        xi->setProp(devID, "Evdev Wheel Emulation", 1);
+        xi->setProp(devID, "Evdev Wheel Emulation Button", 2);
+        xi->setProp(devID, "Evdev Wheel Emulation Axes", 6, 7, 4, 5);
+        scrollingState = true;
+    } else {
+        xi->setProp(devID, "Evdev Wheel Emulation", 0);
+        scrollingState = false;
+    }
+}
+
+void TrackPoint::setMiddleBtnEnabled(bool st)
+{
+    if (st) {
+        xi->setProp(devID, "Evdev Middle Button Emulation", 1);
+        middleBtnState = true;
+    } else {
+        xi->setProp(devID, "Evdev Middle Button Emulation", 0);
+        middleBtnState = false;
+    }
+}
+
+void TrackPoint::setSpeed(int n)
+{
+    QFile f("/sys/devices/platform/i8042/serio1/serio2/speed");
+    if (!f.exists())
+        f.setFileName("/sys/devices/platform/i8042/serio1/speed");
+
+    QTextStream ts(&f);
+
+    speed = n;
+
+    if (f.open(QIODevice::WriteOnly))
+        ts << n;
+    else
+        qDebug() << "Cannot open trackpoint speed file for writing";
+
+    f.close();
+}
+
+void TrackPoint::setSensitivity(int n)
+{
+    QFile f("/sys/devices/platform/i8042/serio1/serio2/sensitivity");
+    if (!f.exists())
+        f.setFileName("/sys/devices/platform/i8042/serio1/sensitivity");
+
+    QTextStream ts(&f);
+
+    sensitivity = n;
+
+    if (f.open(QIODevice::WriteOnly))
+        ts << n;
+    else
+        qDebug() << "Cannot open trackpoint sensitivity file for writing";
+
+    f.close();
+}
+
+void TrackPoint::setInertia(int n)
+{
+    xi->setProp32(devID, "Evdev Wheel Emulation Inertia", 16, n);
+    inertia = n;
+}
+
+void TrackPoint::applySettings()
+{
+    xi->begin();
+    setEnabled(devEnabled);
+    setScrollingEnabled(scrollingState);
+    setMiddleBtnEnabled(middleBtnState);
+    setInertia(inertia);
+    xi->commit();
+}
+
+TouchPad::TouchPad(XInputSession *s)
+{
+    xi = s;
+    devID = xi->findDevice("SynPS/2 Synaptics TouchPad");
+
+    if (devID != -1) {
+        devPresented = true;
+
+        settings = new QSettings("thinkctl", "input");
+
+        if (isSettingsExists(settings)) {
+            settings->beginGroup("TouchPad");
+            devEnabled = settings->value("device_enabled").toInt();
+            twoFingerVertScrolling = settings->value("two_finger_vertical_scrolling_enabled").toBool();
+            edgeVertScrolling = settings->value("edge_vertical_scrolling_enabled").toBool();
+            vertScrollingSpeed = settings->value("vertical_scrolling_speed").toInt();
+            twoFingerHorizScrolling = settings->value("two_finger_horizontal_scrolling_enabled").toBool();
+            edgeHorizScrolling = settings->value("edge_horizontal_scrolling_enabled").toBool();
+            horizScrollingSpeed = settings->value("horizontal_scrolling_speed").toInt();
+            edgeCoasting = settings->value("edge_coasting_enabled").toBool();
+            coastingAccel = settings->value("coasting_acceleration").toInt();
+            coastingDecel = settings->value("coasting_deceleration").toInt();
+            settings->endGroup();
+        } else {
+            devEnabled = true;
+            twoFingerVertScrolling = false;
+            twoFingerHorizScrolling = false;
+            edgeVertScrolling = false;
+            edgeHorizScrolling = false;
+            vertScrollingSpeed = 1;
+            horizScrollingSpeed = 1;
+            edgeCoasting = false;
+            coastingAccel = 1;
+            coastingDecel = 1;
+        }
+
+        applySettings();                // all values are known, so one batch
+    } else {
+        devPresented = false;
+        qDebug() << "Cannot find touchpad device";
+    }
+}
+
+TouchPad::~TouchPad()
+{
+    settings->beginGroup("TouchPad");
+    settings->setValue("device_enabled", devEnabled);
+    settings->setValue("two_finger_vertical_scrolling_enabled", twoFingerVertScrolling);
+    settings->setValue("edge_vertical_scrolling_enabled", edgeVertScrolling);
+    settings->setValue("vertical_scrolling_speed", vertScrollingSpeed);
+    settings->setValue("two_finger_horizontal_scrolling_enabled", twoFingerHorizScrolling);
+    settings->setValue("edge_horizontal_scrolling_enabled", edgeHorizScrolling);
+    settings->setValue("horizontal_scrolling_speed", horizScrollingSpeed);
+    settings->setValue("edge_coasting_enabled", edgeCoasting);
+    settings->setValue("coasting_acceleration", coastingAccel);
+    settings->setValue("coasting_deceleration", coastingDecel);
+    settings->endGroup();
+
+    delete settings;
+}
+
+bool TouchPad::isPresent()
+{
+    return devPresented;
+}
+
+bool TouchPad::getState()
+{
+    return devEnabled == 1 ? true : false;
+}
+
+bool TouchPad::getTwoFingetVertScrolling()
+{
+    return twoFingerVertScrolling == 1 ? true : false;
+}
+
+bool TouchPad::getTwoFingerHorizScrolling()
+{
+    return twoFingerHorizScrolling == 1 ? true : false;
+}
+
+int TouchPad::getVertScrollingSpeed()
+{
+    return vertScrollingSpeed;
+}
+
+int TouchPad::getHorizScrollingSpeed()
+{
+    return horizScrollingSpeed;
+}
+
+bool TouchPad::getEdgeVertScrollingState()
+{
+    return edgeVertScrolling;
+}
+
+bool TouchPad::getEdgeHorizScrollingState()
+{
+    return edgeHorizScrolling;
+}
+
+bool TouchPad::getEdgeCoastingState()
+{
+    return edgeCoasting;
+}
+
+int TouchPad::getCoastingAccel()
+{
+    return (int)coastingAccel;
+}
+
+int TouchPad::getCoastingDecel()
+{
+    return (int)coastingDecel;
+}
+
+void TouchPad::setEnabled(bool st)
+{
+    if (st)
+        devEnabled = 1;
+    else
+        devEnabled = 0;
+
+    xi->setProp(devID, "Device Enabled", devEnabled);
+}
+
+void TouchPad::setTwoFingerVertScrolling(bool st)
+{
+    if (st)
+        twoFingerVertScrolling = 1;
+    else
+        twoFingerVertScrolling = 0;
+
+    xi->setProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
+}
+
+void TouchPad::setTwoFingerHorizScrolling(bool st)
+{
+    if (st)
+        twoFingerHorizScrolling = 1;
+    else
+        twoFingerHorizScrolling = 0;
+
+    xi->setProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
+}
+
+void TouchPad::setVertScrollingSpeed(int n)
+{
+    vertScrollingSpeed = n;
+    xi->setProp32(devID, "Synaptics Scrolling Distance", 32, vertScrollingSpeed, horizScrollingSpeed);
+}
+
+void TouchPad::setHorizScrollingSpeed(int n)
+{
+    horizScrollingSpeed = n;
+    xi->setProp32(devID, "Synaptics Scrolling Distance", 32, vertScrollingSpeed, horizScrollingSpeed);
+}
+
+void TouchPad::setEdgeVertScrolling(bool st)
+{
+    if (st)
+        edgeVertScrolling = 1;
+    else
+        edgeVertScrolling = 0;
+
+    xi->setProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
+}
+
+void TouchPad::setEdgeHorizScrolling(bool st)
+{
+    if (st)
+        edgeHorizScrolling = 1;
+    else
+        edgeHorizScrolling = 0;
+
+    xi->setProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
+}
+
+void TouchPad::setEdgeCoasting(bool st)
+{
+    if (st)
+        edgeCoasting = 1;
+    else
+        edgeCoasting = 0;
+
+    xi->setProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
+}
+
+void TouchPad::setCoastingAccel(int n)
+{
+    coastingAccel = (float)n;
+    xi->setPropFloat(devID, "Synaptics Coasting Speed", coastingDecel, coastingAccel);
+}
+
+void TouchPad::setCoastingDecel(int n)
+{
+    coastingDecel = (float)n;
+    xi->setPropFloat(devID, "Synaptics Coasting Speed", coastingDecel, coastingAccel);
+}
+
+void TouchPad::applySettings()
+{
+    xi->begin();
+    xi->setProp(devID, "Device Enabled", devEnabled);
+    xi->setProp(devID, "Synaptics Two-Finger Scrolling", twoFingerVertScrolling, twoFingerHorizScrolling);
+    xi->setProp32(devID, "Synaptics Scrolling Distance", 32, vertScrollingSpeed, horizScrollingSpeed);
+    xi->setProp(devID, "Synaptics Edge Scrolling", edgeVertScrolling, edgeHorizScrolling, edgeCoasting);
+    xi->setPropFloat(devID, "Synaptics Coasting Speed", coastingDecel, coastingAccel);
+    xi->commit();
+}
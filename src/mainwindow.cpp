@@ -39,16 +39,49 @@ MainWindow::MainWindow(QWidget *parent) :
         profiles.addInitialProfiles();
     currentProfile = profiles.getCurrentProfile();
 
-    timer = new Timer();
+    loop = new EventLoop();
+    bus = new SampleBus();
     sensorsArray = new SensorsArray();
-    gov = new Governor(sensorsArray, profiles.at(currentProfile));
-    wlgov = new WLGovernor(sensorsArray, &profiles);
+    cpufreq = new CpuFreqController();
+    daemon = new DaemonClient();
+
+    /*
+     * When thinkctld runs, it samples sensors and we only read its
+     * snapshots. SensorsArray is kept for gpu controls and sensor slots,
+     * but it's never refreshed.
+     */
+    samplerLoop = NULL;
+    scheduler = NULL;
+    if (daemon->isConnected()) {
+        uevents = new UeventMonitor(loop);
+    } else {
+        samplerLoop = new EventLoop();
+        sensorsArray->setSampleBus(bus);
+        scheduler = new Scheduler(samplerLoop, sensorsArray, profiles.at(currentProfile));
+        uevents = new UeventMonitor(samplerLoop);
+        scheduler->setACEvents(uevents->isOpen());
+    }
+    gov = new Governor(sensorsArray, bus, profiles.at(currentProfile));
+    if (daemon->isConnected())
+        gov->attachDaemon(daemon);                          // thinkctld owns the fan
+    wlgov = new WLGovernor(sensorsArray, bus, &profiles);
 //    apsgov = new APSGovernor();
     batgov = new BatteryGovernor();
     ws = new WirelessSwitchers();
-    tp = new TrackPoint();
-    touchpad = new TouchPad();
-    tpvol = new TPVolume();
+    xinput = new XInputSession();
+    tp = new TrackPoint(xinput);
+    touchpad = new TouchPad(xinput);
+    tpvol = new TPVolume(loop);
+
+    /* Governor may be in control thread, talk to it only through queued signals */
+    qRegisterMetaType<Profile>("Profile");
+    connect(this, SIGNAL(fanModeChanged(bool)), gov, SLOT(setMode(bool)));
+    connect(this, SIGNAL(fanLevelChanged(int)), gov, SLOT(setLevel(int)));
+    connect(this, SIGNAL(fanLevelAuto()), gov, SLOT(setLevelAuto()));
+    connect(this, SIGNAL(fanProfileChanged(Profile)), gov, SLOT(profileChanged(Profile)));
+    if (scheduler)
+        connect(this, SIGNAL(fanProfileChanged(Profile)), scheduler, SLOT(profileChanged(Profile)));
+    connect(&fanPstDialog, SIGNAL(profileEdited()), this, SLOT(fanPresetChanged()));
 
     ui->trackpointEnabled->setChecked(tp->getState());
     ui->TouchPadWidget->setEnabled(touchpad->isPresent());
@@ -66,16 +99,23 @@ MainWindow::MainWindow(QWidget *parent) :
 
     if (batgov->isModulePresent()) {
 
-        if (batgov->mainBat->isInstalled())
+        if (batgov->mainBat->getSnapshot().installed)
             this->initMainBatInfo();
         else
             this->mainBatInstalled(false);
 
         /* Main Battery */
-        connect(timer, SIGNAL(timeout()), batgov, SLOT(updateBatteriesState()));
+        if (scheduler) {
+            connect(scheduler, SIGNAL(batteryTick()), batgov, SLOT(updateBatteriesState()));
+        } else {
+            QTimer *batteryTimer = new QTimer(this);
+            connect(batteryTimer, SIGNAL(timeout()), batgov, SLOT(updateBatteriesState()));
+            connect(uevents, SIGNAL(powerSupplyChanged(QString)), batgov, SLOT(updateBatteriesState()));
+            batteryTimer->start(BATTERY_SLOW_INTERVAL);
+        }
         connect(batgov, SIGNAL(mainBatInstalled(bool)), this, SLOT(mainBatInstalled(bool)));
 //        connect(batgov, SIGNAL(mainBatStateChanged(QString)), this, SLOT(mainBatUpdateState(QString)));
-        connect(batgov, SIGNAL(mainBatValuesChanged()), this, SLOT(mainBatRefreshValues()));
+        connect(batgov, SIGNAL(mainBatValuesChanged(uint)), this, SLOT(mainBatRefreshValues(uint)));
         connect(ui->mainBatChargTreshsStartSpinBox, SIGNAL(valueChanged(int)), batgov, SLOT(mainBatSetStartChargeTreshold(int)));
         connect(ui->mainBatChargTreshsStopSpinBox, SIGNAL(valueChanged(int)), batgov, SLOT(mainBatSetStopChargeTreshold(int)));
 
@@ -85,16 +125,54 @@ MainWindow::MainWindow(QWidget *parent) :
 
 
     realyClose = false;                                     // by default we go in tray
+    daemonLost = false;
     this->programCtrlActivated(settings.isProgramControlled());       // set fan control
     ui->programCtrlBtn->setDown(settings.isProgramControlled());
 
-    /* Timer */
-    connect(timer, SIGNAL(timeout()), sensorsArray, SLOT(updateThermValues()));
+    /* Scheduler */
+    if (scheduler) {
+        connect(scheduler, SIGNAL(thermalTick()), sensorsArray, SLOT(updateThermValues()));
+        connect(sensorsArray, SIGNAL(thermalValuesUpdated()), scheduler, SLOT(thermalUpdated()));
+    }
 
-    /* Sensors Array */
-    connect(sensorsArray, SIGNAL(thermalValuesUpdated()), gov, SLOT(refresh()));
-    connect(sensorsArray, SIGNAL(thermalValuesUpdated()), wlgov, SLOT(updateLevels()));
-    connect(sensorsArray, SIGNAL(thermalValuesUpdated()), this, SLOT(refreshValues()));
+    /* Kernel events instead of polling for plug, trip and rfkill changes */
+    if (scheduler) {
+        connect(uevents, SIGNAL(acChanged(bool)), scheduler, SLOT(acChanged(bool)));
+        connect(uevents, SIGNAL(powerSupplyChanged(QString)), scheduler, SLOT(powerSupplyChanged()));
+        connect(uevents, SIGNAL(thermalChanged(QString)), scheduler, SLOT(thermalChanged()));
+    }
+    connect(uevents, SIGNAL(rfkillChanged(QString)), this, SLOT(setWirelessStates()));
+
+    /* Samples: governors get every one, window repaints at its own rate */
+    samples = new SampleSubscriber(bus, GUI_REFRESH_INTERVAL, this);
+    connect(samples, SIGNAL(sampleReady()), this, SLOT(refreshValues()));
+    history = new SensorHistory(bus, historyDir() + "/" + HISTORY_FILE, this);
+    ui->thermalGraph->setHistory(history);
+
+    /* Snapshots: publish them ourselves or take samples from thinkctld */
+    publisher = NULL;
+    feeder = NULL;
+    if (daemon->isConnected()) {
+        feeder = new SnapshotFeeder(bus, this);
+        wakeupRate = feeder->getWakeupRate();
+        powerSaving = feeder->isPowerSaving();
+        connect(feeder, SIGNAL(wakeupRateUpdated(double)), this, SLOT(setWakeupRate(double)));
+        connect(feeder, SIGNAL(powerSavingChanged(bool)), this, SLOT(setPowerSaving(bool)));
+    } else {
+        publisher = new SnapshotPublisher(bus, batgov->getBatteries());
+        connect(scheduler, SIGNAL(powerSavingChanged(bool)), publisher, SLOT(setPowerSaving(bool)));
+        connect(scheduler, SIGNAL(wakeupRateUpdated(double)), publisher, SLOT(setWakeupRate(double)));
+        publisher->setPowerSaving(scheduler->isPowerSaving());
+
+        QList<Battery *> bats = batgov->getBatteries();
+        for (int i = 0; i < bats.size(); i++)
+            batlogs.append(new BatteryLog(bats.at(i), historyDir()));
+
+        wakeupRate = scheduler->getWakeupRate();
+        powerSaving = scheduler->isPowerSaving();
+        connect(scheduler, SIGNAL(wakeupRateUpdated(double)), this, SLOT(setWakeupRate(double)));
+        connect(scheduler, SIGNAL(powerSavingChanged(bool)), this, SLOT(setPowerSaving(bool)));
+    }
 
     /* Fan */
     connect(ui->programCtrlBtn, SIGNAL(toggled(bool)), this, SLOT(programCtrlActivated(bool)));
@@ -140,24 +218,135 @@ MainWindow::MainWindow(QWidget *parent) :
     /* TouchPad */
     connect(ui->touchpadDialog, SIGNAL(clicked()), this, SLOT(touchpadDialogBtnPressed()));
     connect(ui->touchpadEnabled, SIGNAL(clicked(bool)), this, SLOT(touchpadEnabledChecked()));
+
+    /*
+     * Sampling and fan control get their own threads, so a slow repaint or
+     * blocking D-Bus call here doesn't delay them. Their objects are deleted
+     * in those threads when they finish. There's no sampler thread while
+     * thinkctld samples.
+     */
+    samplerThread = NULL;
+    controlThread = new QThread(this);
+    connect(controlThread, SIGNAL(finished()), this, SLOT(controlThreadFinished()), Qt::DirectConnection);
+    connect(daemon, SIGNAL(disconnected()), this, SLOT(daemonDisconnected()));
+    connect(daemon, SIGNAL(reconnected()), this, SLOT(daemonReconnected()));
+    gov->moveToThread(controlThread);
+    daemon->moveToThread(controlThread);                    // it's used by governor only
+    controlThread->start();
+
+    if (scheduler) {
+        samplerThread = new QThread(this);
+        connect(samplerThread, SIGNAL(started()), scheduler, SLOT(applyTimerSlack()));
+        connect(samplerThread, SIGNAL(finished()), this, SLOT(samplerThreadFinished()), Qt::DirectConnection);
+
+        samplerLoop->moveToThread(samplerThread);
+        sensorsArray->moveToThread(samplerThread);
+        scheduler->moveToThread(samplerThread);
+        uevents->moveToThread(samplerThread);
+
+        samplerThread->start();
+    }
 }
 
 MainWindow::~MainWindow()
 {
     profiles.setCurrentProfile(currentProfile);
     profiles.saveProfiles();
-    this->gov->setLevelAuto();
+
+    if (samplerThread) {
+        samplerThread->quit();                              // no more samples
+        samplerThread->wait();
+    } else {
+        feeder->stop();
+    }
+
+    if (!feeder) {                                          // daemon keeps controlling fan
+        QMetaObject::invokeMethod(gov, "setMode", Qt::BlockingQueuedConnection, Q_ARG(bool, false));
+        QMetaObject::invokeMethod(gov, "setLevelAuto", Qt::BlockingQueuedConnection);
+    }
+
+    controlThread->quit();
+    controlThread->wait();
 
     delete tp;
     delete touchpad;
+    delete xinput;
     delete ws;
     delete wlgov;
-    delete gov;
-    delete sensorsArray;
-    delete timer;
+    if (!samplerThread) {                                   // they are in GUI thread
+        delete uevents;
+        delete sensorsArray;
+    }
+    delete publisher;
+    qDeleteAll(batlogs);
+    delete batgov;
+    delete samples;
+    ui->thermalGraph->setHistory(NULL);
+    delete history;
+    delete feeder;
+    delete tpvol;
+    delete cpufreq;
+    delete bus;
+    delete loop;
     delete ui;
 }
 
+/*
+ * For thinkctl_bench, which publishes its own samples. Bus takes only one
+ * producer, so sensors or feeder stop publishing first. Blocking call to
+ * scheduler returns after a tick in progress is over.
+ */
+
+SampleBus *MainWindow::stopSampling()
+{
+    if (feeder) {
+        feeder->stop();                                     // runs in this thread
+        return bus;
+    }
+
+    disconnect(scheduler, SIGNAL(thermalTick()), sensorsArray, SLOT(updateThermValues()));
+    QMetaObject::invokeMethod(scheduler, "applyTimerSlack", Qt::BlockingQueuedConnection);
+
+    return bus;
+}
+
+/* Called in finishing threads, right before their event dispatchers go away */
+
+void MainWindow::samplerThreadFinished()
+{
+    delete uevents;
+    delete scheduler;
+    delete sensorsArray;
+    delete samplerLoop;
+}
+
+void MainWindow::controlThreadFinished()
+{
+    delete gov;
+    delete daemon;
+}
+
+/* Fan controls do nothing while thinkctld is gone, it gets our state when it's back */
+
+void MainWindow::daemonDisconnected()
+{
+    daemonLost = true;
+    ui->programCtrlBtn->setEnabled(false);
+    ui->controlledBox->setEnabled(false);
+    ui->programCtrlBtn->setToolTip("thinkctld is not running");
+    this->updateTrayToolTip();
+}
+
+void MainWindow::daemonReconnected()
+{
+    daemonLost = false;
+    ui->programCtrlBtn->setEnabled(true);
+    ui->programCtrlBtn->setToolTip(QString());
+    emit fanProfileChanged(*profiles.at(currentProfile));
+    this->programCtrlActivated(settings.isProgramControlled());
+    this->updateTrayToolTip();
+}
+
 QString MainWindow::getColor(WLevelsT lvl)
 {
     QString color("color: ");
@@ -180,34 +369,44 @@ QString MainWindow::getColor(WLevelsT lvl)
 
 void MainWindow::refreshValues()
 {
+    Sample smp;
+
+    if (!samples->latest(&smp))
+        return;
+
+    const int16_t *t = smp.thermal;
+
     /* Term */
-    ui->cpuValueLabel->setNum(sensorsArray->cpu->getTemp());
+    ui->cpuValueLabel->setText(tempToString(smp.cpu.max));
+    ui->cpuValueLabel->setToolTip(cpuTempsToString(&smp.cpu));
     ui->cpuValueLabel->setStyleSheet(getColor(wlgov->cpuGetLevel()));
-    ui->gpuValueLabel->setText(sensorsArray->gpu->getTemp());
+    ui->gpuValueLabel->setText(tempToString(sensorsArray->gpu->getTemp(t)));
     ui->gpuValueLabel->setStyleSheet(getColor(wlgov->gpuGetLevel()));
-    ui->mchValueLabel->setText(sensorsArray->mch->getTemp());
+    ui->mchValueLabel->setText(tempToString(sensorsArray->mch->getTemp(t)));
     ui->mchValueLabel->setStyleSheet(getColor(wlgov->mchGetLevel()));
-    ui->ichValueLabel->setText(sensorsArray->ich->getTemp());
+    ui->ichValueLabel->setText(tempToString(sensorsArray->ich->getTemp(t)));
     ui->ichValueLabel->setStyleSheet(getColor(wlgov->ichGetLevel()));
-    ui->apsValueLabel->setText(sensorsArray->aps->getTemp());
+    ui->apsValueLabel->setText(tempToString(sensorsArray->aps->getTemp(t)));
     ui->apsValueLabel->setStyleSheet(getColor(wlgov->apsGetLevel()));
-    ui->pwrValueLabel->setText(sensorsArray->pwr->getTemp());
-    ui->pcmciaValueLabel->setText(sensorsArray->pcmcia->getTemp());
-    ui->mainBatFstSenValLabel->setText(sensorsArray->mainBatFirst->getTemp());
+    ui->pwrValueLabel->setText(tempToString(sensorsArray->pwr->getTemp(t)));
+    ui->pcmciaValueLabel->setText(tempToString(sensorsArray->pcmcia->getTemp(t)));
+    ui->mainBatFstSenValLabel->setText(tempToString(sensorsArray->mainBatFirst->getTemp(t)));
     ui->mainBatFstSenValLabel->setStyleSheet(getColor(wlgov->mainBatFirstGetLevel()));
-//    ui->mainBatSecSenValLabel->setText(sensorsArray->mainBatSecond->getTemp());
-    ui->mainBatSecSenValLabel->setText(sensorsArray->mainBatSecond->getTemp());
+//    ui->mainBatSecSenValLabel->setText(tempToString(sensorsArray->mainBatSecond->getTemp()));
+    ui->mainBatSecSenValLabel->setText(tempToString(sensorsArray->mainBatSecond->getTemp(t)));
     ui->mainBatSecSenValLabel->setStyleSheet(getColor(wlgov->mainBatSecondGetLevel()));
-    ui->bayBatFstSenValLabel->setText(sensorsArray->bayBatFirst->getTemp());
+    ui->bayBatFstSenValLabel->setText(tempToString(sensorsArray->bayBatFirst->getTemp(t)));
     ui->bayBatFstSenValLabel->setStyleSheet(getColor(wlgov->bayBatFirstGetLevel()));
-    ui->bayBatSecSenValLabel->setText(sensorsArray->bayBatSecond->getTemp());
+    ui->bayBatSecSenValLabel->setText(tempToString(sensorsArray->bayBatSecond->getTemp(t)));
     ui->bayBatSecSenValLabel->setStyleSheet(getColor(wlgov->bayBatSecondGetLevel()));
 
     /* Fan */
-    ui->fanSpeedValueLabel->setNum(gov->getSpeed());
-    ui->fanSpeedValueLabelOvw->setNum(gov->getSpeed());
-    ui->fanLevelValueLabel->setText(gov->getLevel());
-    ui->fanLevelValueLabelOvw->setText(gov->getLevel());
+    QString fanLevel = fanLevelToString(smp.fanLevel);
+
+    ui->fanSpeedValueLabel->setNum(smp.fanSpeed);
+    ui->fanSpeedValueLabelOvw->setNum(smp.fanSpeed);
+    ui->fanLevelValueLabel->setText(fanLevel);
+    ui->fanLevelValueLabelOvw->setText(fanLevel);
 }
 
 void MainWindow::programCtrlActivated(bool s)
@@ -224,8 +423,8 @@ void MainWindow::programCtrlActivated(bool s)
         ui->speedLevelDialerLabel->setEnabled(false);
         ui->speedLevelDial->setEnabled(false);
         ui->swithersWidget->setEnabled(false);
-        gov->setMode(false);
-        gov->setLevelAuto();
+        emit fanModeChanged(false);
+        emit fanLevelAuto();
     }
 
     settings.setProgramControlled(s);
@@ -233,7 +432,7 @@ void MainWindow::programCtrlActivated(bool s)
 
 void MainWindow::presetCtrlActivated()
 {
-    gov->setMode(true);
+    emit fanModeChanged(true);
 
     ui->speedLevelWidget->setEnabled(false);
     ui->speedLevelDialerLabel->setEnabled(false);
@@ -243,7 +442,7 @@ void MainWindow::presetCtrlActivated()
 
 void MainWindow::manualCtrlActivated()
 {
-    gov->setMode(false);
+    emit fanModeChanged(false);
 
     ui->speedLevelWidget->setEnabled(true);
     ui->speedLevelDialerLabel->setEnabled(true);
@@ -256,6 +455,11 @@ void MainWindow::fanPresetBtnPressed()
     fanPstDialog.showDialog(profiles.at(currentProfile));
 }
 
+void MainWindow::fanPresetChanged()
+{
+    emit fanProfileChanged(*profiles.at(currentProfile));
+}
+
 void MainWindow::profileAddBtnPressed()
 {
     profileLnDialog.show();
@@ -266,7 +470,7 @@ void MainWindow::speedLvlDial(int n)
     if (ui->fanOffBtn->isDown())
         ui->fanOffBtn->setDown(false);
 
-    gov->setLevel(n);
+    emit fanLevelChanged(n);
 }
 
 void MainWindow::initProfiles()
@@ -280,7 +484,7 @@ void MainWindow::initProfiles()
 void MainWindow::initCpuPolicies()
 {
     ui->frequencyBox->addItem("ondemand");
-    ui->frequencyBox->addItems(sensorsArray->cpu->getAvailFreq());
+    ui->frequencyBox->addItems(cpufreq->getAvailFreq());
     ui->frequencyBox->setCurrentIndex(profiles.at(currentProfile)->getCpuPolicy());
     this->setCpuPolicy(currentProfile);
 }
@@ -336,42 +540,53 @@ void MainWindow::apsStopBtnPressed()
 */
 void MainWindow::initMainBatInfo()
 {
-//    ui->mainBatStateValLbl->setText(batgov->mainBat->getState());
+    const BatterySnapshot &b = batgov->mainBat->getSnapshot();
 
-    this->mainBatRefreshValues();
+    this->mainBatRefreshValues(BAT_ALL);
 
-    ui->mainBatFirstUseDatValLbl->setText(batgov->mainBat->getFirstUseDate());
+    ui->mainBatFirstUseDatValLbl->setText(b.firstUseDate);
 
-    ui->mainBatManufValLbl->setText(batgov->mainBat->getManufacturer());
-    ui->mainBatModelValLbl->setText(batgov->mainBat->getModel());
-    ui->mainBatTypeValLbl->setText(batgov->mainBat->getType());
-    ui->mainBatDesVoltValLbl->setText(QString::number((float)batgov->mainBat->getDesignVoltage()/1000).append("V"));
-    ui->mainBatDesCapValLbl->setText(QString::number((float)batgov->mainBat->getDesignCapacity()/1000).append("Wh"));
-    ui->mainBatManufDateValLbl->setText(batgov->mainBat->getManufactureDate());
+    ui->mainBatManufValLbl->setText(b.manufacturer);
+    ui->mainBatModelValLbl->setText(b.model);
+    ui->mainBatTypeValLbl->setText(b.type);
+    ui->mainBatDesVoltValLbl->setText(QString::number((float)b.designVoltage/1000).append("V"));
+    ui->mainBatDesCapValLbl->setText(QString::number((float)b.designCapacity/1000).append("Wh"));
+    ui->mainBatManufDateValLbl->setText(b.manufactureDate);
 
     ui->mainBatChargTreshsStartSpinBox->setValue(batgov->mainBat->getStartChargingTreshold());
     ui->mainBatChargTreshsStopSpinBox->setValue(batgov->mainBat->getStopChargingTreshold());
 }
 
-void MainWindow::mainBatRefreshValues()
+/* Only labels of changed fields are touched */
+
+void MainWindow::mainBatRefreshValues(uint dirty)
 {
-    ui->mainBatStateValLbl->setText(batgov->mainBat->getState());
-    ui->mainBatChargedValLbl->setText(QString::number(batgov->mainBat->getChargeLvl()).append('%'));
+    const BatterySnapshot &b = batgov->mainBat->getSnapshot();
 
-    if (batgov->mainBat->isACConnected()) {
-        ui->mainBatVolatileLbl->setText("Charging time:");
-        if (batgov->mainBat->getChargingTime() == 0)
-            ui->mainBatVolatileValLbl->setText("charged");
-        else
-            ui->mainBatVolatileValLbl->setText(minToHrsAndMin(batgov->mainBat->getChargingTime()));
-    } else {
-        ui->mainBatVolatileLbl->setText("Running time:");
-        ui->mainBatVolatileValLbl->setText(minToHrsAndMin(batgov->mainBat->getRemainingRunningTime()));
+    if (dirty & BAT_STATE)
+        ui->mainBatStateValLbl->setText(b.state);
+    if (dirty & BAT_CHARGE_LVL)
+        ui->mainBatChargedValLbl->setText(QString::number(b.chargeLvl).append('%'));
+
+    if (dirty & (BAT_AC_CONNECTED | BAT_CHARGING_TIME | BAT_RUNNING_TIME)) {
+        if (b.acConnected) {
+            ui->mainBatVolatileLbl->setText("Charging time:");
+            if (b.chargingTime == 0)
+                ui->mainBatVolatileValLbl->setText("charged");
+            else
+                ui->mainBatVolatileValLbl->setText(minToHrsAndMin(b.chargingTime));
+        } else {
+            ui->mainBatVolatileLbl->setText("Running time:");
+            ui->mainBatVolatileValLbl->setText(minToHrsAndMin(b.runningTime));
+        }
     }
 
-    ui->mainBatCyclCountValLbl->setNum(batgov->mainBat->getCyclesCount());
-    ui->mainBatCurVoltValLbl->setText(QString::number((float)batgov->mainBat->getCurrentVoltage()/1000).append("V"));
-    ui->mainBatRemCapValLbl->setText(QString::number((float)batgov->mainBat->getRemainingCapacity()/1000).append("Wh"));
+    if (dirty & BAT_CYCLES)
+        ui->mainBatCyclCountValLbl->setNum(b.cyclesCount);
+    if (dirty & BAT_VOLTAGE)
+        ui->mainBatCurVoltValLbl->setText(QString::number((float)b.voltage/1000).append("V"));
+    if (dirty & BAT_REMAINING_CAP)
+        ui->mainBatRemCapValLbl->setText(QString::number((float)b.remainingCapacity/1000).append("Wh"));
 }
 /*
 void MainWindow::mainBatUpdateState(QString s)
@@ -402,12 +617,7 @@ void MainWindow::mainBatWidgetsState(bool s)
 
 void MainWindow::cpuPolicyChoosed(int p)
 {
-    QStringList alFq = sensorsArray->cpu->getAvailFreq();
-
-    if (p == 0)
-        sensorsArray->cpu->setGovernor("ondemand");
-    else
-        sensorsArray->cpu->setFreq(alFq.at(p-1).toInt());        // -1 for shift index
+    cpufreq->applyProfilePolicy(p);
 
     profiles.at(currentProfile)->setCpuPolicy(p);
 }
@@ -433,7 +643,7 @@ void MainWindow::profileChoosed(int p)
     if (ui->profileChooser->currentIndex() != p)
         ui->profileChooser->setCurrentIndex(p);
 
-    gov->profileChanged(profiles.at(p));
+    emit fanProfileChanged(*profiles.at(p));
 
     this->setCpuPolicy(p);
     if (ui->gpuBox->isEnabled())
@@ -443,14 +653,7 @@ void MainWindow::profileChoosed(int p)
 void MainWindow::setCpuPolicy(int n)
 {
     ui->frequencyBox->setCurrentIndex(profiles.at(n)->getCpuPolicy());
-    if (profiles.at(n)->getCpuPolicy() == 0)
-        sensorsArray->cpu->setGovernor("ondemand");
-    else
-        sensorsArray->cpu->setFreq(sensorsArray->cpu->getAvailFreq().at(profiles.at(n)->getCpuPolicy()-1).toInt());
-                                                                                                        // first get the policy num
-                                                                                                        // from profile then get the
-                                                                                                        // frequency from avail freq list
-                                                                                                        // -1 to remove "ondemand"
+    cpufreq->applyProfilePolicy(profiles.at(n)->getCpuPolicy());
 }
 
 void MainWindow::setGpuPolicy(int n)
@@ -470,20 +673,20 @@ void MainWindow::setWirelessStates()
     if (wan == -1) {
         ui->wanLabel->setEnabled(false);
         ui->wanButton->setEnabled(false);
-    } else if (wan == 1)
-        ui->wanButton->setDown(true);
+    } else
+        ui->wanButton->setDown(wan == 1);
 
     if (uwb == -1) {
         ui->uwbLabel->setEnabled(false);
         ui->uwbButton->setEnabled(false);
-    } else if (uwb == 1)
-        ui->uwbButton->setDown(true);
+    } else
+        ui->uwbButton->setDown(uwb == 1);
 
     if (bt == -1) {
         ui->btLabel->setEnabled(false);
         ui->btButton->setEnabled(false);
-    } else if (bt == 1)
-        ui->btButton->setDown(true);
+    } else
+        ui->btButton->setDown(bt == 1);
 }
 
 void MainWindow::wanBtnSwitched(bool s)
@@ -553,6 +756,33 @@ void MainWindow::initTrayIcon()
     connect(trayIcon, SIGNAL(activated(QSystemTrayIcon::ActivationReason)), this, SLOT(trayIconActivated(QSystemTrayIcon::ActivationReason)));
 }
 
+/* Scheduler lives in sampler thread, its values come with queued signals */
+
+void MainWindow::setWakeupRate(double r)
+{
+    wakeupRate = r;
+    updateTrayToolTip();
+}
+
+void MainWindow::setPowerSaving(bool st)
+{
+    powerSaving = st;
+    updateTrayToolTip();
+}
+
+void MainWindow::updateTrayToolTip()
+{
+    QString s("ThinkControl\n");
+
+    s.append(QString::number(wakeupRate, 'f', 2)).append(" wakeups/s");
+    if (powerSaving)
+        s.append(" (battery saver)");
+    if (daemonLost)
+        s.append("\nthinkctld is not running");
+
+    trayIcon->setToolTip(s);
+}
+
 void MainWindow::trayIconActivated(QSystemTrayIcon::ActivationReason reason)
 {
     switch(reason) {
@@ -617,8 +847,13 @@ void MainWindow::touchpadDialogBtnPressed()
 
 void MainWindow::applyAfterSusped()
 {
+    xinput->begin();
+    tp->applySettings();
     touchpad->applySettings();
-    this->mainBatRefreshValues();
+    xinput->commit();
+
+    if (batgov->isModulePresent())
+        batgov->mainBat->refresh();
 }
 
 QString minToHrsAndMin(int m)
@@ -631,4 +866,26 @@ QString minToHrsAndMin(int m)
     return str;
 }
 
+QString tempToString(int t)
+{
+    if (t == SENSOR_NONE)
+        return "none";
+    else
+        return QString::number(t);
+}
+
+/* Per package and per core values for cpu label tooltip */
 
+QString cpuTempsToString(const CpuTemps *t)
+{
+    QString s;
+
+    for (int i = 0; i < t->packages; i++)
+        if (t->package[i] != SENSOR_NONE)
+            s.append(QString("Package %1: %2\n").arg(i).arg(t->package[i]));
+
+    for (int i = 0; i < t->cores; i++)
+        s.append(QString("Core %1: %2\n").arg(i).arg(tempToString(t->core[i])));
+
+    return s.trimmed();
+}
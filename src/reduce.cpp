@@ -0,0 +1,126 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/reduce.h"
+#include "h/devices.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ZONE_MAX_VALUE 32767
+
+void reduceZones(const int16_t *v, int n, ZoneStats *out)
+{
+    int16_t mn = ZONE_MAX_VALUE;
+    int16_t mx = SENSOR_NONE;           // absent zones can't raise max
+    int32_t sum = 0;
+    int cnt = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i none = _mm_set1_epi16(SENSOR_NONE);
+    const __m128i top = _mm_set1_epi16(ZONE_MAX_VALUE);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i vmin = top;
+    __m128i vmax = none;
+    __m128i vsum = _mm_setzero_si128();
+    __m128i vcnt = _mm_setzero_si128();
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        __m128i absent = _mm_cmpeq_epi16(x, none);
+        __m128i present = _mm_andnot_si128(absent, x);      // absent -> 0
+
+        vmax = _mm_max_epi16(vmax, x);
+        vmin = _mm_min_epi16(vmin, _mm_or_si128(present, _mm_and_si128(absent, top)));
+        vsum = _mm_add_epi32(vsum, _mm_madd_epi16(present, ones));
+        vcnt = _mm_add_epi32(vcnt, _mm_madd_epi16(_mm_andnot_si128(absent, ones), ones));
+    }
+
+    int16_t lmin[8], lmax[8];
+    int32_t lsum[4], lcnt[4];
+
+    _mm_storeu_si128((__m128i *)lmin, vmin);
+    _mm_storeu_si128((__m128i *)lmax, vmax);
+    _mm_storeu_si128((__m128i *)lsum, vsum);
+    _mm_storeu_si128((__m128i *)lcnt, vcnt);
+
+    for (int j = 0; j < 8; j++) {
+        mn = lmin[j] < mn ? lmin[j] : mn;
+        mx = lmax[j] > mx ? lmax[j] : mx;
+    }
+    for (int j = 0; j < 4; j++) {
+        sum += lsum[j];
+        cnt += lcnt[j];
+    }
+#endif
+
+    for (; i < n; i++) {                // scalar tail or fallback
+        if (v[i] == SENSOR_NONE)
+            continue;
+
+        mn = v[i] < mn ? v[i] : mn;
+        mx = v[i] > mx ? v[i] : mx;
+        sum += v[i];
+        cnt++;
+    }
+
+    out->count = cnt;
+    if (cnt) {
+        out->min = mn;
+        out->max = mx;
+        out->mean = sum / cnt;
+    } else {
+        out->min = out->max = out->mean = SENSOR_NONE;
+    }
+}
+
+/*
+ * state += (sample - state) / 2^EWMA_SHIFT in Q8 fixed point. Absent
+ * zone resets its state, so zone which appears starts from its sample.
+ */
+
+void ewmaUpdate(int32_t *state, const int16_t *v, int n)
+{
+    const int32_t noneState = SENSOR_NONE << EWMA_FRAC_BITS;
+
+    for (int i = 0; i < n; i++) {
+        int32_t x = (int32_t)v[i] << EWMA_FRAC_BITS;
+        int32_t next = state[i] + ((x - state[i]) >> EWMA_SHIFT);
+
+        state[i] = (v[i] == SENSOR_NONE || state[i] == noneState) ? x : next;
+    }
+}
+
+/* Largest sample - average difference in whole degrees, 0 if none rises */
+
+int ewmaMaxRise(const int32_t *state, const int16_t *v, int n)
+{
+    int32_t rise = 0;
+
+    for (int i = 0; i < n; i++) {
+        int32_t d = ((int32_t)v[i] << EWMA_FRAC_BITS) - state[i];
+
+        d = v[i] == SENSOR_NONE ? 0 : d;
+        rise = d > rise ? d : rise;
+    }
+
+    return rise >> EWMA_FRAC_BITS;
+}
@@ -0,0 +1,216 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/samplebus.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+SampleBus::SampleBus()
+{
+    head = 0;
+
+    for (int i = 0; i < SAMPLEBUS_RING_SIZE; i++)
+        slot[i].seq = 0;
+
+    for (int i = 0; i < SAMPLEBUS_MAX_SUBSCRIBERS; i++)
+        subscribers[i] = -1;
+
+    clock.start();
+    epoch = QDateTime::currentMSecsSinceEpoch();
+}
+
+void SampleBus::publish(Sample &s)
+{
+    publish(s, clock.elapsed());
+}
+
+/* Timestamps never go back, consumers take differences of them */
+
+void SampleBus::publish(Sample &s, qint64 timestamp)
+{
+    uint64_t h = head;
+    SampleSlot *sl = &slot[h % SAMPLEBUS_RING_SIZE];
+    uint64_t one = 1;
+
+    if (h > 0 && timestamp < slot[(h - 1) % SAMPLEBUS_RING_SIZE].data.timestamp)
+        timestamp = slot[(h - 1) % SAMPLEBUS_RING_SIZE].data.timestamp;
+
+    s.seq = h + 1;
+    s.timestamp = timestamp;
+
+    sl->seq++;                                  // odd - update in progress
+    __sync_synchronize();
+    memcpy(&sl->data, &s, sizeof(Sample));
+    __sync_synchronize();
+    sl->seq++;
+
+    __sync_synchronize();
+    head = h + 1;
+
+    for (int i = 0; i < SAMPLEBUS_MAX_SUBSCRIBERS; i++) {
+        int fd = subscribers[i];
+
+        if (fd != -1 && write(fd, &one, sizeof(one)) != sizeof(one))
+            qDebug() << "Cannot wake sample subscriber";
+    }
+}
+
+bool SampleBus::latest(Sample *out)
+{
+    uint64_t h = head;
+
+    if (h == 0)
+        return false;
+
+    const SampleSlot *sl = &slot[(h - 1) % SAMPLEBUS_RING_SIZE];
+    uint32_t s1, s2;
+
+    do {
+        s1 = sl->seq;
+        __sync_synchronize();
+        memcpy(out, (const void *)&sl->data, sizeof(Sample));
+        __sync_synchronize();
+        s2 = sl->seq;
+    } while ((s1 & 1) || s1 != s2);
+
+    return true;
+}
+
+/* Consumers which need every sample walk seqs up to head with it */
+
+bool SampleBus::get(uint64_t seq, Sample *out)
+{
+    if (seq == 0 || seq > head || head - seq >= SAMPLEBUS_RING_SIZE)
+        return false;
+
+    const SampleSlot *sl = &slot[(seq - 1) % SAMPLEBUS_RING_SIZE];
+    uint32_t s1, s2;
+
+    do {
+        s1 = sl->seq;
+        __sync_synchronize();
+        memcpy(out, (const void *)&sl->data, sizeof(Sample));
+        __sync_synchronize();
+        s2 = sl->seq;
+    } while ((s1 & 1) || s1 != s2);
+
+    return out->seq == seq;                     // producer may have lapped us during copy
+}
+
+uint64_t SampleBus::getHead()
+{
+    return head;
+}
+
+qint64 SampleBus::getEpoch()
+{
+    return epoch;
+}
+
+bool SampleBus::subscribe(int fd)
+{
+    for (int i = 0; i < SAMPLEBUS_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i] == -1) {
+            subscribers[i] = fd;
+            __sync_synchronize();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SampleBus::unsubscribe(int fd)
+{
+    for (int i = 0; i < SAMPLEBUS_MAX_SUBSCRIBERS; i++)
+        if (subscribers[i] == fd)
+            subscribers[i] = -1;
+
+    __sync_synchronize();
+}
+
+SampleSubscriber::SampleSubscriber(SampleBus *b, int minInterval, QObject *parent) :
+    QObject(parent)
+{
+    bus = b;
+    interval = minInterval;
+    lastSeq = 0;
+    notifier = NULL;
+
+    delay = new QTimer(this);
+    delay->setSingleShot(true);
+    connect(delay, SIGNAL(timeout()), this, SLOT(deliver()));
+
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd == -1 || !bus->subscribe(eventFd)) {
+        qDebug() << "Cannot subscribe to samples";
+        return;
+    }
+
+    notifier = new QSocketNotifier(eventFd, QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(wakeup()));
+}
+
+SampleSubscriber::~SampleSubscriber()
+{
+    delete notifier;
+
+    if (eventFd != -1) {
+        bus->unsubscribe(eventFd);
+        close(eventFd);
+    }
+}
+
+bool SampleSubscriber::latest(Sample *out)
+{
+    if (!bus->latest(out) || out->seq == lastSeq)
+        return false;
+
+    lastSeq = out->seq;
+
+    return true;
+}
+
+void SampleSubscriber::wakeup()
+{
+    uint64_t n;
+    qint64 wait = 0;
+
+    if (read(eventFd, &n, sizeof(n)) != sizeof(n))
+        return;
+
+    if (delay->isActive())                      // already waiting for interval
+        return;
+
+    if (interval > 0 && lastReady.isValid())
+        wait = interval - lastReady.elapsed();
+
+    if (wait > 0)
+        delay->start((int)wait);
+    else
+        deliver();
+}
+
+void SampleSubscriber::deliver()
+{
+    lastReady.start();
+    emit sampleReady();
+}
@@ -0,0 +1,257 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "h/scheduler.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+
+#define AC_CONNECTED_PATH "/sys/devices/platform/smapi/ac_connected"
+
+Scheduler::Scheduler(EventLoop *l, SensorsArray *sa, Profile *p)
+{
+    loop = l;
+    snsArray = sa;
+    profile = *p;
+
+    thermalInterval = THERMAL_BASE_INTERVAL;
+    batteryInterval = BATTERY_FAST_INTERVAL;
+    lastCpuTemp = snsArray->cpu->getTemp();
+    stableTicks = 0;
+
+    acFd = open(hwPath(AC_CONNECTED_PATH).toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (acFd == -1) {                           // no tp_smapi, try power_supply
+        QString mains = findMainsSupply();
+        if (!mains.isEmpty())
+            acFd = open(mains.append("/online").toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    }
+    lastACState = acFd == -1 ? -1 : readIntFromFd(acFd);
+
+    acEvents = false;
+    powerSaving = false;
+    wakeupRate = 0;
+    rateWindowStart = 0;
+    rateWindowWakeups = 0;
+
+    clock.start();
+    nextThermal = thermalInterval;
+    nextBattery = batteryInterval;
+
+    timerFd = loop->addTimer(this);
+    if (timerFd == -1)
+        qDebug() << "Cannot create scheduler timer";
+
+    setPowerSaving(lastACState == 0);
+    rearm();
+}
+
+Scheduler::~Scheduler()
+{
+    if (timerFd != -1)
+        loop->removeTimer(timerFd);
+
+    if (acFd != -1)
+        close(acFd);
+}
+
+void Scheduler::profileChanged(const Profile &p)
+{
+    profile = p;
+}
+
+int Scheduler::getThermalInterval()
+{
+    return thermalInterval;
+}
+
+bool Scheduler::isPowerSaving()
+{
+    return powerSaving;
+}
+
+double Scheduler::getWakeupRate()
+{
+    return wakeupRate;
+}
+
+void Scheduler::handleEvent(int, uint32_t)
+{
+    qint64 now = clock.elapsed();
+    qint64 window = powerSaving ? SAVER_COALESCE_WINDOW : 0;
+
+    if (now + window >= nextThermal) {
+        nextThermal = now + thermalInterval;
+        emit thermalTick();                     // thermalUpdated() adjusts interval
+        if (!acEvents)
+            checkACState();
+    }
+
+    if (now + window >= nextBattery) {
+        if (batteryInterval < BATTERY_SLOW_INTERVAL)
+            batteryInterval = qMin(batteryInterval*2, BATTERY_SLOW_INTERVAL);
+
+        nextBattery = now + batteryInterval;
+        emit batteryTick();
+    }
+
+    updateWakeupRate(now);
+    rearm();
+}
+
+/* Called after every thermal sampling to pick the next interval */
+
+void Scheduler::thermalUpdated()
+{
+    int cpuTemp = snsArray->cpu->getTemp();
+    int interval;
+
+    if (cpuTemp > lastCpuTemp || snsArray->getMaxRise() >= THERMAL_RISE_DEGREES || isNearThreshold()) {
+        interval = THERMAL_FAST_INTERVAL;
+        stableTicks = 0;
+    } else if (cpuTemp < lastCpuTemp) {
+        interval = THERMAL_BASE_INTERVAL;
+        stableTicks = 0;
+    } else if (++stableTicks >= THERMAL_STABLE_TICKS) {
+        interval = qMin(qMax(thermalInterval, THERMAL_BASE_INTERVAL)*2, THERMAL_SLOW_INTERVAL);
+        stableTicks = 0;
+    } else {
+        interval = qMax(thermalInterval, THERMAL_BASE_INTERVAL);
+    }
+
+    lastCpuTemp = cpuTemp;
+
+    if (powerSaving)
+        interval = qMax(interval, SAVER_THERMAL_MIN_INTERVAL);
+
+    if (interval != thermalInterval) {
+        thermalInterval = interval;
+        nextThermal = clock.elapsed() + thermalInterval;
+        rearm();
+    }
+}
+
+bool Scheduler::isNearThreshold()
+{
+    if (profile.isPidControl())
+        return qAbs(snsArray->cpu->getTemp() - profile.getTargetTemp()) <= THERMAL_NEAR_DEGREES;
+
+    return profile.getCpuCurve()->isNear(snsArray->cpu->getTemp(), THERMAL_NEAR_DEGREES) ||
+            profile.getGpuCurve()->isNear(snsArray->gpu->getTemp(), THERMAL_NEAR_DEGREES) ||
+            profile.getMchCurve()->isNear(snsArray->mch->getTemp(), THERMAL_NEAR_DEGREES);
+}
+
+void Scheduler::setACEvents(bool st)
+{
+    acEvents = st;
+}
+
+/* AC plug or unplug makes battery sampling due immediately */
+
+void Scheduler::checkACState()
+{
+    if (acFd == -1)
+        return;
+
+    int st = readIntFromFd(acFd);
+
+    if (st != lastACState)
+        acChanged(st);
+}
+
+void Scheduler::acChanged(bool online)
+{
+    lastACState = online;
+    setPowerSaving(!online);
+    batteryDue();
+}
+
+/*
+ * Any power_supply event may be the adapter: older kernels don't put
+ * TYPE into uevents, and lost events are resynchronized with this too.
+ */
+
+void Scheduler::powerSupplyChanged()
+{
+    checkACState();
+    batteryDue();
+}
+
+void Scheduler::batteryDue()
+{
+    batteryInterval = BATTERY_FAST_INTERVAL;
+    nextBattery = clock.elapsed();
+    rearm();
+}
+
+/* Trip point crossed, thermalUpdated() backs off again from there */
+
+void Scheduler::thermalChanged()
+{
+    thermalInterval = THERMAL_FAST_INTERVAL;
+    nextThermal = clock.elapsed();
+    rearm();
+}
+
+void Scheduler::setPowerSaving(bool st)
+{
+    if (st == powerSaving)
+        return;
+
+    powerSaving = st;
+    applyTimerSlack();
+
+    if (st && thermalInterval < SAVER_THERMAL_MIN_INTERVAL)
+        thermalInterval = SAVER_THERMAL_MIN_INTERVAL;
+
+    emit powerSavingChanged(st);
+}
+
+/* Slack of 0 restores default value of the thread */
+
+void Scheduler::applyTimerSlack()
+{
+    prctl(PR_SET_TIMERSLACK, powerSaving ? SAVER_TIMER_SLACK : 0, 0, 0, 0);
+}
+
+/* Every scheduler wakeup is a process wakeup, count them per window */
+
+void Scheduler::updateWakeupRate(qint64 now)
+{
+    rateWindowWakeups++;
+
+    if (now - rateWindowStart >= WAKEUP_RATE_WINDOW) {
+        wakeupRate = rateWindowWakeups * 1000.0 / (now - rateWindowStart);
+        rateWindowStart = now;
+        rateWindowWakeups = 0;
+
+        emit wakeupRateUpdated(wakeupRate);
+    }
+}
+
+void Scheduler::rearm()
+{
+    qint64 first = qMin(nextThermal, nextBattery);
+    qint64 last = qMax(nextThermal, nextBattery);
+
+    if (powerSaving && last - first <= SAVER_COALESCE_WINDOW)
+        first = last;                           // delay earlier source, one wakeup for both
+
+    qint64 next = first - clock.elapsed();
+
+    if (timerFd != -1)
+        loop->setTimer(timerFd, next > 0 ? (int)next : 1, false);   // 0 would disarm
+}
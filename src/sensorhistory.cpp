@@ -0,0 +1,281 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/sensorhistory.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QDir>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+static const int64_t tierPeriods[HISTORY_TIERS] = { 10000, 60000, 600000 };
+
+SensorHistory::SensorHistory(SampleBus *b, const QString &path, QObject *parent) :
+    QObject(parent)
+{
+    bus = b;
+    fd = -1;
+    data = NULL;
+    lastSeq = bus->getHead();
+
+    if (!map(path)) {
+        qDebug() << "Sensor history won't be kept across restarts";
+        void *p = mmap(NULL, sizeof(HistoryData), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        data = p == MAP_FAILED ? NULL : (HistoryData *)p;
+    }
+
+    if (data == NULL) {
+        qDebug() << "Cannot allocate sensor history";
+        samples = NULL;
+        return;
+    }
+
+    if (data->magic != HISTORY_MAGIC || data->version != HISTORY_VERSION || data->size != sizeof(HistoryData))
+        reset();
+
+    samples = new SampleSubscriber(bus, 0, this);
+    connect(samples, SIGNAL(sampleReady()), this, SLOT(drain()));
+}
+
+SensorHistory::~SensorHistory()
+{
+    if (data != NULL) {
+        sync();
+        munmap(data, sizeof(HistoryData));
+    }
+
+    if (fd != -1)
+        close(fd);
+}
+
+bool SensorHistory::map(const QString &path)
+{
+    if (path.isEmpty() || !QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+
+    fd = open(path.toLocal8Bit().constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        qDebug() << "Cannot open" << path;
+        return false;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {          // another process keeps it
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(HistoryData)) == 0) {
+        void *p = mmap(NULL, sizeof(HistoryData), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            data = (HistoryData *)p;
+    }
+
+    if (data == NULL) {
+        qDebug() << "Cannot map" << path;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void SensorHistory::reset()
+{
+    memset(data, 0, sizeof(HistoryData));
+
+    for (int i = 0; i < HISTORY_TIERS; i++)
+        data->tier[i].period = tierPeriods[i];
+
+    data->version = HISTORY_VERSION;
+    data->size = sizeof(HistoryData);
+    data->magic = HISTORY_MAGIC;
+}
+
+bool SensorHistory::isPersistent()
+{
+    return fd != -1;
+}
+
+/* Written back by kernel anyway, this only makes sure it's on disk at exit */
+
+void SensorHistory::sync()
+{
+    if (fd != -1 && msync(data, sizeof(HistoryData), MS_SYNC) == -1)
+        qDebug() << "Cannot sync sensor history";
+}
+
+/*
+ * Takes every sample published since last wakeup. Those which already
+ * fell out of bus ring are lost, tiers just get fewer samples then.
+ */
+
+void SensorHistory::drain()
+{
+    uint64_t head = bus->getHead();
+    bool added = false;
+    Sample s;
+
+    if (head - lastSeq > SAMPLEBUS_RING_SIZE)
+        lastSeq = head - SAMPLEBUS_RING_SIZE;
+
+    for (uint64_t seq = lastSeq + 1; seq <= head; seq++) {
+        if (bus->get(seq, &s)) {
+            append(s);
+            added = true;
+        }
+    }
+
+    lastSeq = head;
+
+    if (added)
+        emit appended();
+}
+
+void SensorHistory::append(const Sample &s)
+{
+    HistoryPoint &p = data->raw[data->head % HISTORY_RAW_SIZE];
+
+    p.time = bus->getEpoch() + s.timestamp;
+    for (int i = 0; i < THERMAL_SLOTS; i++)
+        p.value[i] = s.thermal[i];
+    p.value[HISTORY_FAN] = s.fanSpeed < 0 ? SENSOR_NONE : s.fanSpeed > 32767 ? 32767 : (int16_t)s.fanSpeed;
+    p.pad = 0;
+
+    __sync_synchronize();                       // point is complete before it's counted
+    data->head++;
+
+    for (int i = 0; i < HISTORY_TIERS; i++)
+        accumulate(&data->tier[i], p);
+}
+
+/* Each tier is fed from raw points, so means are exact and not averaged twice */
+
+void SensorHistory::accumulate(HistoryTier *t, const HistoryPoint &p)
+{
+    HistoryAccum &a = t->acc;
+    int64_t start = p.time - p.time % t->period;
+
+    if (a.count > 0 && a.time != start)
+        closeBucket(t);
+
+    if (a.count == 0) {
+        a.time = start;
+        for (int i = 0; i < HISTORY_CHANNELS; i++) {
+            a.valid[i] = 0;
+            a.sum[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < HISTORY_CHANNELS; i++) {
+        int16_t v = p.value[i];
+
+        if (v == SENSOR_NONE)
+            continue;
+
+        if (a.valid[i] == 0 || v < a.min[i])
+            a.min[i] = v;
+        if (a.valid[i] == 0 || v > a.max[i])
+            a.max[i] = v;
+        a.sum[i] += v;
+        a.valid[i]++;
+    }
+
+    a.count++;
+}
+
+void SensorHistory::closeBucket(HistoryTier *t)
+{
+    HistoryAccum &a = t->acc;
+    HistoryBucket &b = t->bucket[t->head % HISTORY_TIER_SIZE];
+
+    b.time = a.time;
+    b.count = a.count;
+    b.pad = 0;
+
+    for (int i = 0; i < HISTORY_CHANNELS; i++) {
+        if (a.valid[i] == 0) {
+            b.stat[i].min = b.stat[i].max = b.stat[i].mean = SENSOR_NONE;
+        } else {
+            b.stat[i].min = a.min[i];
+            b.stat[i].max = a.max[i];
+            b.stat[i].mean = (int16_t)((a.sum[i] + a.valid[i] / 2) / a.valid[i]);
+        }
+    }
+
+    __sync_synchronize();
+    t->head++;
+    a.count = 0;
+}
+
+uint64_t SensorHistory::getHead()
+{
+    return data == NULL ? 0 : data->head;
+}
+
+int SensorHistory::getRaw(HistoryPoint *out, int n)
+{
+    uint64_t head = getHead();
+    int count = 0;
+
+    while (count < n && count < HISTORY_RAW_SIZE && (uint64_t)count < head) {
+        out[count] = data->raw[(head - 1 - count) % HISTORY_RAW_SIZE];
+        count++;
+    }
+
+    return count;
+}
+
+bool SensorHistory::getRawAt(uint64_t n, HistoryPoint *out)
+{
+    uint64_t head = getHead();
+
+    if (n == 0 || n > head || head - n >= HISTORY_RAW_SIZE)
+        return false;
+
+    *out = data->raw[(n - 1) % HISTORY_RAW_SIZE];
+    return true;
+}
+
+int SensorHistory::getBuckets(int tier, HistoryBucket *out, int n)
+{
+    if (data == NULL || tier < 0 || tier >= HISTORY_TIERS)
+        return 0;
+
+    const HistoryTier &t = data->tier[tier];
+    int count = 0;
+
+    while (count < n && count < HISTORY_TIER_SIZE && (uint64_t)count < t.head) {
+        out[count] = t.bucket[(t.head - 1 - count) % HISTORY_TIER_SIZE];
+        count++;
+    }
+
+    return count;
+}
+
+int64_t SensorHistory::getPeriod(int tier)
+{
+    return tier >= 0 && tier < HISTORY_TIERS ? tierPeriods[tier] : 0;
+}
@@ -20,6 +20,15 @@
 #include "h/settings.h"
 #include <QDebug>
 
+/* Built-in thresholds are checked at compile time, loaded ones in loadProfiles() */
+
+#define SET_TRIPLET(p, Sensor, min, mid, max, td) do { \
+        FAN_STATIC_ASSERT(FAN_TRIPLET_VALID(min, mid, max, td), Sensor##TripletValid) __attribute__((unused)); \
+        p->set##Sensor##Min(min); \
+        p->set##Sensor##Mid(mid); \
+        p->set##Sensor##Max(max); \
+    } while (0)
+
 
 QString Profile::getName() { return name; }
 int Profile::getCpuMin() { return cpuMin; }
@@ -35,21 +44,74 @@ int Profile::getTreshold() { return treshold; }
 int Profile::getGpuMethod() { return gpuMethod; }
 int Profile::getGpuProfile() { return gpuProfile; }
 int Profile::getCpuPolicy() { return cpuPolicy; }
+bool Profile::isPidControl() { return pidControl; }
+int Profile::getTargetTemp() { return targetTemp; }
 
 void Profile::setName(QString s) { name = s; }
-void Profile::setCpuMin(int n) { cpuMin = n; }
-void Profile::setCpuMid(int n) { cpuMid = n; }
-void Profile::setCpuMax(int n) { cpuMax = n; }
-void Profile::setGpuMin(int n) { gpuMin = n; }
-void Profile::setGpuMid(int n) { gpuMid = n; }
-void Profile::setGpuMax(int n) { gpuMax = n; }
-void Profile::setMchMin(int n) { mchMin = n; }
-void Profile::setMchMid(int n) { mchMid = n; }
-void Profile::setMchMax(int n) { mchMax = n; }
-void Profile::setTreshold(int n) { treshold = n; }
+void Profile::setCpuMin(int n) { if (n != cpuMin) cpuCurveStale = true; cpuMin = n; }
+void Profile::setCpuMid(int n) { if (n != cpuMid) cpuCurveStale = true; cpuMid = n; }
+void Profile::setCpuMax(int n) { if (n != cpuMax) cpuCurveStale = true; cpuMax = n; }
+void Profile::setGpuMin(int n) { if (n != gpuMin) gpuCurveStale = true; gpuMin = n; }
+void Profile::setGpuMid(int n) { if (n != gpuMid) gpuCurveStale = true; gpuMid = n; }
+void Profile::setGpuMax(int n) { if (n != gpuMax) gpuCurveStale = true; gpuMax = n; }
+void Profile::setMchMin(int n) { if (n != mchMin) mchCurveStale = true; mchMin = n; }
+void Profile::setMchMid(int n) { if (n != mchMid) mchCurveStale = true; mchMid = n; }
+void Profile::setMchMax(int n) { if (n != mchMax) mchCurveStale = true; mchMax = n; }
 void Profile::setGpuMethod(int n) { gpuMethod = n; }
 void Profile::setGpuProfile(int n) { gpuProfile = n; }
 void Profile::setCpuPolicy(int n) { cpuPolicy = n; }
+void Profile::setPidControl(bool st) { pidControl = st; }
+void Profile::setTargetTemp(int n) { targetTemp = n; }
+
+Profile::Profile()
+{
+    cpuMin = cpuMid = cpuMax = 0;
+    gpuMin = gpuMid = gpuMax = 0;
+    mchMin = mchMid = mchMax = 0;
+    treshold = 0;
+    gpuMethod = gpuProfile = cpuPolicy = 0;
+    pidControl = false;
+    targetTemp = 65;
+
+    cpuCurveStale = gpuCurveStale = mchCurveStale = false;     // default curves until triplets are set
+}
+
+FanCurve *Profile::getCpuCurve() { return curve(&cpuCurve, &cpuCurveStale, cpuMin, cpuMid, cpuMax); }
+FanCurve *Profile::getGpuCurve() { return curve(&gpuCurve, &gpuCurveStale, gpuMin, gpuMid, gpuMax); }
+FanCurve *Profile::getMchCurve() { return curve(&mchCurve, &mchCurveStale, mchMin, mchMid, mchMax); }
+
+/* Stale curves take it when they are rebuilt from triplet */
+
+void Profile::setTreshold(int n)
+{
+    treshold = n;
+
+    if (!cpuCurveStale)
+        cpuCurve.setHysteresis(n);
+    if (!gpuCurveStale)
+        gpuCurve.setHysteresis(n);
+    if (!mchCurveStale)
+        mchCurve.setHysteresis(n);
+}
+
+void Profile::setCpuCurve(const FanCurve &c) { cpuCurve = c; cpuCurveStale = false; }
+void Profile::setGpuCurve(const FanCurve &c) { gpuCurve = c; gpuCurveStale = false; }
+void Profile::setMchCurve(const FanCurve &c) { mchCurve = c; mchCurveStale = false; }
+
+/* Rebuild curve from triplet if it was changed, keep old curve if triplet is wrong */
+
+FanCurve *Profile::curve(FanCurve *c, bool *stale, int min, int mid, int max)
+{
+    if (*stale) {
+        QString err;
+
+        if (!c->setTriplet(min, mid, max, treshold, &err))
+            qDebug() << "Profile" << name << "thresholds" << min << mid << max << "rejected:" << err;
+        *stale = false;
+    }
+
+    return c;
+}
 
 ProfileList::ProfileList()
 {
@@ -77,22 +139,15 @@ void ProfileList::addProfile(QString name)
 
     profile->setName(name);
 
-    profile->setCpuMin(50);
-    profile->setCpuMid(60);
-    profile->setCpuMax(70);
-
-    profile->setGpuMin(60);
-    profile->setGpuMid(70);
-    profile->setGpuMax(80);
-
-    profile->setMchMin(50);
-    profile->setMchMid(60);
-    profile->setMchMax(70);
-
+    SET_TRIPLET(profile, Cpu, 50, 60, 70, 3);
+    SET_TRIPLET(profile, Gpu, 60, 70, 80, 3);
+    SET_TRIPLET(profile, Mch, 50, 60, 70, 3);
     profile->setTreshold(3);
     profile->setCpuPolicy(0);
     profile->setGpuMethod(1);
     profile->setGpuProfile(3);
+    profile->setPidControl(false);
+    profile->setTargetTemp(65);
 
     this->append(profile);
 }
@@ -111,45 +166,48 @@ void ProfileList::addInitialProfiles()
 
     performance->setName("Performance");
 
-    performance->setCpuMin(50);
-    performance->setCpuMid(60);
-    performance->setCpuMax(70);
-    performance->setGpuMin(60);
-    performance->setGpuMid(70);
-    performance->setGpuMax(80);
-    performance->setMchMin(50);
-    performance->setMchMid(60);
-    performance->setMchMax(70);
+    SET_TRIPLET(performance, Cpu, 50, 60, 70, 3);
+    SET_TRIPLET(performance, Gpu, 60, 70, 80, 3);
+    SET_TRIPLET(performance, Mch, 50, 60, 70, 3);
     performance->setTreshold(3);
 
     performance->setCpuPolicy(0);
     performance->setGpuMethod(1);
     performance->setGpuProfile(3);
+    performance->setPidControl(false);
+    performance->setTargetTemp(60);
 
 
     Profile *silent = new Profile;
 
     silent->setName("Silent");
 
-    silent->setCpuMin(65);
-    silent->setCpuMid(75);
-    silent->setCpuMax(85);
-    silent->setGpuMin(65);
-    silent->setGpuMid(75);
-    silent->setGpuMax(85);
-    silent->setMchMin(65);
-    silent->setMchMid(75);
-    silent->setMchMax(85);
+    SET_TRIPLET(silent, Cpu, 65, 75, 85, 3);
+    SET_TRIPLET(silent, Gpu, 65, 75, 85, 3);
+    SET_TRIPLET(silent, Mch, 65, 75, 85, 3);
     silent->setTreshold(3);
 
     silent->setCpuPolicy(3);
     silent->setGpuMethod(1);
     silent->setGpuProfile(2);
+    silent->setPidControl(false);
+    silent->setTargetTemp(75);
 
     this->append(performance);
     this->append(silent);
 }
 
+/* Curve from "<sensor>_curve" key, or from old min/mid/max triplet */
+
+static bool loadCurve(QSettings *s, const QString &sensor, int td, FanCurve *c, QString *err)
+{
+    if (s->contains(sensor + "_curve"))
+        return c->fromString(s->value(sensor + "_curve").toString(), td, err);
+
+    return c->setTriplet(s->value(sensor + "_min").toInt(), s->value(sensor + "_mid").toInt(),
+                         s->value(sensor + "_max").toInt(), td, err);
+}
+
 void ProfileList::loadProfiles()
 {
     currentProfile = settings->value("selected_profile").toInt();
@@ -175,12 +233,36 @@ void ProfileList::loadProfiles()
         p->setCpuPolicy(settings->value("cpu_policy").toInt());
         p->setGpuMethod(settings->value("gpu_method").toInt());
         p->setGpuProfile(settings->value("gpu_profile").toInt());
+        p->setPidControl(settings->value("pid_control", false).toBool());
+        p->setTargetTemp(settings->value("target_temp", 65).toInt());
+
+        FanCurve cpuCurve, gpuCurve, mchCurve;
+        QString err;
+
+        /* Profile with a broken curve is kept, that curve is built from triplet */
+        if (loadCurve(settings, "cpu", p->getTreshold(), &cpuCurve, &err))
+            p->setCpuCurve(cpuCurve);
+        else
+            qDebug() << "Profile" << p->getName() << "cpu curve rejected:" << err;
+        if (loadCurve(settings, "gpu", p->getTreshold(), &gpuCurve, &err))
+            p->setGpuCurve(gpuCurve);
+        else
+            qDebug() << "Profile" << p->getName() << "gpu curve rejected:" << err;
+        if (loadCurve(settings, "mch", p->getTreshold(), &mchCurve, &err))
+            p->setMchCurve(mchCurve);
+        else
+            qDebug() << "Profile" << p->getName() << "mch curve rejected:" << err;
 
         this->append(p);
     }
 
     settings->endArray();
     settings->endGroup();
+
+    if (this->isEmpty())
+        addInitialProfiles();
+    else if (currentProfile >= this->size())
+        currentProfile = 0;
 }
 
 void ProfileList::saveProfiles()
@@ -208,6 +290,12 @@ void ProfileList::saveProfiles()
         settings->setValue("cpu_policy", this->at(i)->getCpuPolicy());
         settings->setValue("gpu_method", this->at(i)->getGpuMethod());
         settings->setValue("gpu_profile", this->at(i)->getGpuProfile());
+        settings->setValue("pid_control", this->at(i)->isPidControl());
+        settings->setValue("target_temp", this->at(i)->getTargetTemp());
+
+        settings->setValue("cpu_curve", this->at(i)->getCpuCurve()->toString());
+        settings->setValue("gpu_curve", this->at(i)->getGpuCurve()->toString());
+        settings->setValue("mch_curve", this->at(i)->getMchCurve()->toString());
     }
 
     settings->endArray();
@@ -0,0 +1,417 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/simulator.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include <stdio.h>
+
+#define SIM_BAT_DESIGN_CAPACITY 57720       // mWh
+#define SIM_BAT_VOLTAGE 11100               // mV
+#define SIM_BASE_POWER 6.0                  // W drawn by the rest of machine
+#define SIM_CHARGE_POWER 30.0
+
+#define SMAPI "/sys/devices/platform/smapi"
+#define HWMON "/sys/class/hwmon/hwmon0"
+
+Simulator::Simulator(const QString &r)
+{
+    root = r;
+
+    capacity = 60;
+    passive = 0.5;
+    ambient = 25;
+    for (int i = 0; i < SIM_FAN_LEVELS; i++)
+        fanCooling[i] = 0.2 * i;
+
+    time = 0;
+    duration = 0;
+    lastLog = -1;
+    speedup = 1;
+    log = false;
+
+    cpuTemp = ambient;
+    fanLevel = 0;
+    fanMode = "auto";
+    watchdog = 0;
+    lastCommand = 0;
+    acConnected = true;
+    batCapacity = SIM_BAT_DESIGN_CAPACITY * 0.8;
+    busyJiffies = 0;
+    idleJiffies = 0;
+
+    connect(&timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+bool Simulator::loadScript(const QString &file)
+{
+    QFile f(file);
+    QTextStream ts(&f);
+
+    if (!f.open(QIODevice::ReadOnly)) {
+        qDebug() << "Cannot open" << file;
+        return false;
+    }
+
+    heat.clear();
+    ac.clear();
+
+    while (!ts.atEnd()) {
+        QStringList w = ts.readLine().section('#', 0, 0).split(' ', QString::SkipEmptyParts);
+
+        if (w.isEmpty())
+            continue;
+
+        if (w.at(0) == "ac" && w.size() == 3) {
+            ACStep s;
+            s.time = w.at(1).toDouble();
+            s.connected = w.at(2).toInt();
+            ac.append(s);
+        } else if (w.at(0) == "ambient" && w.size() == 2) {
+            ambient = w.at(1).toDouble();
+            cpuTemp = ambient;
+        } else if (w.at(0) == "capacity" && w.size() == 2) {
+            capacity = w.at(1).toDouble();
+        } else if (w.at(0) == "passive" && w.size() == 2) {
+            passive = w.at(1).toDouble();
+        } else if (w.at(0) == "fan" && w.size() == 3) {
+            int l = w.at(1).toInt();
+            if (l >= 0 && l < SIM_FAN_LEVELS)
+                fanCooling[l] = w.at(2).toDouble();
+        } else if (w.size() == 2) {
+            HeatStep s;
+            s.time = w.at(0).toDouble();
+            s.power = w.at(1).toDouble();
+            heat.append(s);
+        } else {
+            qDebug() << "Wrong script line:" << w.join(" ");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Static files first, then the first set of dynamic values */
+
+bool Simulator::createTree()
+{
+    QDir d;
+    bool ok = true;
+    QString freqs;
+
+    ok &= d.mkpath(path("/proc/acpi/ibm"));
+    ok &= d.mkpath(path(HWMON));
+    ok &= d.mkpath(path(SMAPI "/BAT0"));
+    ok &= d.mkpath(path("/var/run"));
+
+    for (int f = SIM_MAX_FREQ; f >= SIM_MIN_FREQ; f -= 400000)
+        freqs.append(QString::number(f)).append(' ');
+
+    ok &= writeFile("/proc/modules", "thinkpad_acpi 69747 0 - Live 0x0000000000000000\n"
+                    "tp_smapi 13012 0 - Live 0x0000000000000000\n");
+    ok &= writeFile("/proc/acpi/ibm/bluetooth", "status:\t\tenabled\n");
+    ok &= writeFile("/sys/devices/system/cpu/online", QString("0-%1").arg(SIM_THREADS - 1));
+    ok &= writeFile("/sys/devices/system/cpu/present", QString("0-%1").arg(SIM_THREADS - 1));
+
+    for (int i = 0; i < SIM_THREADS; i++) {
+        QString cpu = QString("/sys/devices/system/cpu/cpu%1").arg(i);
+
+        ok &= d.mkpath(path(cpu + "/topology"));
+        ok &= d.mkpath(path(cpu + "/cpufreq"));
+        ok &= writeFile(cpu + "/topology/physical_package_id", "0");
+        ok &= writeFile(cpu + "/topology/core_id", QString::number(i / 2));
+        ok &= writeFile(cpu + "/cpufreq/scaling_governor", "ondemand");
+        ok &= writeFile(cpu + "/cpufreq/scaling_setspeed", "<unsupported>");
+        ok &= writeFile(cpu + "/cpufreq/scaling_min_freq", QString::number(SIM_MIN_FREQ));
+        ok &= writeFile(cpu + "/cpufreq/scaling_max_freq", QString::number(SIM_MAX_FREQ));
+        ok &= writeFile(cpu + "/cpufreq/cpuinfo_min_freq", QString::number(SIM_MIN_FREQ));
+        ok &= writeFile(cpu + "/cpufreq/cpuinfo_max_freq", QString::number(SIM_MAX_FREQ));
+        ok &= writeFile(cpu + "/cpufreq/cpuinfo_cur_freq", QString::number(SIM_MAX_FREQ));
+        ok &= writeFile(cpu + "/cpufreq/scaling_available_frequencies", freqs.trimmed());
+    }
+
+    ok &= writeFile(HWMON "/name", "coretemp");
+    ok &= writeFile(HWMON "/temp1_label", "Package id 0");
+    for (int i = 0; i < SIM_THREADS / 2; i++)
+        ok &= writeFile(QString(HWMON "/temp%1_label").arg(i + 2), QString("Core %1").arg(i));
+
+    ok &= writeFile(SMAPI "/BAT0/installed", "1");
+    ok &= writeFile(SMAPI "/BAT0/manufacturer", "SANYO");
+    ok &= writeFile(SMAPI "/BAT0/model", "42T4511");
+    ok &= writeFile(SMAPI "/BAT0/chemistry", "LION");
+    ok &= writeFile(SMAPI "/BAT0/design_capacity", QString::number(SIM_BAT_DESIGN_CAPACITY));
+    ok &= writeFile(SMAPI "/BAT0/design_voltage", "10800");
+    ok &= writeFile(SMAPI "/BAT0/manufacture_date", "2011-09-01");
+    ok &= writeFile(SMAPI "/BAT0/first_use_date", "2011-11-12");
+    ok &= writeFile(SMAPI "/BAT0/cycle_count", "112");
+    ok &= writeFile(SMAPI "/BAT0/last_full_capacity", QString::number((int)(SIM_BAT_DESIGN_CAPACITY * 0.85)));
+    ok &= writeFile(SMAPI "/BAT0/start_charge_thresh", "40");
+    ok &= writeFile(SMAPI "/BAT0/stop_charge_thresh", "85");
+
+    ok &= writeFile("/proc/acpi/ibm/fan", "");
+    writeValues();
+
+    if (!ok)
+        qDebug() << "Cannot create simulator tree in" << root;
+
+    return ok;
+}
+
+void Simulator::setSpeedup(int n)
+{
+    speedup = n > 0 ? n : 1;
+}
+
+void Simulator::setDuration(double s)
+{
+    duration = s;
+}
+
+void Simulator::setLog(bool s)
+{
+    log = s;
+}
+
+double Simulator::getTime()
+{
+    return time;
+}
+
+double Simulator::getCpuTemp()
+{
+    return cpuTemp;
+}
+
+int Simulator::getFanLevel()
+{
+    return fanLevel;
+}
+
+void Simulator::start()
+{
+    timer.start(SIM_TICK);
+}
+
+void Simulator::tick()
+{
+    step(SIM_TICK / 1000.0 * speedup);
+
+    if (duration > 0 && time >= duration) {
+        timer.stop();
+        emit finished();
+    }
+}
+
+void Simulator::step(double dt)
+{
+    readFanCommand();
+
+    if (watchdog > 0 && fanMode != "auto" && (time - lastCommand) / speedup > watchdog) {
+        qDebug() << "Fan watchdog expired at" << time << "s";
+        fanMode = "auto";
+    }
+
+    if (fanMode == "auto")                          // firmware: ramp from 45 to 80 C
+        fanLevel = qBound(0, (int)((cpuTemp - 45) / 5), SIM_FAN_LEVELS - 1);
+    else if (fanMode == "full-speed")
+        fanLevel = SIM_FAN_LEVELS - 1;
+    else
+        fanLevel = qBound(0, fanMode.toInt(), SIM_FAN_LEVELS - 1);
+
+    double power = heatAt(time) * freqScale();
+    double cooling = passive + fanCooling[fanLevel] * (fanMode == "full-speed" ? 1.2 : 1.0);
+
+    cpuTemp += dt * (power - cooling * (cpuTemp - ambient)) / capacity;
+
+    acConnected = acAt(time);
+    if (acConnected)
+        batCapacity += dt * SIM_CHARGE_POWER * 1000 / 3600;
+    else
+        batCapacity -= dt * (power + SIM_BASE_POWER) * 1000 / 3600;
+    batCapacity = qBound(0.0, batCapacity, SIM_BAT_DESIGN_CAPACITY * 0.85);
+
+    double load = qBound(0.0, heatAt(time) / SIM_FULL_LOAD_POWER, 1.0);
+    busyJiffies += dt * 100 * SIM_THREADS * load;
+    idleJiffies += dt * 100 * SIM_THREADS * (1 - load);
+
+    time += dt;
+    writeValues();
+
+    if (log && time - lastLog >= 1) {
+        printf("%.1f %.2f %d %s\n", time, cpuTemp, fanLevel, fanMode.toLocal8Bit().constData());
+        fflush(stdout);
+        lastLog = time;
+    }
+}
+
+double Simulator::heatAt(double t)
+{
+    double p = 10;
+
+    for (int i = 0; i < heat.size() && heat.at(i).time <= t; i++)
+        p = heat.at(i).power;
+
+    return p;
+}
+
+bool Simulator::acAt(double t)
+{
+    bool c = true;
+
+    for (int i = 0; i < ac.size() && ac.at(i).time <= t; i++)
+        c = ac.at(i).connected;
+
+    return c;
+}
+
+/* Dynamic power goes down with frequency set through userspace governor */
+
+double Simulator::freqScale()
+{
+    QString cpu0("/sys/devices/system/cpu/cpu0/cpufreq/");
+
+    if (readFile(cpu0 + "scaling_governor") != "userspace")
+        return 1.0;
+
+    int f = readFile(cpu0 + "scaling_setspeed").toInt();
+
+    return f > 0 ? (double)f / SIM_MAX_FREQ : 1.0;
+}
+
+/*
+ * Fan class writes "level <n>" at offset 0 over the status text, so the
+ * command is followed by leftovers of it. File is rewritten in
+ * writeValues() without replacing the inode, held descriptors stay valid.
+ */
+
+void Simulator::readFanCommand()
+{
+    QString s;
+    QFile f(path("/proc/acpi/ibm/fan"));
+
+    if (f.open(QIODevice::ReadOnly))
+        s = QString(f.readAll());
+
+    if (s.startsWith("status:"))                   // nothing written since last step
+        return;
+    lastCommand = time;
+
+    if (s.startsWith("watchdog ")) {
+        int n = 9;
+        while (n < s.size() && s.at(n).isDigit())     // followed by status leftovers
+            n++;
+        watchdog = s.mid(9, n - 9).toInt();
+        return;
+    }
+
+    int i = s.lastIndexOf("level ");
+    if (i == -1)
+        return;
+
+    QString cmd = s.mid(i + 6).section('\n', 0, 0).section(' ', 0, 0).trimmed();
+
+    if (cmd.startsWith("auto"))
+        fanMode = "auto";
+    else if (cmd.startsWith("full-speed") || cmd.startsWith("disengaged"))
+        fanMode = "full-speed";
+    else if (!cmd.isEmpty() && cmd.at(0).isDigit())
+        fanMode = QString::number(cmd.left(1).toInt());
+}
+
+void Simulator::writeValues()
+{
+    int t = (int)cpuTemp;
+    int rise = t - (int)ambient;
+    QString therm("temperatures:\t");
+    int vals[16];
+
+    for (int i = 0; i < 16; i++)
+        vals[i] = -128;
+    vals[0] = t;                                    // CPU
+    vals[1] = (int)ambient + rise * 3 / 10;         // APS
+    vals[3] = (int)ambient + rise * 8 / 10;         // GPU
+    vals[4] = (int)ambient + 5 + rise / 5;          // main battery
+    vals[6] = vals[4];
+    vals[8] = (int)ambient + rise * 7 / 10;         // MCH
+    vals[9] = (int)ambient + rise / 2;              // ICH
+
+    for (int i = 0; i < 16; i++)
+        therm.append(QString::number(vals[i])).append(i < 15 ? " " : "\n");
+    writeFile("/proc/acpi/ibm/thermal", therm);
+
+    QString level = fanMode == "auto" ? QString("auto") : (fanMode == "full-speed" ? QString("full-speed") : QString::number(fanLevel));
+    writeFile("/proc/acpi/ibm/fan", QString("status:\t\tenabled\nspeed:\t\t%1\nlevel:\t\t%2\n")
+              .arg(fanMode == "full-speed" ? 5200 : fanLevel * 600).arg(level));
+
+    writeFile("/proc/stat", QString("cpu  %1 0 0 %2 0 0 0 0 0 0\n")
+              .arg((qlonglong)busyJiffies).arg((qlonglong)idleJiffies));
+
+    writeFile(HWMON "/temp1_input", QString::number((int)(cpuTemp * 1000)));
+    for (int i = 0; i < SIM_THREADS / 2; i++)                       // cores differ a bit
+        writeFile(QString(HWMON "/temp%1_input").arg(i + 2), QString::number((int)(cpuTemp * 1000) - i * 1500));
+
+    int pct = (int)(batCapacity * 100 / SIM_BAT_DESIGN_CAPACITY);
+    double power = heatAt(time) * freqScale() + SIM_BASE_POWER;
+
+    writeFile(SMAPI "/ac_connected", acConnected ? "1" : "0");
+    writeFile(SMAPI "/BAT0/state", acConnected ? (pct < 85 ? "charging" : "idle") : "discharging");
+    writeFile(SMAPI "/BAT0/remaining_percent", QString::number(pct));
+    writeFile(SMAPI "/BAT0/remaining_capacity", QString::number((int)batCapacity));
+    writeFile(SMAPI "/BAT0/voltage", QString::number(SIM_BAT_VOLTAGE + pct * 10));
+    writeFile(SMAPI "/BAT0/remaining_running_time", acConnected ? QString("not_discharging") :
+              QString::number((int)(batCapacity / 1000 / power * 60)));
+    writeFile(SMAPI "/BAT0/remaining_charging_time", acConnected ?
+              QString::number((int)((SIM_BAT_DESIGN_CAPACITY * 0.85 - batCapacity) / 1000 / SIM_CHARGE_POWER * 60)) :
+              QString("not_charging"));
+}
+
+QString Simulator::path(const QString &p)
+{
+    return QString(root).append(p);
+}
+
+bool Simulator::writeFile(const QString &p, const QString &val)
+{
+    QFile f(path(p));
+
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray b = val.toLocal8Bit();
+    if (!b.endsWith('\n'))
+        b.append('\n');
+
+    return f.write(b) == b.size();
+}
+
+QString Simulator::readFile(const QString &p)
+{
+    QFile f(path(p));
+
+    if (!f.open(QIODevice::ReadOnly))
+        return QString();
+
+    return QString(f.readLine()).trimmed();
+}
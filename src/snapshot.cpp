@@ -0,0 +1,378 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "h/snapshot.h"
+#include "h/reduce.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Writer holds a lock on its object for life. Object which can't be
+ * locked belongs to a running writer and is left alone, an unlocked one
+ * was left by a dead writer and is replaced. Old one stays locked until
+ * the new one is, so two starting writers can't replace each other.
+ */
+
+SnapshotWriter::SnapshotWriter()
+{
+    ring = NULL;
+
+    int old = shm_open(SNAPSHOT_SHM_NAME, O_RDWR | O_CLOEXEC, 0);
+    if (old == -1 && errno != ENOENT) {
+        qDebug() << "Shared memory" << SNAPSHOT_SHM_NAME << "belongs to another writer";
+        fd = -1;
+        return;
+    }
+    if (old != -1 && flock(old, LOCK_EX | LOCK_NB) == -1) {
+        qDebug() << "Snapshots are published by another process";
+        close(old);
+        fd = -1;
+        return;
+    }
+    if (old != -1)
+        shm_unlink(SNAPSHOT_SHM_NAME);
+
+    fd = shm_open(SNAPSHOT_SHM_NAME, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd != -1 && flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (old != -1)
+        close(old);
+    if (fd == -1) {
+        qDebug() << "Cannot open shared memory" << SNAPSHOT_SHM_NAME;
+        return;
+    }
+
+    fchmod(fd, 0644);                           // umask shouldn't hide it from readers
+
+    if (ftruncate(fd, sizeof(SnapshotRing)) == 0) {
+        void *p = mmap(NULL, sizeof(SnapshotRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            ring = (SnapshotRing *)p;
+    }
+
+    if (ring == NULL) {
+        qDebug() << "Cannot map shared memory" << SNAPSHOT_SHM_NAME;
+        shm_unlink(SNAPSHOT_SHM_NAME);
+        close(fd);
+        fd = -1;
+        return;
+    }
+
+    memset((void *)ring, 0, sizeof(SnapshotRing));
+    ring->version = SNAPSHOT_VERSION;
+    ring->size = SNAPSHOT_RING_SIZE;
+    __sync_synchronize();
+    ring->magic = SNAPSHOT_MAGIC;
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if (ring) {
+        ring->magic = 0;
+        munmap(ring, sizeof(SnapshotRing));
+        shm_unlink(SNAPSHOT_SHM_NAME);          // still locked, so it's ours
+        close(fd);
+    }
+}
+
+bool SnapshotWriter::isOpened()
+{
+    return ring != NULL;
+}
+
+void SnapshotWriter::publish(const SensorSnapshot &s)
+{
+    if (ring == NULL)
+        return;
+
+    uint64_t head = ring->head;
+    SnapshotSlot *slot = &ring->slot[head % SNAPSHOT_RING_SIZE];
+
+    slot->seq++;                                // odd - update in progress
+    __sync_synchronize();
+    memcpy(&slot->data, &s, sizeof(SensorSnapshot));
+    __sync_synchronize();
+    slot->seq++;
+
+    __sync_synchronize();
+    ring->head = head + 1;
+}
+
+SnapshotReader::SnapshotReader()
+{
+    ring = NULL;
+    lastHead = 0;
+    open();
+    checked.start();
+}
+
+SnapshotReader::~SnapshotReader()
+{
+    close();
+}
+
+bool SnapshotReader::open()
+{
+    int fd = shm_open(SNAPSHOT_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SnapshotRing)) {
+        void *p = mmap(NULL, sizeof(SnapshotRing), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            ring = (SnapshotRing *)p;
+            dev = st.st_dev;
+            ino = st.st_ino;
+            lastHead = ring->head;
+            advanced.start();
+        }
+    }
+
+    ::close(fd);
+
+    return ring != NULL;
+}
+
+void SnapshotReader::close()
+{
+    if (ring)
+        munmap(ring, sizeof(SnapshotRing));
+    ring = NULL;
+}
+
+/*
+ * Restarted writer unlinks old object and creates a new one, so the old
+ * mapping just stops advancing. Mapping is replaced when the name points
+ * to another object now.
+ */
+
+void SnapshotReader::checkWriter()
+{
+    if (ring != NULL) {
+        if (ring->head != lastHead) {
+            lastHead = ring->head;
+            advanced.start();
+        }
+        if (isOpened() && advanced.elapsed() < SNAPSHOT_STALE_MS)
+            return;
+    }
+
+    if (checked.elapsed() < SNAPSHOT_REOPEN_MS)
+        return;
+    checked.start();
+
+    int fd = shm_open(SNAPSHOT_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    bool same = false;
+
+    if (fd != -1) {
+        same = ring != NULL && fstat(fd, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+        ::close(fd);
+    }
+
+    if (fd == -1 || same)
+        return;
+
+    close();
+    open();
+}
+
+bool SnapshotReader::isOpened()
+{
+    return ring != NULL && ring->magic == SNAPSHOT_MAGIC && ring->version == SNAPSHOT_VERSION;
+}
+
+int SnapshotReader::latest(SensorSnapshot *out, int n)
+{
+    checkWriter();
+
+    if (!isOpened())
+        return 0;
+
+    uint64_t head = ring->head;
+    int cnt = 0;
+
+    if (n > SNAPSHOT_RING_SIZE - 1)             // writer may be inside the oldest slot
+        n = SNAPSHOT_RING_SIZE - 1;
+
+    while (cnt < n && (uint64_t)cnt < head) {
+        const SnapshotSlot *slot = &ring->slot[(head - 1 - cnt) % SNAPSHOT_RING_SIZE];
+        uint32_t s1, s2;
+        int tries = 0;
+
+        do {
+            if (++tries > SNAPSHOT_MAX_RETRIES)
+                return cnt;                     // writer stopped inside the slot
+            s1 = slot->seq;
+            __sync_synchronize();
+            memcpy(&out[cnt], (const void *)&slot->data, sizeof(SensorSnapshot));
+            __sync_synchronize();
+            s2 = slot->seq;
+        } while ((s1 & 1) || s1 != s2);
+
+        cnt++;
+    }
+
+    return cnt;
+}
+
+SnapshotPublisher::SnapshotPublisher(SampleBus *bus, const QList<Battery *> &b)
+{
+    samples = new SampleSubscriber(bus, 0, this);
+    connect(samples, SIGNAL(sampleReady()), this, SLOT(publish()));
+    bats = b;
+
+    powerSaving = false;
+    wakeupRate = 0;
+}
+
+void SnapshotPublisher::setPowerSaving(bool st)
+{
+    powerSaving = st;
+}
+
+void SnapshotPublisher::setWakeupRate(double r)
+{
+    wakeupRate = r;
+}
+
+void SnapshotPublisher::publish()
+{
+    SensorSnapshot s;
+    Sample smp;
+    struct timespec ts;
+
+    if (!writer.isOpened() || !samples->latest(&smp))
+        return;
+
+    memset(&s, 0, sizeof(s));
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s.timestamp = (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+
+    memcpy(s.thermal, smp.thermal, sizeof(s.thermal));
+    s.cpuTemp = smp.cpu.max;
+    s.fanLevel = smp.fanLevel;
+    s.fanSpeed = smp.fanSpeed;
+
+    if (!bats.isEmpty()) {              // refreshed on battery ticks
+        BatterySnapshot b = sumBatteries(bats);
+
+        s.acConnected = b.acConnected;
+        s.batInstalled = b.installed;
+
+        if (s.batInstalled) {
+            s.batChargeLvl = b.chargeLvl;
+            s.batVoltage = b.voltage;
+            s.batRemainingCapacity = b.remainingCapacity;
+        }
+    }
+
+    s.powerSaving = powerSaving;
+    s.wakeupRate = wakeupRate;
+
+    writer.publish(s);
+}
+
+SnapshotFeeder::SnapshotFeeder(SampleBus *b, QObject *parent) :
+    QObject(parent)
+{
+    bus = b;
+    lastTimestamp = 0;
+    powerSaving = false;
+    wakeupRate = 0;
+
+    for (int i = 0; i < THERMAL_SLOTS; i++)
+        trend[i] = SENSOR_NONE << EWMA_FRAC_BITS;
+
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(poll()));
+    timer->start(SNAPSHOT_POLL_INTERVAL);
+    poll();
+}
+
+bool SnapshotFeeder::isPowerSaving()
+{
+    return powerSaving;
+}
+
+double SnapshotFeeder::getWakeupRate()
+{
+    return wakeupRate;
+}
+
+void SnapshotFeeder::stop()
+{
+    timer->stop();
+}
+
+/* Snapshots newer than last published one go to bus, oldest first */
+
+void SnapshotFeeder::poll()
+{
+    SensorSnapshot snaps[SNAPSHOT_FEED_MAX];
+    int n = reader.latest(snaps, SNAPSHOT_FEED_MAX);
+
+    if (n > 0 && snaps[0].timestamp < lastTimestamp)
+        lastTimestamp = 0;                      // restarted writer, or clock went back
+
+    for (int i = n - 1; i >= 0; i--)
+        if (snaps[i].timestamp > lastTimestamp)
+            feed(snaps[i]);
+
+    if (n == 0)
+        return;
+
+    lastTimestamp = snaps[0].timestamp;
+
+    if (snaps[0].powerSaving != powerSaving) {
+        powerSaving = snaps[0].powerSaving;
+        emit powerSavingChanged(powerSaving);
+    }
+    if (snaps[0].wakeupRate != wakeupRate) {
+        wakeupRate = snaps[0].wakeupRate;
+        emit wakeupRateUpdated(wakeupRate);
+    }
+}
+
+void SnapshotFeeder::feed(const SensorSnapshot &s)
+{
+    Sample smp;
+
+    memset(&smp, 0, sizeof(smp));
+
+    memcpy(smp.thermal, s.thermal, sizeof(smp.thermal));
+    smp.maxRise = ewmaMaxRise(trend, smp.thermal, THERMAL_SLOTS);
+    ewmaUpdate(trend, smp.thermal, THERMAL_SLOTS);
+    reduceZones(smp.thermal, THERMAL_SLOTS, &smp.thermStats);
+
+    smp.cpu.max = s.cpuTemp;
+    smp.cpu.avg = s.cpuTemp;
+    smp.fanSpeed = s.fanSpeed;
+    smp.fanLevel = s.fanLevel;
+
+    bus->publish(smp, (qint64)s.timestamp - bus->getEpoch());     // when it was sampled
+}
@@ -0,0 +1,143 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/thermalmodel.h"
+#include "h/devices.h"
+
+#include <math.h>
+
+#define THERMAL_INIT_COV 1000.0
+#define THERMAL_MAX_COV 1.0e6           // stop forgetting when nothing excites the model
+#define THERMAL_RESIDUAL_WEIGHT 0.1
+
+ThermalZoneModel::ThermalZoneModel()
+{
+    reset();
+}
+
+void ThermalZoneModel::reset()
+{
+    for (int i = 0; i < THERMAL_PARAMS; i++) {
+        theta[i] = 0;
+        prevX[i] = 0;
+        for (int j = 0; j < THERMAL_PARAMS; j++)
+            cov[i][j] = i == j ? THERMAL_INIT_COV : 0;
+    }
+
+    prevTemp = SENSOR_NONE;
+    samples = 0;
+    residual = THERMAL_MAX_RESIDUAL * 2;
+}
+
+/* Scaled so all regressors are around 1 and covariance stays conditioned */
+
+void ThermalZoneModel::regressors(int temp, int rpm, int load, double *x)
+{
+    double t = temp / 100.0;
+    double r = rpm / 5000.0;
+
+    x[0] = 1;
+    x[1] = t;
+    x[2] = r;
+    x[3] = r * t;
+    x[4] = load / 100.0;
+}
+
+/*
+ * Sample pairs (previous regressors, observed dT/dt) are fed into RLS.
+ * Fit error is taken before parameters are updated, so it tells how
+ * well the model predicted this step.
+ */
+
+void ThermalZoneModel::update(int temp, int rpm, int load, double dt)
+{
+    if (temp == SENSOR_NONE || dt > THERMAL_MAX_DT) {
+        reset();
+        return;
+    }
+
+    if (prevTemp != SENSOR_NONE && dt > 0) {
+        double y = (temp - prevTemp) / dt;
+        double px[THERMAL_PARAMS];
+        double denom = THERMAL_FORGET;
+        double e = y;
+        double trace = 0;
+
+        for (int i = 0; i < THERMAL_PARAMS; i++) {
+            px[i] = 0;
+            for (int j = 0; j < THERMAL_PARAMS; j++)
+                px[i] += cov[i][j] * prevX[j];
+            denom += prevX[i] * px[i];
+            e -= theta[i] * prevX[i];
+        }
+
+        for (int i = 0; i < THERMAL_PARAMS; i++)
+            theta[i] += px[i] / denom * e;
+
+        for (int i = 0; i < THERMAL_PARAMS; i++) {
+            for (int j = 0; j < THERMAL_PARAMS; j++)
+                cov[i][j] -= px[i] * px[j] / denom;
+            trace += cov[i][i];
+        }
+
+        if (trace < THERMAL_MAX_COV)
+            for (int i = 0; i < THERMAL_PARAMS; i++)
+                for (int j = 0; j < THERMAL_PARAMS; j++)
+                    cov[i][j] /= THERMAL_FORGET;
+
+        residual += THERMAL_RESIDUAL_WEIGHT * (fabs(e) - residual);
+        samples++;
+    }
+
+    regressors(temp, rpm, load, prevX);
+    prevTemp = temp;
+}
+
+bool ThermalZoneModel::isTrained()
+{
+    return samples >= THERMAL_MIN_SAMPLES && residual < THERMAL_MAX_RESIDUAL;
+}
+
+/*
+ * With rpm and load fixed the model is dT/dt = a + b*T. For b < 0 it
+ * settles exponentially to -a/b, otherwise it's extrapolated linearly.
+ */
+
+int ThermalZoneModel::predict(double horizon)
+{
+    if (prevTemp == SENSOR_NONE || !isTrained())
+        return prevTemp;
+
+    double a = theta[0] + theta[2] * prevX[2] + theta[4] * prevX[4];
+    double b = (theta[1] + theta[3] * prevX[2]) / 100.0;
+    double t;
+
+    if (b < -1.0e-4) {
+        double eq = -a / b;
+        t = eq + (prevTemp - eq) * exp(b * horizon);
+    } else
+        t = prevTemp + (a + b * prevTemp) * horizon;
+
+    if (t > prevTemp + THERMAL_MAX_LEAD)
+        t = prevTemp + THERMAL_MAX_LEAD;
+    else if (t < prevTemp - THERMAL_MAX_LEAD)
+        t = prevTemp - THERMAL_MAX_LEAD;
+
+    return (int)floor(t + 0.5);
+}
@@ -0,0 +1,527 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <QApplication>
+#include <QMetaObject>
+#include <QStringList>
+#include "h/mainwindow.h"
+#include "h/simulator.h"
+#include "h/batterylog.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define BENCH_ITERATIONS 20000
+#define BENCH_GUI_ITERATIONS 2000
+#define CHECK_BATLOG_RECORDS 12             // a minute apart, half of them in the next hour
+#define SYSCALL_TRACEPOINT "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id"
+#define SYSCALL_TRACEPOINT_OLD "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+
+/*
+ * Microbenchmarks of sampling and governor hot paths on a fake hardware
+ * tree made by Simulator. For every path it prints ns/op, allocations/op
+ * (malloc calls, operator new included) and syscalls/op (needs access to
+ * raw_syscalls tracepoint, i.e. root or perf_event_paranoid <= -1).
+ *
+ *   thinkctl_bench [--root DIR] [--iterations N]
+ *
+ * MainWindow::refreshValues() is measured only when DISPLAY is set.
+ * Before measuring, BatteryLog is checked to read back what it recorded,
+ * bench exits with 1 if it doesn't.
+ */
+
+/* Count malloc calls made while measuring */
+
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+
+static volatile bool countAllocs = false;
+static unsigned long allocs = 0;
+
+extern "C" void *malloc(size_t n)
+{
+    if (countAllocs)
+        allocs++;
+    return __libc_malloc(n);
+}
+
+extern "C" void *calloc(size_t n, size_t s)
+{
+    if (countAllocs)
+        allocs++;
+    return __libc_calloc(n, s);
+}
+
+extern "C" void *realloc(void *p, size_t n)
+{
+    if (countAllocs)
+        allocs++;
+    return __libc_realloc(p, n);
+}
+
+static int openSyscallCounter()
+{
+    struct perf_event_attr attr;
+    FILE *f = fopen(SYSCALL_TRACEPOINT, "r");
+    int id = -1;
+
+    if (!f)
+        f = fopen(SYSCALL_TRACEPOINT_OLD, "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "%d", &id) != 1)
+        id = -1;
+    fclose(f);
+    if (id == -1)
+        return -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.disabled = 1;
+    attr.sample_period = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long nowNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class Bench {
+public:
+    Bench(int n);
+    ~Bench();
+
+    void run(const char *name, void (*fn)(void *), void *ctx);
+
+private:
+    int iterations;
+    int syscallFd;
+    long long syscallOverhead;      // counted by enable/disable themselves
+
+    long long countSyscalls(void (*fn)(void *), void *ctx, int n);
+};
+
+Bench::Bench(int n)
+{
+    iterations = n;
+    syscallFd = openSyscallCounter();
+    syscallOverhead = 0;
+
+    if (syscallFd == -1)
+        fprintf(stderr, "raw_syscalls tracepoint isn't accessible, syscalls/op not measured\n");
+    else
+        syscallOverhead = countSyscalls(NULL, NULL, 0);
+
+    printf("%-34s %12s %12s %12s\n", "path", "ns/op", "allocs/op", "syscalls/op");
+}
+
+Bench::~Bench()
+{
+    if (syscallFd != -1)
+        close(syscallFd);
+}
+
+long long Bench::countSyscalls(void (*fn)(void *), void *ctx, int n)
+{
+    unsigned long long cnt = 0;
+
+    ioctl(syscallFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(syscallFd, PERF_EVENT_IOC_ENABLE, 0);
+    for (int i = 0; i < n; i++)
+        fn(ctx);
+    ioctl(syscallFd, PERF_EVENT_IOC_DISABLE, 0);
+
+    if (read(syscallFd, &cnt, sizeof(cnt)) != sizeof(cnt))
+        return 0;
+
+    return (long long)cnt - syscallOverhead;
+}
+
+void Bench::run(const char *name, void (*fn)(void *), void *ctx)
+{
+    long long start, elapsed;
+
+    for (int i = 0; i < iterations / 10 + 1; i++)           // warm up caches
+        fn(ctx);
+
+    allocs = 0;
+    countAllocs = true;
+    start = nowNs();
+    for (int i = 0; i < iterations; i++)
+        fn(ctx);
+    elapsed = nowNs() - start;
+    countAllocs = false;
+
+    printf("%-34s %12.1f %12.2f ", name, (double)elapsed / iterations, (double)allocs / iterations);
+
+    if (syscallFd != -1)
+        printf("%12.2f\n", (double)countSyscalls(fn, ctx, iterations) / iterations);
+    else
+        printf("%12s\n", "n/a");
+
+    fflush(stdout);
+}
+
+static void benchUpdateThermValues(void *p)
+{
+    ((SensorsArray *)p)->updateThermValues();
+}
+
+static void benchCpuGetTemp(void *p)
+{
+    volatile int t = ((SensorsArray *)p)->cpu->getTemp();
+    (void)t;
+}
+
+static void benchCpuRefresh(void *p)
+{
+    ((SensorsArray *)p)->cpu->refresh();
+}
+
+static void benchFanGetLevel(void *p)
+{
+    volatile int l = ((Fan *)p)->getLevel().size();
+    (void)l;
+}
+
+static void benchFanGetSpeed(void *p)
+{
+    volatile int s = ((Fan *)p)->getSpeed();
+    (void)s;
+}
+
+/* Consumers only act on a new sample, so each iteration republishes one */
+
+static SampleBus *benchBus;
+static Sample benchSample;
+
+static void benchUpdateLevels(void *p)
+{
+    benchBus->publish(benchSample);
+    ((WLGovernor *)p)->updateLevels();
+}
+
+static void benchAdjustFanSpeed(void *p)
+{
+    ((Governor *)p)->adjustFanSpeed(benchSample);
+}
+
+static SampleBus *guiBus;
+
+static void benchRefreshValues(void *p)
+{
+    guiBus->publish(benchSample);
+    QMetaObject::invokeMethod((QObject *)p, "refreshValues");
+}
+
+/* Battery of the log check, its values are set by the check */
+
+class CheckBattery : public AbstractBatteryBackend {
+public:
+    CheckBattery();
+
+    BatterySnapshot next;
+
+    QString getName() { return "CHECK"; }
+    void read(BatterySnapshot *s) { *s = next; }
+    void readIdentity(BatterySnapshot *) {}
+
+    int getStartThreshold() { return 0; }
+    int getStopThreshold() { return 0; }
+    void setStartThreshold(int) {}
+    void setStopThreshold(int) {}
+};
+
+CheckBattery::CheckBattery()
+{
+    next.installed = true;
+    next.acConnected = false;
+    next.state = "discharging";
+    next.runningTime = next.chargingTime = 0;
+    next.cyclesCount = 123;
+    next.voltage = 12400;
+    next.remainingCapacity = 41000;
+    next.lastFullCapacity = 50000;
+    next.chargeLvl = 82;
+    next.designCapacity = next.designVoltage = 0;
+}
+
+static time_t checkTime;
+
+static time_t checkClock(time_t *t)
+{
+    if (t)
+        *t = checkTime;
+
+    return checkTime;
+}
+
+static BatteryLogRecord checkRecord(const BatterySnapshot &b)
+{
+    BatteryLogRecord r;
+
+    r.time = checkTime;
+    r.installed = b.installed;
+    r.acConnected = b.acConnected;
+    r.voltage = b.voltage;
+    r.remainingCapacity = b.remainingCapacity;
+    r.lastFullCapacity = b.lastFullCapacity;
+    r.chargeLvl = b.chargeLvl;
+    r.cyclesCount = b.cyclesCount;
+
+    return r;
+}
+
+/* Compares what read() gave for [from, now] with expected records from that time */
+
+static bool checkRead(BatteryLog *log, time_t from, const QList<BatteryLogRecord> &expected)
+{
+    QList<BatteryLogRecord> got = log->read(from, checkTime);
+    int n = 0;
+
+    for (int i = 0; i < expected.size(); i++) {
+        const BatteryLogRecord &e = expected.at(i);
+
+        if (e.time < from)
+            continue;
+        if (n >= got.size())
+            return false;
+
+        const BatteryLogRecord &g = got.at(n++);
+        if (g.time != e.time || g.installed != e.installed || g.acConnected != e.acConnected ||
+                g.voltage != e.voltage || g.remainingCapacity != e.remainingCapacity ||
+                g.lastFullCapacity != e.lastFullCapacity || g.chargeLvl != e.chargeLvl ||
+                g.cyclesCount != e.cyclesCount)
+            return false;
+    }
+
+    return n == got.size();
+}
+
+/*
+ * Records across an hour boundary, then the log is opened again with its
+ * last record torn and once more without index. Every time whole range
+ * and range from the boundary (found through index) must read back as
+ * recorded. Returns what failed, NULL if nothing.
+ */
+
+static const char *batteryLogRoundTrip(const QString &dir, CheckBattery *backend, Battery *bat)
+{
+    QList<BatteryLogRecord> expected;
+    QString path = dir + "/" + bat->getName();
+    time_t boundary = (time(NULL) / 3600 - 24) * 3600;      // a day ago, well inside index
+    time_t start = boundary - CHECK_BATLOG_RECORDS / 2 * (BATLOG_MIN_INTERVAL + 1) + 1;
+    struct stat st;
+    BatteryLog *log;
+    bool ok;
+
+    checkTime = start;
+    log = new BatteryLog(bat, dir);                         // records current values
+    if (!log->isWritable()) {
+        delete log;
+        return "log isn't writable";
+    }
+    expected.append(checkRecord(bat->getSnapshot()));
+
+    for (int i = 1; i < CHECK_BATLOG_RECORDS; i++) {
+        checkTime += BATLOG_MIN_INTERVAL + 1;
+        backend->next.voltage -= 7;
+        backend->next.remainingCapacity -= 150 + i;
+        backend->next.chargeLvl = backend->next.remainingCapacity * 100 / backend->next.lastFullCapacity;
+        if (i == CHECK_BATLOG_RECORDS - 2)
+            backend->next.acConnected = true;
+        bat->refresh();
+        expected.append(checkRecord(bat->getSnapshot()));
+    }
+
+    ok = checkRead(log, start, expected) && checkRead(log, boundary, expected);
+    delete log;
+    if (!ok)
+        return "records across hour boundary differ";
+
+    /* Torn tail is cut on open, then current values are recorded again */
+    QByteArray logPath = (path + ".log").toLocal8Bit();
+    if (stat(logPath.constData(), &st) == -1 || truncate(logPath.constData(), st.st_size - 1) == -1)
+        return "cannot truncate log";
+    expected.removeLast();
+
+    checkTime += 30;
+    log = new BatteryLog(bat, dir);
+    expected.append(checkRecord(bat->getSnapshot()));
+    ok = checkRead(log, start, expected) && checkRead(log, boundary, expected);
+    delete log;
+    if (!ok)
+        return "records after torn tail differ";
+
+    /* Lost index is rebuilt from the log */
+    if (unlink((path + ".idx").toLocal8Bit().constData()) == -1)
+        return "cannot remove index";
+
+    checkTime += 30;
+    log = new BatteryLog(bat, dir);
+    expected.append(checkRecord(bat->getSnapshot()));
+    ok = checkRead(log, start, expected) && checkRead(log, boundary, expected);
+    delete log;
+    if (!ok)
+        return "records after lost index differ";
+
+    return NULL;
+}
+
+static bool checkBatteryLog(const QString &root)
+{
+    QString dir = root + "/batlog";
+    CheckBattery *backend = new CheckBattery();
+    Battery bat(backend);
+    const char *err;
+
+    BatteryLog::setClock(checkClock);
+    err = batteryLogRoundTrip(dir, backend, &bat);
+    BatteryLog::setClock(time);
+
+    unlink((dir + "/" + bat.getName() + ".log").toLocal8Bit().constData());
+    unlink((dir + "/" + bat.getName() + ".idx").toLocal8Bit().constData());
+    rmdir(dir.toLocal8Bit().constData());
+
+    if (err)
+        printf("BatteryLog round trip FAILED: %s\n\n", err);
+    else
+        printf("BatteryLog round trip ok\n\n");
+
+    return err == NULL;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static QString argValue(const QStringList &args, const QString &name)
+{
+    int i = args.indexOf(name);
+
+    return i != -1 && i + 1 < args.size() ? args.at(i + 1) : QString();
+}
+
+/* Everything touching the tree lives here, so it's gone before tree is removed */
+
+static int runBenches(QApplication &a, const QString &root, bool gui)
+{
+    QStringList args = a.arguments();
+    int iterations = argValue(args, "--iterations").toInt();
+
+    if (iterations <= 0)
+        iterations = BENCH_ITERATIONS;
+
+    Simulator sim(root);
+    if (!sim.createTree())
+        return 1;
+    sim.step(1);
+
+    setHwRoot(root);
+
+    bool logOk = checkBatteryLog(root);
+
+    ProfileList profiles;
+    profiles.addInitialProfiles();
+
+    SampleBus bus;
+    SensorsArray sensorsArray;
+    sensorsArray.setSampleBus(&bus);
+    bus.latest(&benchSample);
+    benchBus = &bus;
+
+    Governor gov(&sensorsArray, &bus, profiles.at(0));
+    WLGovernor wlgov(&sensorsArray, &bus, &profiles);
+    Bench bench(iterations);
+
+    bench.run("SensorsArray::updateThermValues", benchUpdateThermValues, &sensorsArray);
+    bench.run("Cpu::refresh", benchCpuRefresh, &sensorsArray);
+    bench.run("Cpu::getTemp", benchCpuGetTemp, &sensorsArray);
+    bench.run("Fan::getLevel", benchFanGetLevel, (Fan *)&gov);
+    bench.run("Fan::getSpeed", benchFanGetSpeed, (Fan *)&gov);
+    bench.run("WLGovernor::updateLevels +publish", benchUpdateLevels, &wlgov);
+    bench.run("Governor::adjustFanSpeed", benchAdjustFanSpeed, &gov);
+    printf("%-34s %12lu written, %lu suppressed\n", "  fan writes",
+           gov.getWritesIssued(), gov.getWritesSuppressed());
+
+    if (gui) {
+        MainWindow w;
+        Bench guiBench(qMin(iterations, BENCH_GUI_ITERATIONS));
+
+        guiBus = w.stopSampling();
+
+        guiBench.run("MainWindow::refreshValues", benchRefreshValues, &w);
+    } else {
+        printf("%-34s %12s\n", "MainWindow::refreshValues", "skipped, no DISPLAY");
+    }
+
+    gov.setLevelAuto();
+
+    return logOk ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    bool gui = getenv("DISPLAY") != NULL;
+    char tmpl[] = "/tmp/thinkctl-bench-XXXXXX";
+    bool temporary = false;
+    QString root;
+
+    for (int i = 1; i + 1 < argc; i++)
+        if (!strcmp(argv[i], "--root"))
+            root = argv[i + 1];
+
+    if (root.isEmpty()) {
+        if (!mkdtemp(tmpl)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        root = tmpl;
+        temporary = true;
+    }
+
+    setenv("HOME", root.toLocal8Bit().constData(), 1);          // keep QSettings away from user files
+    setenv("XDG_CONFIG_HOME", QString(root).append("/config").toLocal8Bit().constData(), 1);
+
+    QApplication a(argc, argv, gui);
+    int ret = runBenches(a, root, gui);
+
+    if (temporary && nftw(tmpl, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+        perror("Cannot remove simulator tree");
+
+    return ret;
+}
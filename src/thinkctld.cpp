@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QCoreApplication>
+#include "h/devices.h"
+#include "h/settings.h"
+#include "h/fangovernor.h"
+#include "h/daemon.h"
+#include "h/snapshot.h"
+#include "h/batterylog.h"
+#include "h/sensorhistory.h"
+#include "h/scheduler.h"
+#include "h/samplebus.h"
+#include "h/uevent.h"
+
+/*
+ * Headless fan control daemon. Runs sampling and fan governor loop
+ * without X session, GUI connects to it through DaemonClient. Everything
+ * runs in one thread here, consumers still take samples from the bus.
+ *
+ * "--root DIR" makes it work on a fake /sys and /proc tree, e.g. one
+ * maintained by thinkctl_sim. "--group NAME" sets which group may send
+ * commands, it's "thinkctl" by default.
+ */
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = a.arguments();
+    int rootArg = args.indexOf("--root");
+    int groupArg = args.indexOf("--group");
+    QString group = THINKCTLD_GROUP;
+
+    if (rootArg != -1 && rootArg + 1 < args.size())
+        setHwRoot(args.at(rootArg + 1));
+    if (groupArg != -1 && groupArg + 1 < args.size())
+        group = args.at(groupArg + 1);
+
+    ProfileList profiles;
+
+    if (profiles.isSettingsExists())
+        profiles.loadProfiles();
+    else
+        profiles.addInitialProfiles();
+
+    Profile *profile = profiles.at(profiles.getCurrentProfile());
+
+    EventLoop loop;
+    SampleBus bus;
+    SensorHistory history(&bus, historyDir() + "/" + HISTORY_FILE);
+    SensorsArray sensorsArray;
+    sensorsArray.setSampleBus(&bus);
+    Scheduler scheduler(&loop, &sensorsArray, profile);
+    UeventMonitor uevents(&loop);
+    Governor gov(&sensorsArray, &bus, profile);
+    DaemonServer server(&gov, profile, group);
+
+    if (!server.isListening())                  // or another daemon runs
+        return 1;
+
+    QList<Battery *> bats = findBatteries();
+    SnapshotPublisher publisher(&bus, bats);
+    QList<BatteryLog *> batlogs;
+
+    QObject::connect(&scheduler, SIGNAL(thermalTick()), &sensorsArray, SLOT(updateThermValues()));
+    QObject::connect(&sensorsArray, SIGNAL(thermalValuesUpdated()), &scheduler, SLOT(thermalUpdated()));
+    QObject::connect(&uevents, SIGNAL(acChanged(bool)), &scheduler, SLOT(acChanged(bool)));
+    QObject::connect(&uevents, SIGNAL(powerSupplyChanged(QString)), &scheduler, SLOT(powerSupplyChanged()));
+    QObject::connect(&uevents, SIGNAL(thermalChanged(QString)), &scheduler, SLOT(thermalChanged()));
+    scheduler.setACEvents(uevents.isOpen());
+    QObject::connect(&server, SIGNAL(profileUpdated(Profile)), &gov, SLOT(profileChanged(Profile)));
+    QObject::connect(&server, SIGNAL(profileUpdated(Profile)), &scheduler, SLOT(profileChanged(Profile)));
+    QObject::connect(&scheduler, SIGNAL(powerSavingChanged(bool)), &publisher, SLOT(setPowerSaving(bool)));
+    QObject::connect(&scheduler, SIGNAL(wakeupRateUpdated(double)), &publisher, SLOT(setWakeupRate(double)));
+    for (int i = 0; i < bats.size(); i++)
+        QObject::connect(&scheduler, SIGNAL(batteryTick()), bats.at(i), SLOT(refresh()));
+    for (int i = 0; i < bats.size(); i++)
+        batlogs.append(new BatteryLog(bats.at(i), historyDir()));
+    publisher.setPowerSaving(scheduler.isPowerSaving());
+
+    gov.setMode(true);
+
+    int ret = a.exec();
+
+    gov.setLevelAuto();                         // leave fan to firmware
+    qDebug() << "Fan writes:" << gov.getWritesIssued() << "issued," << gov.getWritesSuppressed() << "suppressed";
+    profiles.saveProfiles();
+    qDeleteAll(batlogs);
+    qDeleteAll(bats);
+
+    return ret;
+}
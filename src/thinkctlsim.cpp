@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <QCoreApplication>
+#include <QStringList>
+#include "h/simulator.h"
+
+#include <stdio.h>
+
+/*
+ * Hardware simulator for running thinkctld and governors without a
+ * ThinkPad:
+ *
+ *   thinkctl_sim --root /tmp/tp [--script heat.txt] [--speedup 10]
+ *                [--duration 600] [--log]
+ *   thinkctld --root /tmp/tp
+ */
+
+static QString argValue(const QStringList &args, const QString &name)
+{
+    int i = args.indexOf(name);
+
+    return i != -1 && i + 1 < args.size() ? args.at(i + 1) : QString();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QStringList args = a.arguments();
+    QString root = argValue(args, "--root");
+
+    if (root.isEmpty()) {
+        fprintf(stderr, "usage: thinkctl_sim --root DIR [--script FILE] [--speedup N] "
+                "[--duration S] [--log]\n");
+        return 1;
+    }
+
+    Simulator sim(root);
+
+    if (!argValue(args, "--script").isEmpty() && !sim.loadScript(argValue(args, "--script")))
+        return 1;
+    if (!sim.createTree())
+        return 1;
+
+    if (!argValue(args, "--speedup").isEmpty())
+        sim.setSpeedup(argValue(args, "--speedup").toInt());
+    if (!argValue(args, "--duration").isEmpty())
+        sim.setDuration(argValue(args, "--duration").toDouble());
+    sim.setLog(args.contains("--log"));
+
+    QObject::connect(&sim, SIGNAL(finished()), &a, SLOT(quit()));
+    sim.start();
+
+    return a.exec();
+}
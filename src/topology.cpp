@@ -0,0 +1,281 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/topology.h"
+#include "h/devices.h"
+#include "h/reduce.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QStringList>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CPU_ONLINE_PATH "/sys/devices/system/cpu/online"
+#define CPU_TOPOLOGY_PATH "/sys/devices/system/cpu/cpu"
+#define HWMON_PATH "/sys/class/hwmon"
+#define THERMAL_ZONES_PATH "/sys/class/thermal"
+
+static int openInput(const QString &path)
+{
+    int fd = open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        qDebug() << "Cannot open" << path;
+
+    return fd;
+}
+
+static int readTopologyValue(int cpu, const char *name)
+{
+    QString path = hwPath(CPU_TOPOLOGY_PATH);
+    path.append(QString::number(cpu)).append("/topology/").append(name);
+
+    if (!QFile::exists(path))
+        return 0;
+
+    int v = getIntValueFromFile(path);
+
+    return v < 0 ? 0 : v;
+}
+
+CpuTopology::CpuTopology()
+{
+    packagesCnt = 0;
+
+    discoverThreads();
+
+    coreFd.fill(-1, coreIds.size());
+    packageFd.fill(-1, packagesCnt);
+
+    discoverHwmon();
+    if (coreFd.count(-1) == coreFd.size() && packageFd.count(-1) == packageFd.size())
+        discoverThermalZones();
+}
+
+CpuTopology::~CpuTopology()
+{
+    for (int i = 0; i < coreFd.size(); i++)
+        if (coreFd.at(i) != -1)
+            close(coreFd.at(i));
+
+    for (int i = 0; i < packageFd.size(); i++)
+        if (packageFd.at(i) != -1)
+            close(packageFd.at(i));
+}
+
+int CpuTopology::getThreadsCount()
+{
+    return threads.size();
+}
+
+int CpuTopology::getCoresCount()
+{
+    return coreIds.size();
+}
+
+int CpuTopology::getPackagesCount()
+{
+    return packagesCnt;
+}
+
+QList<CpuThread> CpuTopology::getThreads()
+{
+    return threads;
+}
+
+void CpuTopology::discoverThreads()
+{
+    QList<int> cpus = parseCpuList(getStringValueFromFile(hwPath(CPU_ONLINE_PATH)).toLocal8Bit().constData());
+
+    if (cpus.isEmpty())
+        cpus.append(0);
+
+    for (int i = 0; i < cpus.size(); i++) {
+        CpuThread t;
+
+        t.cpu = cpus.at(i);
+        t.package = readTopologyValue(t.cpu, "physical_package_id");
+        if (t.package >= CPU_MAX_PACKAGES)
+            t.package = CPU_MAX_PACKAGES - 1;
+        t.core = coreIndex(t.package, readTopologyValue(t.cpu, "core_id"));
+
+        if (t.package + 1 > packagesCnt)
+            packagesCnt = t.package + 1;
+
+        threads.append(t);
+    }
+}
+
+/* Returns index of physical core, adds new one if there is a room */
+
+int CpuTopology::coreIndex(int package, int coreId)
+{
+    int key = package * 1024 + coreId;
+    int i = coreIds.indexOf(key);
+
+    if (i == -1 && coreIds.size() < CPU_MAX_CORES) {
+        coreIds.append(key);
+        i = coreIds.size() - 1;
+    }
+
+    return i;
+}
+
+/*
+ * coretemp registers one hwmon device per package with "Package id N"
+ * and "Core K" labels, k10temp has only package wide Tctl/Tdie.
+ */
+
+void CpuTopology::discoverHwmon()
+{
+    QDir hwmon(hwPath(HWMON_PATH));
+    QStringList devs = hwmon.entryList(QStringList("hwmon*"), QDir::Dirs | QDir::NoDotAndDotDot);
+    int pkgOrd = 0;
+
+    for (int i = 0; i < devs.size(); i++) {
+        QString devPath = hwPath(HWMON_PATH).append('/').append(devs.at(i));
+        QString name;
+
+        if (QFile::exists(devPath + "/name"))
+            name = getStringValueFromFile(devPath + "/name");
+        else
+            continue;
+
+        if (name != "coretemp" && name != "k10temp")
+            continue;
+
+        QDir dev(devPath);
+        QStringList labels = dev.entryList(QStringList("temp*_label"), QDir::Files);
+        int pkg = pkgOrd < packagesCnt ? pkgOrd : packagesCnt - 1;
+        int pkgInput = -1;
+        QList<int> coreInputs, coreNums;
+
+        for (int j = 0; j < labels.size(); j++) {
+            QString labelPath = devPath + '/' + labels.at(j);
+            QString input = labelPath.left(labelPath.size() - 6).append("_input");
+            QString label = getStringValueFromFile(labelPath);
+
+            if (label.startsWith("Package id ")) {
+                pkg = label.mid(11).toInt();
+                pkgInput = openInput(input);
+            } else if (label.startsWith("Core ")) {
+                coreNums.append(label.mid(5).toInt());
+                coreInputs.append(openInput(input));
+            } else if ((label == "Tctl" || label == "Tdie") && pkgInput == -1) {
+                pkgInput = openInput(input);
+            }
+        }
+
+        if (pkg < 0 || pkg >= packagesCnt)
+            pkg = 0;
+
+        if (pkgInput != -1 && packageFd.at(pkg) == -1)
+            packageFd[pkg] = pkgInput;
+        else if (pkgInput != -1)
+            close(pkgInput);
+
+        for (int j = 0; j < coreInputs.size(); j++) {
+            int idx = coreIds.indexOf(pkg * 1024 + coreNums.at(j));
+
+            if (idx != -1 && coreFd.at(idx) == -1 && coreInputs.at(j) != -1)
+                coreFd[idx] = coreInputs.at(j);
+            else if (coreInputs.at(j) != -1)
+                close(coreInputs.at(j));
+        }
+
+        pkgOrd++;
+    }
+}
+
+/* Fallback without hwmon: x86_pkg_temp zones, or any first zone as package */
+
+void CpuTopology::discoverThermalZones()
+{
+    QDir thermal(hwPath(THERMAL_ZONES_PATH));
+    QStringList zones = thermal.entryList(QStringList("thermal_zone*"), QDir::Dirs | QDir::NoDotAndDotDot);
+    int pkg = 0;
+
+    for (int i = 0; i < zones.size() && pkg < packagesCnt; i++) {
+        QString zonePath = hwPath(THERMAL_ZONES_PATH).append('/').append(zones.at(i));
+
+        if (QFile::exists(zonePath + "/type") &&
+                getStringValueFromFile(zonePath + "/type") == "x86_pkg_temp")
+            packageFd[pkg++] = openInput(zonePath + "/temp");
+    }
+
+    if (pkg == 0 && !zones.isEmpty() && packagesCnt > 0)
+        packageFd[0] = openInput(hwPath(THERMAL_ZONES_PATH).append('/').append(zones.first()).append("/temp"));
+}
+
+void CpuTopology::refresh(CpuTemps *out)
+{
+    ZoneStats cs, ps;
+
+    out->cores = coreFd.size();
+    out->packages = packageFd.size();
+
+    for (int i = 0; i < coreFd.size(); i++)
+        out->core[i] = coreFd.at(i) != -1 ? readIntFromFd(coreFd.at(i)) / 1000 : SENSOR_NONE;  // millidegrees
+
+    for (int i = 0; i < packageFd.size(); i++)
+        out->package[i] = packageFd.at(i) != -1 ? readIntFromFd(packageFd.at(i)) / 1000 : SENSOR_NONE;
+
+    reduceZones(out->core, out->cores, &cs);
+    reduceZones(out->package, out->packages, &ps);
+
+    out->max = qMax(cs.max, ps.max);                    // SENSOR_NONE is below any value
+    out->avg = cs.count ? cs.mean : ps.mean;
+}
+
+/* Parse kernel cpu list format, e.g. "0-3,8-11,15" */
+
+QList<int> parseCpuList(const char *str)
+{
+    QList<int> cpus;
+    const char *p = str;
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p)
+            break;
+        p = end;
+
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1)
+                break;
+            p = end;
+        }
+
+        for (long i = first; i <= last && cpus.size() < 4096; i++)
+            cpus.append((int)i);
+
+        if (*p != ',')
+            break;
+        p++;
+    }
+
+    return cpus;
+}
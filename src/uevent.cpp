@@ -0,0 +1,154 @@
+/*
+    Copyright (C) 2012  vold@sdf.org
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "h/uevent.h"
+#include "h/devices.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+UeventMonitor::UeventMonitor(EventLoop *l)
+{
+    struct sockaddr_nl addr;
+    int rcvbuf = UEVENT_RCVBUF;
+
+    loop = l;
+    mainsName = findMainsSupply().section('/', -1);
+
+    sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (sock == -1) {
+        qDebug() << "Cannot open uevent socket";
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;                         // kernel events, udev rebroadcasts to 2
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || !loop->addFd(sock, EPOLLIN, this)) {
+        qDebug() << "Cannot listen to uevents";
+        close(sock);
+        sock = -1;
+    }
+}
+
+UeventMonitor::~UeventMonitor()
+{
+    if (sock != -1) {
+        loop->removeFd(sock);
+        close(sock);
+    }
+}
+
+bool UeventMonitor::isOpen()
+{
+    return sock != -1;
+}
+
+void UeventMonitor::handleEvent(int, uint32_t)
+{
+    char buf[UEVENT_BUF_SIZE];
+    struct sockaddr_nl from;
+    socklen_t fromLen;
+    int len;
+
+    for (;;) {
+        fromLen = sizeof(from);
+        len = recvfrom(sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &fromLen);
+
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == ENOBUFS) {
+                qDebug() << "Uevents were lost, resynchronizing";
+                emit powerSupplyChanged(QString());
+                emit thermalChanged(QString());
+                emit rfkillChanged(QString());
+                continue;
+            }
+
+            break;                              // EAGAIN, all read
+        }
+
+        if (from.nl_pid != 0)                   // only kernel is trusted
+            continue;
+
+        buf[len] = '\0';
+        parse(buf, len);
+    }
+}
+
+/* "action@devpath" header followed by NUL separated KEY=value pairs */
+
+void UeventMonitor::parse(const char *buf, int len)
+{
+    const char *end = buf + len;
+    const char *subsystem = NULL;
+    const char *devpath = NULL;
+    const char *psyName = NULL;
+    const char *psyType = NULL;
+    const char *psyOnline = NULL;
+    const char *rfkillType = NULL;
+
+    if (!strchr(buf, '@'))
+        return;
+
+    for (const char *p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1) {
+        if (!strncmp(p, "SUBSYSTEM=", 10))
+            subsystem = p + 10;
+        else if (!strncmp(p, "DEVPATH=", 8))
+            devpath = p + 8;
+        else if (!strncmp(p, "POWER_SUPPLY_NAME=", 18))
+            psyName = p + 18;
+        else if (!strncmp(p, "POWER_SUPPLY_TYPE=", 18))
+            psyType = p + 18;
+        else if (!strncmp(p, "POWER_SUPPLY_ONLINE=", 20))
+            psyOnline = p + 20;
+        else if (!strncmp(p, "RFKILL_TYPE=", 12))
+            rfkillType = p + 12;
+    }
+
+    if (!subsystem || !devpath)
+        return;
+
+    QString dev = QString(devpath).section('/', -1);
+
+    if (!strcmp(subsystem, "power_supply")) {
+        bool mains = psyType ? !strcmp(psyType, "Mains") : (psyName && mainsName == psyName);
+
+        if (mains && psyOnline)                 // TYPE is missing before 5.8 kernels
+            emit acChanged(atoi(psyOnline));
+
+        emit powerSupplyChanged(psyName ? QString(psyName) : dev);
+    } else if (!strcmp(subsystem, "thermal")) {
+        emit thermalChanged(dev);
+    } else if (!strcmp(subsystem, "rfkill")) {
+        emit rfkillChanged(rfkillType ? QString(rfkillType) : dev);
+    }
+}